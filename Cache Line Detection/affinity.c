@@ -0,0 +1,78 @@
+#include "affinity.h"
+#include "platform.h"
+
+#if PLATFORM_LINUX
+#include <sched.h>
+
+int pin_current_thread(int cpu)
+{
+	cpu_set_t set;
+
+	if(cpu < 0 || cpu >= CPU_SETSIZE)
+		return -1;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	/* pid 0 is the calling thread, not the whole process */
+	return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+int is_cpu_allowed(int cpu)
+{
+	cpu_set_t set;
+
+	if(cpu < 0 || cpu >= CPU_SETSIZE)
+		return 0;
+
+	if(sched_getaffinity(0, sizeof(set), &set) != 0)
+		return 1;
+
+	return CPU_ISSET(cpu, &set) != 0;
+}
+
+int get_cpu_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return count > 0 ? (int)count : 1;
+}
+
+#elif PLATFORM_MACOS
+#include <unistd.h>
+
+int pin_current_thread(int cpu)
+{
+	return -1;
+}
+
+int is_cpu_allowed(int cpu)
+{
+	return 1;
+}
+
+int get_cpu_count(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return count > 0 ? (int)count : 1;
+}
+
+#else
+
+int pin_current_thread(int cpu)
+{
+	return -1;
+}
+
+int is_cpu_allowed(int cpu)
+{
+	return 1;
+}
+
+int get_cpu_count(void)
+{
+	return 1;
+}
+
+#endif
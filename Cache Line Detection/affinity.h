@@ -0,0 +1,20 @@
+#ifndef AFFINITY_INC
+#define AFFINITY_INC
+
+/*
+	Pins the calling thread to one logical CPU, so a measurement isn't
+	migrated half way through. Returns 0 on success, -1 if the CPU doesn't
+	exist or the platform can't pin threads (macOS only has hints).
+*/
+int pin_current_thread(int cpu);
+
+/* Number of logical CPUs online. At least 1. */
+int get_cpu_count(void);
+
+/*
+	Whether the calling thread's affinity mask (a taskset or cgroup
+	cpuset, say) lets it run on "cpu". 1 where there's no mask to ask.
+*/
+int is_cpu_allowed(int cpu);
+
+#endif
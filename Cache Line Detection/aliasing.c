@@ -0,0 +1,236 @@
+#include "aliasing.h"
+#include "cache.h"
+#include "frequency.h"
+#include "stats.h"
+#include "profile.h"
+#include "fast_math.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_4K			4096
+
+/* Each stream covers half a page, so they never overlap for real */
+#define STREAM_ELEMENTS	(PAGE_4K / 2 / sizeof(uint64_t))
+
+/* Elements or pairs per trial, and trials per point */
+#define ACCESSES		(1024 * 1024)
+#define TRIALS			5
+
+/* Extra measurements a point that looks offending gets before it counts */
+#define RETRIES			3
+
+/* Keeps values alive and loops unvectorized, without adding work where there's inline asm */
+#if defined(__GNUC__)
+#define OPAQUE_UPDATE(x)	__asm__ volatile("" : "+r"(x))
+#else
+static volatile uint64_t opaqueSink;
+#define OPAQUE_UPDATE(x)	(opaqueSink = (x))
+#endif
+
+static uint64_t sink;
+
+static void run_streams(const uint64_t* load, uint64_t* store, unsigned int passes)
+{
+	uint64_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+	unsigned int pass, i;
+
+	for(pass = 0; pass < passes; ++pass)
+	{
+		for(i = 0; i < STREAM_ELEMENTS; i += 4)
+		{
+			sum0 += load[i];
+			store[i] = i;
+			sum1 += load[i + 1];
+			store[i + 1] = i;
+			sum2 += load[i + 2];
+			store[i + 2] = i;
+			sum3 += load[i + 3];
+			store[i + 3] = i;
+			OPAQUE_UPDATE(sum0);
+			OPAQUE_UPDATE(sum1);
+			OPAQUE_UPDATE(sum2);
+			OPAQUE_UPDATE(sum3);
+		}
+	}
+
+	sink = sum0 + sum1 + sum2 + sum3;
+}
+
+/* Each load stream of a pair walks a page, "lineSize" bytes at a time */
+static void run_pairs(const char* first, const char* second, unsigned int lineSize, unsigned int passes)
+{
+	uint32_t a0 = 0, a1 = 0, b0 = 0, b1 = 0;
+	unsigned int pass, i;
+
+	for(pass = 0; pass < passes; ++pass)
+	{
+		for(i = 0; i < PAGE_4K; i += 2 * lineSize)
+		{
+			a0 += *(const uint32_t*)(first + i);
+			b0 += *(const uint32_t*)(second + i);
+			a1 += *(const uint32_t*)(first + i + lineSize);
+			b1 += *(const uint32_t*)(second + i + lineSize);
+			OPAQUE_UPDATE(a0);
+			OPAQUE_UPDATE(b0);
+		}
+	}
+
+	sink = a0 + a1 + b0 + b1;
+}
+
+/* Median cycles per element */
+static double time_streams(const uint64_t* load, uint64_t* store, double ghz)
+{
+	const unsigned int passes = ACCESSES / STREAM_ELEMENTS;
+	double samples[TRIALS];
+	unsigned int trial;
+
+	run_streams(load, store, 1);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		run_streams(load, store, passes);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 * ghz / ((double)passes * STREAM_ELEMENTS);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+/* Median cycles per pair of loads */
+static double time_pairs(const char* first, const char* second, unsigned int lineSize, double ghz)
+{
+	const unsigned int pairLines = PAGE_4K / lineSize;
+	const unsigned int passes = ACCESSES / pairLines;
+	double samples[TRIALS];
+	unsigned int trial;
+
+	run_pairs(first, second, lineSize, 1);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		run_pairs(first, second, lineSize, passes);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 * ghz / ((double)passes * pairLines);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+static double offending_limit(const double* cycles, unsigned int count)
+{
+	return sample_median(cycles, count) * (1 + SIGNIFICANT_RISE);
+}
+
+static double lower(double a, double b)
+{
+	return a < b ? a : b;
+}
+
+int measure_aliasing(unsigned int lineSize, struct aliasing_result* result, const char** failure)
+{
+	/* Four pages, page aligned by hand, so the streams and pairs can start anywhere in one and run into the next */
+	char* raw = malloc(5 * PAGE_4K);
+	char* pages;
+	unsigned int i, retry;
+	double limit;
+
+	memset(result, 0, sizeof(*result));
+
+	if(!is_power_of_two(lineSize) || lineSize < 16 || lineSize > ALIASING_MAX_LINE)
+	{
+		free(raw);
+		*failure = "the line size isn't a power of two from 16 to 256 bytes";
+		return -1;
+	}
+
+	if(!raw)
+	{
+		*failure = "out of memory";
+		return -1;
+	}
+
+	result->lineSize = lineSize;
+	result->bankPoints = lineSize / BANK_STEP;
+
+	pages = (char*)(((uintptr_t)raw + PAGE_4K - 1) & ~(uintptr_t)(PAGE_4K - 1));
+	memset(pages, 0, 4 * PAGE_4K);
+
+	profile_phase_begin("frequency stabilization");
+	result->ghz = stabilize_core_frequency(1.0);
+	profile_phase_end();
+
+	/* The stores always start two pages in, the loads i * ALIASING_STEP bytes into the first page */
+	profile_phase_begin("4K aliasing probe");
+	for(i = 0; i < ALIASING_POINTS; ++i)
+		result->alias[i] = time_streams((const uint64_t*)(pages + i * ALIASING_STEP), (uint64_t*)(pages + 2 * PAGE_4K), result->ghz);
+
+	/* An interruption is slow once, a conflict every time: whatever looks offending gets a second chance */
+	limit = offending_limit(result->alias, ALIASING_POINTS);
+	for(i = 0; i < ALIASING_POINTS; ++i)
+		for(retry = 0; retry < RETRIES && result->alias[i] > limit; ++retry)
+			result->alias[i] = lower(result->alias[i], time_streams((const uint64_t*)(pages + i * ALIASING_STEP), (uint64_t*)(pages + 2 * PAGE_4K), result->ghz));
+	profile_phase_end();
+
+	/* The other line is a page and a half away, so its set differs */
+	profile_phase_begin("bank conflict probe");
+	for(i = 0; i < result->bankPoints; ++i)
+	{
+		result->sameLine[i] = time_pairs(pages, pages + i * BANK_STEP, lineSize, result->ghz);
+		result->otherLine[i] = time_pairs(pages, pages + PAGE_4K + PAGE_4K / 2 + i * BANK_STEP, lineSize, result->ghz);
+	}
+
+	limit = offending_limit(result->sameLine, result->bankPoints);
+	for(i = 0; i < result->bankPoints; ++i)
+		for(retry = 0; retry < RETRIES && result->sameLine[i] > limit; ++retry)
+			result->sameLine[i] = lower(result->sameLine[i], time_pairs(pages, pages + i * BANK_STEP, lineSize, result->ghz));
+
+	limit = offending_limit(result->otherLine, result->bankPoints);
+	for(i = 0; i < result->bankPoints; ++i)
+		for(retry = 0; retry < RETRIES && result->otherLine[i] > limit; ++retry)
+			result->otherLine[i] = lower(result->otherLine[i], time_pairs(pages, pages + PAGE_4K + PAGE_4K / 2 + i * BANK_STEP, lineSize, result->ghz));
+	profile_phase_end();
+
+	free(raw);
+	return 0;
+}
+
+unsigned int find_offending_ranges(const double* cycles, unsigned int count, struct offending_range* ranges, unsigned int max)
+{
+	double typical = sample_median(cycles, count);
+	double limit = offending_limit(cycles, count);
+	unsigned int found = 0;
+	unsigned int i = 0;
+
+	while(i < count)
+	{
+		struct offending_range range;
+
+		if(cycles[i] <= limit)
+		{
+			++i;
+			continue;
+		}
+
+		range.first = i;
+		range.worst = cycles[i];
+		range.typical = typical;
+
+		for(; i < count && cycles[i] > limit; ++i)
+			if(cycles[i] > range.worst)
+				range.worst = cycles[i];
+
+		range.last = i - 1;
+
+		if(found < max)
+			ranges[found] = range;
+		++found;
+	}
+
+	return found;
+}
@@ -0,0 +1,63 @@
+#ifndef ALIASING_INC
+#define ALIASING_INC
+
+/*
+	Address conflicts in the L1, everything in it resident.
+
+	4K aliasing: a load stream and a store stream run side by side, a
+	load and a store per element. A load whose address matches an older
+	store's in the low 12 bits is held until that store's full address
+	is known to differ, so some distances between the streams (modulo
+	4096) are much slower than the rest.
+
+	Bank conflicts: pairs of independent loads, the first at the start of
+	a line and the second at every offset within either the same line or
+	a line in another set. Cores with banked L1s can't serve two loads
+	to one bank in the same cycle. The pairs walk a page, a line apart.
+*/
+
+#define ALIASING_STEP		8
+#define ALIASING_POINTS		(4096 / ALIASING_STEP)
+
+#define ALIASING_MAX_LINE	256
+
+#define BANK_STEP			4
+#define BANK_MAX_POINTS		(ALIASING_MAX_LINE / BANK_STEP)
+
+struct aliasing_result
+{
+	double ghz;							/* The clock the cycles are counted in */
+	unsigned int lineSize;
+	unsigned int bankPoints;			/* lineSize / BANK_STEP */
+
+	/* Cycles per element, by (load - store) modulo 4096, in ALIASING_STEP bytes */
+	double alias[ALIASING_POINTS];
+
+	/* Cycles per pair of loads, by the second one's offset, in BANK_STEP bytes */
+	double sameLine[BANK_MAX_POINTS];
+	double otherLine[BANK_MAX_POINTS];
+};
+
+/*
+	Returns 0 on success, -1 with "failure" set for a line size that
+	isn't a power of two from 16 to ALIASING_MAX_LINE bytes, or out of
+	memory.
+*/
+int measure_aliasing(unsigned int lineSize, struct aliasing_result* result, const char** failure);
+
+/*
+	A run of neighbouring points that are more than SIGNIFICANT_RISE
+	slower than the median of all of them.
+*/
+struct offending_range
+{
+	unsigned int first;			/* Indices of the points */
+	unsigned int last;
+	double worst;				/* The slowest point in the range */
+	double typical;				/* The median of all points */
+};
+
+/* Fills at most "max" ranges and returns how many there were in all. */
+unsigned int find_offending_ranges(const double* cycles, unsigned int count, struct offending_range* ranges, unsigned int max);
+
+#endif
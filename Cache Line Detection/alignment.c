@@ -0,0 +1,282 @@
+#include "alignment.h"
+#include "cache.h"
+#include "frequency.h"
+#include "stats.h"
+#include "profile.h"
+#include "fast_math.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_4K		4096
+
+/* Accesses per trial, and trials per point */
+#define ACCESSES	(64 * 1024)
+#define TRIALS		3
+
+/* Extra measurements an offset that looks offending gets before it counts */
+#define RETRIES		3
+
+static const unsigned int accessWidths[ALIGNMENT_WIDTHS] = {2, 4, 8, 16, 32, 64};
+
+static int is_split(unsigned int lineSize, unsigned int width, unsigned int offset)
+{
+	return offset + width > lineSize;
+}
+
+double worst_alignment_cost(const struct alignment_map* map, unsigned int widthIndex, enum alignment_test test, enum alignment_kind kind)
+{
+	const unsigned int width = map->widths[widthIndex];
+	enum alignment_placement placement = kind == ALIGNMENT_PAGE_SPLIT ? ALIGNMENT_PAGE_END : ALIGNMENT_MID_PAGE;
+	double worst = -1;
+	unsigned int offset;
+
+	for(offset = 0; offset < map->lineSize; ++offset)
+	{
+		int split = is_split(map->lineSize, width, offset);
+		double cycles = map->cycles[widthIndex][placement][test][offset];
+
+		switch(kind)
+		{
+		case ALIGNMENT_ALIGNED:
+			if(offset != 0)
+				continue;
+			break;
+		case ALIGNMENT_MISALIGNED:
+			if(offset % width == 0 || split)
+				continue;
+			break;
+		default:
+			if(!split)
+				continue;
+			break;
+		}
+
+		if(cycles > worst)
+			worst = cycles;
+	}
+
+	return worst;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__) && (PLATFORM_LINUX || PLATFORM_MACOS)
+
+typedef uint16_t access2_t __attribute__((aligned(1), may_alias));
+typedef uint32_t access4_t __attribute__((aligned(1), may_alias));
+typedef uint64_t access8_t __attribute__((aligned(1), may_alias));
+typedef uint8_t access16_t __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint8_t access32_t __attribute__((vector_size(32), aligned(1), may_alias));
+typedef uint8_t access64_t __attribute__((vector_size(64), aligned(1), may_alias));
+
+#define TARGET_2
+#define TARGET_4
+#define TARGET_8
+#define TARGET_16
+#define TARGET_32	__attribute__((target("avx2")))
+#define TARGET_64	__attribute__((target("avx512f")))
+
+/* Forces every access to really happen, in order, without doing anything itself */
+#define BARRIER()	__asm__ volatile("" : : : "memory")
+
+/* Keeps a loaded value from being optimized away */
+#define USE_2(v)	__asm__ volatile("" : : "r"(v) : "memory")
+#define USE_4(v)	USE_2(v)
+#define USE_8(v)	USE_2(v)
+#define USE_16(v)	__asm__ volatile("" : : "x"(v) : "memory")
+#define USE_32(v)	USE_16(v)
+#define USE_64(v)	USE_16(v)
+
+/* Turns a loaded value, always 0, into an offset, so the next address really depends on it */
+#define TO_OFFSET_2(v, z)	((z) = (size_t)(v))
+#define TO_OFFSET_4(v, z)	TO_OFFSET_2(v, z)
+#define TO_OFFSET_8(v, z)	TO_OFFSET_2(v, z)
+#define TO_OFFSET_16(v, z)	__asm__("movq %x1, %0" : "=r"(z) : "x"(v))
+#define TO_OFFSET_32(v, z)	__asm__("vmovq %x1, %0" : "=r"(z) : "x"(v))
+#define TO_OFFSET_64(v, z)	TO_OFFSET_32(v, z)
+
+/*
+	A 0 the compiler can't see through. Reloading at base + index, where
+	the store went to base, keeps cores that rename memory by address
+	expression (Zen 2 and later among them) from handing the stored
+	register straight to the load, which would skip forwarding.
+*/
+#define HIDE_ZERO(z)	__asm__("" : "+r"(z))
+
+#define REPEAT_8(x)	x x x x x x x x
+
+#define DEFINE_ALIGNMENT_KERNELS(WIDTH) \
+	static TARGET_##WIDTH void load_throughput_##WIDTH(char* at, unsigned int count) \
+	{ \
+		unsigned int i; \
+		\
+		for(i = 0; i < count; i += 8) \
+		{ \
+			REPEAT_8({ access##WIDTH##_t v = *(access##WIDTH##_t*)at; USE_##WIDTH(v); }) \
+		} \
+	} \
+	\
+	static TARGET_##WIDTH void load_latency_##WIDTH(char* at, unsigned int count) \
+	{ \
+		unsigned int i; \
+		size_t z; \
+		\
+		for(i = 0; i < count; i += 8) \
+		{ \
+			REPEAT_8({ access##WIDTH##_t v = *(access##WIDTH##_t*)at; TO_OFFSET_##WIDTH(v, z); at += z; }) \
+		} \
+		\
+		USE_8(at); \
+	} \
+	\
+	static TARGET_##WIDTH void store_throughput_##WIDTH(char* at, unsigned int count) \
+	{ \
+		const access##WIDTH##_t zero = {0}; \
+		unsigned int i; \
+		\
+		for(i = 0; i < count; i += 8) \
+		{ \
+			REPEAT_8({ *(access##WIDTH##_t*)at = zero; BARRIER(); }) \
+		} \
+	} \
+	\
+	static TARGET_##WIDTH void store_forwarding_##WIDTH(char* at, unsigned int count) \
+	{ \
+		access##WIDTH##_t v = {0}; \
+		unsigned int i; \
+		size_t z, index = 0; \
+		\
+		HIDE_ZERO(index); \
+		for(i = 0; i < count; i += 8) \
+		{ \
+			REPEAT_8({ *(access##WIDTH##_t*)at = v; BARRIER(); v = *(access##WIDTH##_t*)(at + index); TO_OFFSET_##WIDTH(v, z); at += z; }) \
+		} \
+		\
+		USE_8(at); \
+	}
+
+DEFINE_ALIGNMENT_KERNELS(2)
+DEFINE_ALIGNMENT_KERNELS(4)
+DEFINE_ALIGNMENT_KERNELS(8)
+DEFINE_ALIGNMENT_KERNELS(16)
+DEFINE_ALIGNMENT_KERNELS(32)
+DEFINE_ALIGNMENT_KERNELS(64)
+
+typedef void (*alignment_kernel)(char* at, unsigned int count);
+
+#define WIDTH_KERNELS(WIDTH) {load_throughput_##WIDTH, load_latency_##WIDTH, store_throughput_##WIDTH, store_forwarding_##WIDTH}
+
+static const alignment_kernel kernels[ALIGNMENT_WIDTHS][ALIGNMENT_TEST_COUNT] = {
+	WIDTH_KERNELS(2),
+	WIDTH_KERNELS(4),
+	WIDTH_KERNELS(8),
+	WIDTH_KERNELS(16),
+	WIDTH_KERNELS(32),
+	WIDTH_KERNELS(64)
+};
+
+static int is_supported_width(unsigned int width)
+{
+	__builtin_cpu_init();
+
+	if(width == 32)
+		return __builtin_cpu_supports("avx2");
+	if(width == 64)
+		return __builtin_cpu_supports("avx512f");
+
+	return 1;
+}
+
+/* Median nanoseconds per access */
+static double time_kernel(alignment_kernel kernel, char* at)
+{
+	double samples[TRIALS];
+	unsigned int trial;
+
+	kernel(at, ACCESSES);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		kernel(at, ACCESSES);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / ACCESSES;
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+/* An interruption is slow once, a split every time: whatever looks offending gets a second chance */
+static void remeasure_offending(double* cycles, unsigned int count, alignment_kernel kernel, char* line, double ghz)
+{
+	double limit = sample_median(cycles, count) * (1 + SIGNIFICANT_RISE);
+	unsigned int offset, retry;
+
+	for(offset = 0; offset < count; ++offset)
+		for(retry = 0; retry < RETRIES && cycles[offset] > limit; ++retry)
+		{
+			double again = time_kernel(kernel, line + offset) * ghz;
+
+			if(again < cycles[offset])
+				cycles[offset] = again;
+		}
+}
+
+int measure_alignment_map(unsigned int lineSize, struct alignment_map* map)
+{
+	char* buffer = NULL;
+	char* lines[ALIGNMENT_PLACEMENT_COUNT];
+	unsigned int w, placement, test, offset;
+
+	if(!is_power_of_two(lineSize) || lineSize < 16 || lineSize > ALIGNMENT_MAX_LINE)
+		return -1;
+
+	/* Three pages: room on both sides of the line in the middle one, and one to split into */
+	if(posix_memalign((void**)&buffer, PAGE_4K, 3 * PAGE_4K) != 0)
+		return -1;
+
+	/* Every load reads 0, so a dependent address never moves */
+	memset(buffer, 0, 3 * PAGE_4K);
+	lines[ALIGNMENT_MID_PAGE] = buffer + PAGE_4K + lineSize;
+	lines[ALIGNMENT_PAGE_END] = buffer + 2 * PAGE_4K - lineSize;
+
+	memset(map, 0, sizeof(*map));
+	map->lineSize = lineSize;
+
+	profile_phase_begin("frequency stabilization");
+	map->ghz = stabilize_core_frequency(1.0);
+	profile_phase_end();
+
+	profile_phase_begin("alignment map");
+	for(w = 0; w < ALIGNMENT_WIDTHS; ++w)
+	{
+		map->widths[w] = accessWidths[w];
+		map->supported[w] = is_supported_width(accessWidths[w]);
+
+		for(placement = 0; placement < ALIGNMENT_PLACEMENT_COUNT; ++placement)
+			for(test = 0; test < ALIGNMENT_TEST_COUNT; ++test)
+			{
+				double* cycles = map->cycles[w][placement][test];
+
+				for(offset = 0; offset < lineSize; ++offset)
+					cycles[offset] = map->supported[w] ? time_kernel(kernels[w][test], lines[placement] + offset) * map->ghz : -1;
+
+				if(map->supported[w])
+					remeasure_offending(cycles, lineSize, kernels[w][test], lines[placement], map->ghz);
+			}
+	}
+	profile_phase_end();
+
+	free(buffer);
+	return 0;
+}
+
+#else
+
+int measure_alignment_map(unsigned int lineSize, struct alignment_map* map)
+{
+	return -1;
+}
+
+#endif
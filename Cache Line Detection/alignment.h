@@ -0,0 +1,68 @@
+#ifndef ALIGNMENT_INC
+#define ALIGNMENT_INC
+
+/*
+	What misalignment costs. Every access width is run at every offset
+	within a cache line, once in a line in the middle of a page, where
+	the accesses that don't fit split the line, and once in the last
+	line of a page, where they split the page too.
+
+	Widths the CPU has no instructions for (32 bytes without AVX2, 64
+	without AVX-512) are skipped. x86-64 Linux and macOS only, with GCC
+	or Clang.
+*/
+
+#define ALIGNMENT_WIDTHS		6		/* 2, 4, 8, 16, 32 and 64 bytes */
+#define ALIGNMENT_MAX_LINE		256
+
+enum alignment_test
+{
+	ALIGNMENT_LOAD_THROUGHPUT,		/* Independent loads */
+	ALIGNMENT_LOAD_LATENCY,			/* Each load's address depends on the one before */
+	ALIGNMENT_STORE_THROUGHPUT,		/* Independent stores */
+	ALIGNMENT_STORE_FORWARDING,		/* A store, then a load of it that the next store depends on */
+
+	ALIGNMENT_TEST_COUNT
+};
+
+enum alignment_placement
+{
+	ALIGNMENT_MID_PAGE,
+	ALIGNMENT_PAGE_END,
+
+	ALIGNMENT_PLACEMENT_COUNT
+};
+
+struct alignment_map
+{
+	unsigned int lineSize;
+	double ghz;							/* The clock the cycles are counted in */
+
+	unsigned int widths[ALIGNMENT_WIDTHS];
+	int supported[ALIGNMENT_WIDTHS];
+
+	/* Cycles per access, by width, placement, test and offset */
+	double cycles[ALIGNMENT_WIDTHS][ALIGNMENT_PLACEMENT_COUNT][ALIGNMENT_TEST_COUNT][ALIGNMENT_MAX_LINE];
+};
+
+/*
+	The worst cost over the offsets of one kind: aligned (offset 0 only),
+	misaligned within the line, splitting the line, or splitting the page.
+	-1 if no offset is of that kind.
+*/
+enum alignment_kind
+{
+	ALIGNMENT_ALIGNED,
+	ALIGNMENT_MISALIGNED,
+	ALIGNMENT_LINE_SPLIT,
+	ALIGNMENT_PAGE_SPLIT,
+
+	ALIGNMENT_KIND_COUNT
+};
+
+double worst_alignment_cost(const struct alignment_map* map, unsigned int widthIndex, enum alignment_test test, enum alignment_kind kind);
+
+/* Returns 0 on success, -1 if it can't run here or lineSize is out of range. */
+int measure_alignment_map(unsigned int lineSize, struct alignment_map* map);
+
+#endif
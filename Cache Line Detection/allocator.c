@@ -0,0 +1,288 @@
+#include "allocator.h"
+#include "threads.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Objects per trial, and trials per size */
+#define OBJECTS				4096
+#define TRIALS				5
+
+/* Per thread, in the sharing test */
+#define INCREMENTS			(16 * 1024 * 1024)
+
+/* Small objects malloc gets asked for while looking for two in one line */
+#define NEIGHBOUR_TRIES		64
+
+static const unsigned int objectSizes[ALLOCATOR_SIZES] = {8, 16, 24, 32, 48, 64, 96, 128, 256, 512, 1024, 4096};
+
+static const char* kindNames[ALLOCATOR_KIND_COUNT] = {"malloc", "posix_memalign", "aligned_alloc"};
+
+const char* allocator_kind_name(enum allocator_kind kind)
+{
+	return (unsigned int)kind < ALLOCATOR_KIND_COUNT ? kindNames[kind] : "?";
+}
+
+static int is_supported_kind(enum allocator_kind kind)
+{
+	switch(kind)
+	{
+	case ALLOCATOR_MALLOC:
+		return 1;
+#if PLATFORM_LINUX || PLATFORM_MACOS
+	case ALLOCATOR_POSIX_MEMALIGN:
+		return 1;
+#endif
+#if PLATFORM_LINUX
+	/* C11, which glibc declares under _GNU_SOURCE even for C99 */
+	case ALLOCATOR_ALIGNED_ALLOC:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+static void* allocate(enum allocator_kind kind, size_t size, size_t lineSize)
+{
+	void* block = NULL;
+
+	switch(kind)
+	{
+	case ALLOCATOR_MALLOC:
+		block = malloc(size);
+		break;
+#if PLATFORM_LINUX || PLATFORM_MACOS
+	case ALLOCATOR_POSIX_MEMALIGN:
+		if(posix_memalign(&block, lineSize, size) != 0)
+			block = NULL;
+		break;
+#endif
+#if PLATFORM_LINUX
+	case ALLOCATOR_ALIGNED_ALLOC:
+		block = aligned_alloc(lineSize, (size + lineSize - 1) & ~(lineSize - 1));
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return block;
+}
+
+/* The largest power of two dividing the address, from 8 up to the line, as a bucket index */
+static unsigned int alignment_bucket(uintptr_t address, unsigned int buckets)
+{
+	unsigned int bucket = 0;
+
+	while(bucket + 1 < buckets && address % ((uintptr_t)8 << (bucket + 1)) == 0)
+		bucket++;
+
+	return bucket;
+}
+
+static int is_straddling(uintptr_t address, size_t size, unsigned int lineSize)
+{
+	size_t lines = (address + size - 1) / lineSize - address / lineSize + 1;
+
+	return lines > (size + lineSize - 1) / lineSize;
+}
+
+/* Placement from one batch of fresh objects, the time from TRIALS more */
+static int measure_kind(enum allocator_kind kind, unsigned int size, unsigned int lineSize, unsigned int buckets, struct allocation_stats* stats)
+{
+	void** objects = malloc(OBJECTS * sizeof(void*));
+	double* gaps = malloc(OBJECTS * sizeof(double));
+	double samples[TRIALS];
+	unsigned int i, trial, gapCount = 0;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if(!objects || !gaps || !is_supported_kind(kind))
+	{
+		free(objects);
+		free(gaps);
+		return -1;
+	}
+
+	for(i = 0; i < OBJECTS; ++i)
+	{
+		uintptr_t address;
+
+		objects[i] = allocate(kind, size, lineSize);
+		if(!objects[i])
+			break;
+
+		address = (uintptr_t)objects[i];
+		stats->alignment[alignment_bucket(address, buckets)] += 1.0 / OBJECTS;
+		if(is_straddling(address, size, lineSize))
+			stats->straddling += 1.0 / OBJECTS;
+
+		if(i > 0)
+		{
+			uintptr_t previous = (uintptr_t)objects[i - 1];
+
+			gaps[gapCount++] = (double)(address > previous ? address - previous : previous - address);
+		}
+	}
+
+	stats->supported = i == OBJECTS;
+	stats->spacing = gapCount ? sample_median(gaps, gapCount) : 0;
+
+	while(i > 0)
+		free(objects[--i]);
+
+	for(trial = 0; trial < TRIALS && stats->supported; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		for(i = 0; i < OBJECTS; ++i)
+			objects[i] = allocate(kind, size, lineSize);
+		for(i = 0; i < OBJECTS; ++i)
+			free(objects[i]);
+
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / OBJECTS;
+	}
+
+	if(stats->supported)
+		stats->nanos = sample_median(samples, TRIALS);
+
+	free(objects);
+	free(gaps);
+	return stats->supported ? 0 : -1;
+}
+
+#if HAVE_THREADS
+
+struct sharing_run
+{
+	volatile uint64_t* counters[2];
+	struct thread_barrier barrier;
+	double begin[2];
+	double end[2];
+};
+
+static void sharing_thread(unsigned int index, void* context)
+{
+	struct sharing_run* run = context;
+	volatile uint64_t* counter = run->counters[index];
+	unsigned int i;
+
+	thread_barrier_wait(&run->barrier);
+	run->begin[index] = get_time_seconds();
+
+	for(i = 0; i < INCREMENTS; ++i)
+		(*counter)++;
+
+	run->end[index] = get_time_seconds();
+}
+
+/* Nanoseconds per increment, both threads at once; 0 if the threads didn't start */
+static double time_sharing(volatile uint64_t* first, volatile uint64_t* second)
+{
+	struct sharing_run run;
+	double samples[TRIALS];
+	unsigned int trial;
+
+	run.counters[0] = first;
+	run.counters[1] = second;
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		thread_barrier_init(&run.barrier, 2);
+		if(run_pinned_threads(2, sharing_thread, &run) != 0)
+		{
+			thread_barrier_destroy(&run.barrier);
+			return 0;
+		}
+		thread_barrier_destroy(&run.barrier);
+
+		samples[trial] = ((run.end[0] > run.end[1] ? run.end[0] : run.end[1]) -
+			(run.begin[0] < run.begin[1] ? run.begin[0] : run.begin[1])) * 1e9 / INCREMENTS;
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+/* Two counters malloc put next to each other, then two on lines of their own */
+static void measure_sharing(unsigned int lineSize, struct allocator_result* result)
+{
+	void* neighbours[NEIGHBOUR_TRIES];
+	void* padded[2] = {NULL, NULL};
+	unsigned int tries, pair = 0;
+
+	for(tries = 0; tries < NEIGHBOUR_TRIES; ++tries)
+	{
+		neighbours[tries] = calloc(1, sizeof(uint64_t));
+		if(!neighbours[tries])
+			break;
+
+		if(tries > 0 && (uintptr_t)neighbours[tries - 1] / lineSize == (uintptr_t)neighbours[tries] / lineSize)
+		{
+			result->sharedLine = 1;
+			pair = tries - 1;
+			++tries;
+			break;
+		}
+	}
+
+	if(tries >= 2)
+		result->packedNanos = time_sharing(neighbours[pair], neighbours[pair + 1]);
+
+	padded[0] = allocate(ALLOCATOR_POSIX_MEMALIGN, sizeof(uint64_t), lineSize);
+	padded[1] = allocate(ALLOCATOR_POSIX_MEMALIGN, sizeof(uint64_t), lineSize);
+	if(padded[0] && padded[1])
+	{
+		memset(padded[0], 0, sizeof(uint64_t));
+		memset(padded[1], 0, sizeof(uint64_t));
+		result->paddedNanos = time_sharing(padded[0], padded[1]);
+	}
+
+	free(padded[0]);
+	free(padded[1]);
+	while(tries > 0)
+		free(neighbours[--tries]);
+}
+
+#else
+
+static void measure_sharing(unsigned int lineSize, struct allocator_result* result)
+{
+}
+
+#endif
+
+int measure_allocator(unsigned int lineSize, struct allocator_result* result)
+{
+	unsigned int s, kind;
+
+	if(!is_power_of_two(lineSize) || lineSize < 16 || lineSize > 1024)
+		return -1;
+
+	memset(result, 0, sizeof(*result));
+	result->lineSize = lineSize;
+
+	while((8u << result->buckets) <= lineSize)
+		result->buckets++;
+
+	profile_phase_begin("allocator placement");
+	for(s = 0; s < ALLOCATOR_SIZES; ++s)
+	{
+		result->sizes[s] = objectSizes[s];
+
+		for(kind = 0; kind < ALLOCATOR_KIND_COUNT; ++kind)
+			measure_kind((enum allocator_kind)kind, objectSizes[s], lineSize, result->buckets, &result->stats[s][kind]);
+	}
+	profile_phase_end();
+
+	profile_phase_begin("false sharing");
+	measure_sharing(lineSize, result);
+	profile_phase_end();
+
+	return 0;
+}
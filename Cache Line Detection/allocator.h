@@ -0,0 +1,60 @@
+#ifndef ALLOCATOR_INC
+#define ALLOCATOR_INC
+
+/*
+	Where the system allocator puts objects, relative to cache lines.
+
+	Every allocator and size gets a few thousand objects in a row: how
+	their addresses are aligned (the largest power of two dividing them,
+	up to the line), how many straddle more lines than their size needs,
+	how far apart neighbours land (the real footprint, padding and
+	headers included), and what an allocation and its free cost.
+
+	Then the cost of sharing: two threads, each incrementing its own
+	counter, once with counters malloc put side by side in one line, once
+	with each on a line of its own.
+*/
+
+enum allocator_kind
+{
+	ALLOCATOR_MALLOC,
+	ALLOCATOR_POSIX_MEMALIGN,				/* Aligned to the line */
+	ALLOCATOR_ALIGNED_ALLOC,				/* Aligned to the line, the size rounded up to it as C11 wants */
+
+	ALLOCATOR_KIND_COUNT
+};
+
+#define ALLOCATOR_SIZES			12
+#define ALLOCATOR_MAX_BUCKETS	8			/* 8 bytes up to a 1KB line */
+
+struct allocation_stats
+{
+	int supported;
+
+	/* Fraction of objects whose alignment is 8B, 16B... up to the line; anything less counts as 8B */
+	double alignment[ALLOCATOR_MAX_BUCKETS];
+	double straddling;						/* Fraction spanning more lines than needed */
+	double spacing;							/* Median bytes between neighbours */
+	double nanos;							/* An allocation and its free */
+};
+
+struct allocator_result
+{
+	unsigned int lineSize;
+	unsigned int buckets;					/* 8B, 16B... up to lineSize */
+	unsigned int sizes[ALLOCATOR_SIZES];
+	struct allocation_stats stats[ALLOCATOR_SIZES][ALLOCATOR_KIND_COUNT];
+
+	int sharedLine;							/* Whether malloc really put the counters in one line */
+
+	/* Nanoseconds per increment, 0 if it couldn't run */
+	double packedNanos;
+	double paddedNanos;
+};
+
+const char* allocator_kind_name(enum allocator_kind kind);
+
+/* Returns 0 on success, -1 if lineSize isn't a power of two from 16 to 1024 bytes. */
+int measure_allocator(unsigned int lineSize, struct allocator_result* result);
+
+#endif
@@ -0,0 +1,115 @@
+#include "bench.h"
+#include "cache.h"
+#include "results.h"
+#include "compare.h"
+#include "affinity.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if PLATFORM_LINUX || PLATFORM_MACOS
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The fixed methodology. Changing any of these invalidates every stored baseline. */
+#define BENCH_TRIALS	5
+#define BENCH_MIN_SIZE	(16 * 1024)
+#define BENCH_MAX_SIZE	(64 * 1024 * 1024)
+
+static const unsigned int benchStrides[] = {
+	64,		/* One access per (usual) cache line: the data cache hierarchy */
+	4096	/* One access per page: the TLB hierarchy */
+};
+
+static int make_directory(const char* path)
+{
+	return (mkdir(path, 0755) == 0 || errno == EEXIST) ? 0 : -1;
+}
+
+static int file_exists(const char* path)
+{
+	struct stat info;
+
+	return stat(path, &info) == 0;
+}
+
+int run_bench(const struct bench_options* options)
+{
+	struct result_set* results;
+	char host[256];
+	char hostDirectory[512];
+	char baselinePath[600];
+	char currentPath[600];
+	const char* suffix = options->hugePages ? "-hugepages" : "";
+	unsigned int i;
+	int haveBaseline;
+
+	if(gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "unknown-host");
+	host[sizeof(host) - 1] = '\0';
+
+	snprintf(hostDirectory, sizeof(hostDirectory), "%s/%s", options->directory, host);
+	snprintf(baselinePath, sizeof(baselinePath), "%s/baseline%s.txt", hostDirectory, suffix);
+	snprintf(currentPath, sizeof(currentPath), "%s/latest%s.txt", hostDirectory, suffix);
+
+	if(make_directory(options->directory) != 0 || make_directory(hostDirectory) != 0)
+	{
+		fprintf(stderr, "Can't create %s\n", hostDirectory);
+		return 2;
+	}
+
+	if(pin_current_thread(options->cpu) != 0)
+		printf("Warning: couldn't pin to CPU %d, results may be noisier\n", options->cpu);
+
+	results = create_result_set();
+	if(!results)
+		return 2;
+
+	set_cache_huge_pages(options->hugePages);
+	set_cache_recorder(results, BENCH_TRIALS);
+
+	printf("=== Benchmark Suite (%s, CPU %d, %s pages) ===\n\n",
+		host, options->cpu, options->hugePages ? "huge" : "normal");
+
+	for(i = 0; i < sizeof(benchStrides) / sizeof(benchStrides[0]); ++i)
+	{
+		printf("Sweeping 16KB-64MB with a %u byte stride...\n", benchStrides[i]);
+		fflush(stdout);
+		measure_cache_sweep(BENCH_MIN_SIZE, BENCH_MAX_SIZE, benchStrides[i]);
+	}
+
+	set_cache_recorder(NULL, 1);
+	set_cache_huge_pages(0);
+
+	haveBaseline = file_exists(baselinePath) && !options->updateBaseline;
+
+	if(save_result_set(results, haveBaseline ? currentPath : baselinePath) != 0)
+	{
+		fprintf(stderr, "Can't save results in %s\n", hostDirectory);
+		free_result_set(results);
+		return 2;
+	}
+
+	free_result_set(results);
+
+	if(!haveBaseline)
+	{
+		printf("\nStored new baseline %s\n", baselinePath);
+		return 0;
+	}
+
+	printf("\n");
+	return compare_result_files(baselinePath, currentPath, options->thresholdPercent, options->alpha);
+}
+
+#else
+
+int run_bench(const struct bench_options* options)
+{
+	printf("Benchmark suite not supported on this platform\n");
+	return 2;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef BENCH_INC
+#define BENCH_INC
+
+/*
+	The standardized benchmark suite ("make bench").
+
+	Unlike a normal run nothing is derived from the machine: the thread
+	is pinned, the kernels, strides, size grid and trial count are fixed,
+	so two runs on the same host measure exactly the same thing.
+
+	Results live in <directory>/<hostname>/. The first run (or any run
+	with updateBaseline set) stores a baseline there, later runs are
+	compared against it.
+*/
+struct bench_options
+{
+	const char* directory;
+	int cpu;
+	int hugePages;
+	int updateBaseline;
+	double thresholdPercent;
+	double alpha;
+};
+
+/* Returns 0 if nothing regressed, non-zero otherwise - see compare_result_files. */
+int run_bench(const struct bench_options* options);
+
+#endif
@@ -0,0 +1,385 @@
+#include "budget.h"
+#include "cache.h"
+#include "stats.h"
+#include "platform.h"
+#include "profile.h"
+#include "fast_math.h"
+
+#include <string.h>
+
+#define BUDGET_MIN_SIZE		(16 * 1024)
+#define BUDGET_MAX_SIZE		(64 * 1024 * 1024)
+#define BUDGET_MAX_POINTS	128
+#define BUDGET_MAX_SAMPLES	8
+
+/* Samples on each side of a boundary before it's worth bisecting */
+#define BUDGET_SIDE_SAMPLES	3
+
+/* Bisected sizes are whole pages */
+#define BUDGET_GRANULE		4096
+
+/* Accesses per measurement until the coarse sweep has been sized, and the limits it's sized within */
+#define CALIBRATION_STEPS	(1024 * 1024)
+#define MIN_STEPS			(64 * 1024)
+#define MAX_STEPS			(128 * 1024 * 1024)
+
+/*
+	The coarse sweep gets this share of the budget, the rest is left for
+	refinement. Large working sets are several times slower per access
+	than the first one, which the sizing assumes they are on average.
+*/
+#define COARSE_SHARE		0.3
+#define COARSE_SLOWDOWN		4.0
+
+struct budget_point
+{
+	unsigned int size;
+	unsigned int sampleCount;
+	double samples[BUDGET_MAX_SAMPLES];	/* Nanoseconds per access */
+	double cost;						/* Seconds the last sample took, allocation included */
+};
+
+struct budget_run
+{
+	double deadline;
+	unsigned int stride;
+	unsigned int steps;
+	unsigned int measurements;
+
+	unsigned int pointCount;
+	struct budget_point points[BUDGET_MAX_POINTS];	/* Sorted by size */
+};
+
+/* What is known about one level's boundary, and the size to sample next to know more (0 if nothing would help). */
+struct level_analysis
+{
+	unsigned int size;
+	unsigned int upperBound;
+	double confidence;
+	unsigned int next;
+};
+
+static struct budget_point* find_point(struct budget_run* run, unsigned int size, int create)
+{
+	unsigned int i;
+
+	for(i = 0; i < run->pointCount && run->points[i].size < size; ++i);
+
+	if(i < run->pointCount && run->points[i].size == size)
+		return &run->points[i];
+
+	if(!create || run->pointCount == BUDGET_MAX_POINTS)
+		return NULL;
+
+	memmove(&run->points[i + 1], &run->points[i], (run->pointCount - i) * sizeof(struct budget_point));
+	memset(&run->points[i], 0, sizeof(struct budget_point));
+	run->points[i].size = size;
+	run->pointCount++;
+
+	return &run->points[i];
+}
+
+static double point_time(const struct budget_point* point)
+{
+	return sample_median(point->samples, point->sampleCount);
+}
+
+/*
+	What a sample of "size" should cost: what it cost last time, or
+	twice what the nearest smaller size cost if it's new. Nothing to go
+	by before the first sample.
+*/
+static double expected_cost(const struct budget_run* run, unsigned int size)
+{
+	double cost = 0;
+	unsigned int i;
+
+	for(i = 0; i < run->pointCount && run->points[i].size <= size; ++i)
+	{
+		if(!run->points[i].sampleCount)
+			continue;
+
+		cost = run->points[i].cost;
+		if(run->points[i].size < size)
+			cost *= 2;
+	}
+
+	return cost;
+}
+
+/* Returns 0 on success, -1 if the deadline (or memory) doesn't allow another sample of "size". */
+static int take_sample(struct budget_run* run, unsigned int size)
+{
+	struct budget_point* point;
+	double begin = get_time_seconds();
+	double nanos;
+
+	if(begin + expected_cost(run, size) > run->deadline)
+		return -1;
+
+	point = find_point(run, size, 1);
+	if(!point || point->sampleCount == BUDGET_MAX_SAMPLES)
+		return -1;
+
+	nanos = measure_access_time(size, run->stride, run->steps);
+	if(nanos < 0)
+		return -1;
+
+	point->samples[point->sampleCount++] = nanos;
+	point->cost = get_time_seconds() - begin;
+	run->measurements++;
+
+	return 0;
+}
+
+/* The same rule as the full detection: the line is the stride after the last significant rise. */
+static unsigned int detect_line_size(struct budget_run* run)
+{
+	static const unsigned int candidateStrides[] = {32, 64, 128, 256};
+
+	double previous = 0;
+	unsigned int lineSize = candidateStrides[0];
+	unsigned int i;
+
+	for(i = 0; i < sizeof(candidateStrides) / sizeof(candidateStrides[0]); ++i)
+	{
+		double nanos = measure_access_time(1024 * 1024, candidateStrides[i], run->steps);
+
+		if(nanos < 0)
+			break;
+
+		if(previous > 0 && (nanos - previous) / previous > SIGNIFICANT_RISE)
+			lineSize = candidateStrides[i];
+
+		previous = nanos;
+		run->measurements++;
+	}
+
+	return lineSize;
+}
+
+/*
+	Every power of two from BUDGET_MIN_SIZE up, once. The first point
+	tells how fast this machine is, and the rest are sized so the whole
+	sweep takes about COARSE_SHARE of the budget.
+*/
+static void coarse_sweep(struct budget_run* run, double seconds)
+{
+	unsigned int pointCount = 0;
+	unsigned int size;
+
+	for(size = BUDGET_MIN_SIZE; size <= BUDGET_MAX_SIZE; size *= 2)
+		++pointCount;
+
+	for(size = BUDGET_MIN_SIZE; size <= BUDGET_MAX_SIZE; size *= 2)
+	{
+		if(take_sample(run, size) != 0)
+			break;
+
+		if(size == BUDGET_MIN_SIZE)
+		{
+			/* A warm-up and a measured iteration per sample */
+			double secondsPerAccess = find_point(run, size, 0)->cost / (2.0 * run->steps);
+			double steps = seconds * COARSE_SHARE / (pointCount * 2 * COARSE_SLOWDOWN * secondsPerAccess);
+
+			if(steps < MIN_STEPS)
+				steps = MIN_STEPS;
+			if(steps > MAX_STEPS)
+				steps = MAX_STEPS;
+
+			run->steps = (unsigned int)steps;
+		}
+	}
+}
+
+/*
+	Where to bisect [low, high]. If the native size is in there, just
+	under it goes first: when the OS is right that fits, and the bracket
+	is down to almost nothing in one step.
+*/
+static unsigned int bisect(struct budget_run* run, unsigned int low, unsigned int high, unsigned int hint)
+{
+	unsigned int candidate;
+
+	if(hint > low && hint <= high)
+	{
+		candidate = (hint - hint / 8) & ~(BUDGET_GRANULE - 1);
+
+		if(candidate > low && candidate < high && !find_point(run, candidate, 0))
+			return candidate;
+	}
+
+	candidate = (low / 2 + high / 2) & ~(BUDGET_GRANULE - 1);
+
+	return (candidate > low && candidate < high) ? candidate : 0;
+}
+
+static void analyse_level(struct budget_run* run, unsigned int level, unsigned int hint, struct level_analysis* analysis)
+{
+	const struct budget_point* coarsePoints[32];
+	double coarse[32];
+	const struct budget_point* low;
+	const struct budget_point* high;
+	unsigned int coarseCount = 0;
+	unsigned int minSize, maxSize, fewest;
+	unsigned int i;
+	double threshold, p;
+	int boundary, sawSlow = 0;
+
+	memset(analysis, 0, sizeof(*analysis));
+	get_cache_level_range(level, &minSize, &maxSize);
+
+	/* The boundary is found on the doubling sizes, exactly like a full run would */
+	for(i = 0; i < run->pointCount && coarseCount < 32; ++i)
+	{
+		const struct budget_point* point = &run->points[i];
+
+		if(point->sampleCount && point->size >= minSize && point->size <= maxSize && is_power_of_two(point->size))
+		{
+			coarsePoints[coarseCount] = point;
+			coarse[coarseCount++] = point_time(point);
+		}
+	}
+
+	/* The budget ran out before this range was reached */
+	if(coarseCount < 2)
+		return;
+
+	boundary = find_first_boundary(coarse, coarseCount);
+
+	if(boundary < 0)
+	{
+		/* At least the largest size tried. All more time can buy is certainty that the top didn't rise. */
+		low = coarsePoints[coarseCount - 2];
+		high = coarsePoints[coarseCount - 1];
+
+		fewest = low->sampleCount < high->sampleCount ? low->sampleCount : high->sampleCount;
+		if(fewest > BUDGET_SIDE_SAMPLES)
+			fewest = BUDGET_SIDE_SAMPLES;
+
+		analysis->size = high->size;
+		analysis->confidence = 0.5 * fewest / BUDGET_SIDE_SAMPLES;
+
+		if(low->sampleCount < BUDGET_SIDE_SAMPLES)
+			analysis->next = low->size;
+		else if(high->sampleCount < BUDGET_SIDE_SAMPLES)
+			analysis->next = high->size;
+		return;
+	}
+
+	low = coarsePoints[boundary];
+	high = coarsePoints[boundary + 1];
+	threshold = (point_time(low) + point_time(high)) / 2;
+
+	/* Bisected sizes in between pull the bracket in, on whichever side of halfway they landed */
+	for(i = 0; i < run->pointCount; ++i)
+	{
+		const struct budget_point* point = &run->points[i];
+
+		if(!point->sampleCount || point->size <= coarsePoints[boundary]->size || point->size >= coarsePoints[boundary + 1]->size)
+			continue;
+
+		if(point_time(point) < threshold)
+		{
+			if(!sawSlow)
+				low = point;
+		}
+		else if(!sawSlow)
+		{
+			high = point;
+			sawSlow = 1;
+		}
+	}
+
+	/* How sure the two sides really differ, times how tight the bracket is */
+	p = welch_t_test(low->samples, low->sampleCount, high->samples, high->sampleCount);
+
+	analysis->size = low->size;
+	analysis->upperBound = high->size;
+	analysis->confidence = (p < 0 ? 0.5 : 1 - p) * low->size / high->size;
+
+	if(low->sampleCount < BUDGET_SIDE_SAMPLES)
+		analysis->next = low->size;
+	else if(high->sampleCount < BUDGET_SIDE_SAMPLES)
+		analysis->next = high->size;
+	else if((high->size - low->size) * 16 > low->size)
+		analysis->next = bisect(run, low->size, high->size, hint);
+}
+
+void detect_cache_within_budget(double seconds, const unsigned int hints[4], struct budget_result* result)
+{
+	static struct budget_run run;
+
+	struct level_analysis analysis[3];
+	int exhausted[3] = {0, 0, 0};
+	double begin = get_time_seconds();
+	unsigned int level;
+
+	memset(&run, 0, sizeof(run));
+	memset(result, 0, sizeof(*result));
+
+	run.deadline = begin + seconds;
+	run.steps = CALIBRATION_STEPS;
+
+	profile_phase_begin("budget line size");
+	if(hints[3])
+	{
+		run.stride = hints[3];
+		result->lineFromHint = 1;
+	}
+	else
+	{
+		run.stride = detect_line_size(&run);
+	}
+	result->lineSize = run.stride;
+	profile_phase_end();
+
+	profile_phase_begin("budget coarse sweep");
+	coarse_sweep(&run, run.deadline - get_time_seconds());
+	profile_phase_end();
+
+	/* Anytime refinement: always the least certain level that more samples can still help */
+	profile_phase_begin("budget refinement");
+	for(;;)
+	{
+		unsigned int pick = 0;
+		double lowest = 2;
+
+		for(level = 1; level <= 3; ++level)
+		{
+			analyse_level(&run, level, hints[level - 1], &analysis[level - 1]);
+
+			if(!exhausted[level - 1] && analysis[level - 1].next && analysis[level - 1].confidence < lowest)
+			{
+				pick = level;
+				lowest = analysis[level - 1].confidence;
+			}
+		}
+
+		if(!pick)
+			break;
+
+		/* Too expensive for what's left, but a cheaper level may still fit */
+		if(take_sample(&run, analysis[pick - 1].next) != 0)
+			exhausted[pick - 1] = 1;
+	}
+	profile_phase_end();
+
+	for(level = 0; level < 3; ++level)
+	{
+		struct budget_estimate* estimate = &result->levels[level];
+
+		estimate->size = analysis[level].size;
+		estimate->upperBound = analysis[level].upperBound;
+		estimate->confidence = analysis[level].confidence;
+
+		if(!estimate->size && hints[level])
+		{
+			estimate->size = hints[level];
+			estimate->fromHint = 1;
+		}
+	}
+
+	result->measurements = run.measurements;
+	result->seconds = get_time_seconds() - begin;
+}
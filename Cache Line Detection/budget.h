@@ -0,0 +1,37 @@
+#ifndef BUDGET_INC
+#define BUDGET_INC
+
+/*
+	Anytime detection (--budget). A coarse sweep finds roughly where each
+	boundary is, then whatever time is left goes to the least certain
+	one: more samples on both sides of it, then bisecting the sizes in
+	between. Whenever the deadline comes, the best estimate so far is
+	what gets returned.
+*/
+
+struct budget_estimate
+{
+	unsigned int size;			/* Largest size known to fit. 0 if nothing is known at all. */
+	unsigned int upperBound;	/* Smallest size known not to fit. 0 if no boundary was seen. */
+	double confidence;			/* From 0 (a guess) to 1 */
+	int fromHint;				/* Nothing was measured, size is the native value */
+};
+
+struct budget_result
+{
+	struct budget_estimate levels[3];
+	unsigned int lineSize;
+	int lineFromHint;
+
+	unsigned int measurements;
+	double seconds;				/* Actually spent */
+};
+
+/*
+	"hints" are the native sizes in the layout of get_all_cache_sizes
+	(L1, L2, L3, line), 0 where the OS didn't say. They pick the stride,
+	steer the refinement and stand in for levels the budget didn't reach.
+*/
+void detect_cache_within_budget(double seconds, const unsigned int hints[4], struct budget_result* result);
+
+#endif
@@ -1,12 +1,23 @@
 #include "cache.h"
 #include "fast_math.h"
 #include "platform.h"
+#include "results.h"
+#include "profile.h"
+#include "format.h"
+#include "cache_sim.h"
+#include "kernels.h"
+#include "frequency.h"
+#include "stats.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
 
+#if PLATFORM_LINUX
+#include <sys/mman.h>
+#endif
+
 /* Linux-specific cache detection using sysfs */
 #if PLATFORM_LINUX
 static unsigned int get_cache_line_linux_sysfs(void)
@@ -79,9 +90,11 @@ static unsigned int get_l3_cache_linux(void)
 
 	See: http://igoro.com/archive/gallery-of-processor-cache-effects/
 */
+#define ITERATION_STEPS	(128*1024*1024) /* Increased for L3 cache testing. */
+
 static void iterate_through_data(char* data, unsigned int dataSize, unsigned int stride)
 {
-	static const unsigned int steps = 128*1024*1024; /* Increased for L3 cache testing. */
+	static const unsigned int steps = ITERATION_STEPS;
 
 	unsigned int lengthMod = dataSize - 1;
 	unsigned int i;
@@ -101,6 +114,40 @@ static void iterate_through_data(char* data, unsigned int dataSize, unsigned int
 		++data[(i * stride) & lengthMod];
 }
 
+/*
+	Accesses per iteration of iterate_through_any_data. The budgeted
+	measurements shorten it, everything else runs ITERATION_STEPS.
+*/
+static unsigned int iterationSteps = ITERATION_STEPS;
+
+/*
+	The same walk over a buffer of any size. It goes a pass at a time
+	rather than wrapping the index around on every access, which would
+	put a compare on the critical path and hide the L1 -> L2 step. It's
+	still a different loop, so its timings only compare with each other.
+*/
+static void iterate_through_any_data(char* data, unsigned int dataSize, unsigned int stride)
+{
+	const unsigned int steps = iterationSteps;
+
+	unsigned int index = 0;
+	unsigned int i = 0;
+
+	stride %= dataSize;
+	if(!stride)
+		stride = dataSize;
+
+	while(i < steps)
+	{
+		for(; index < dataSize && i < steps; index += stride, ++i)
+			++data[index];
+
+		index -= dataSize;
+	}
+}
+
+typedef void (*iteration_kernel)(char* data, unsigned int dataSize, unsigned int stride);
+
 /* Cross-platform timing abstraction */
 #if PLATFORM_MACOS
 static double get_time_diff_nanos(void)
@@ -110,36 +157,36 @@ static double get_time_diff_nanos(void)
     return (double)timebase.numer / (double)timebase.denom;
 }
 
-static timing_t timed_iteration(char* data, unsigned int dataSize, unsigned int stride)
+static timing_t timed_hardware_iteration(iteration_kernel kernel, char* data, unsigned int dataSize, unsigned int stride)
 {
     uint64_t begin, end;
     double time_diff;
     
     begin = mach_absolute_time();
-    iterate_through_data(data, dataSize, stride);
+    kernel(data, dataSize, stride);
     end = mach_absolute_time();
     
     time_diff = (double)(end - begin) * get_time_diff_nanos();
     return time_diff;
 }
 #elif PLATFORM_LINUX
-static timing_t timed_iteration(char* data, unsigned int dataSize, unsigned int stride)
+static timing_t timed_hardware_iteration(iteration_kernel kernel, char* data, unsigned int dataSize, unsigned int stride)
 {
     double begin, end;
     
     begin = get_time_seconds();
-    iterate_through_data(data, dataSize, stride);
+    kernel(data, dataSize, stride);
     end = get_time_seconds();
     
     return (timing_t){.seconds = end - begin};
 }
 #else
-static timing_t timed_iteration(char* data, unsigned int dataSize, unsigned int stride)
+static timing_t timed_hardware_iteration(iteration_kernel kernel, char* data, unsigned int dataSize, unsigned int stride)
 {
 	clock_t begin, end;
 
 	begin = clock();
-	iterate_through_data(data, dataSize, stride);
+	kernel(data, dataSize, stride);
 	end = clock();
 
 	return end - begin;
@@ -147,19 +194,6 @@ static timing_t timed_iteration(char* data, unsigned int dataSize, unsigned int
 #endif
 
 /* Cross-platform timing comparison helpers */
-static timing_t timing_diff(timing_t a, timing_t b)
-{
-    timing_t result;
-#if PLATFORM_MACOS
-    result = a - b;
-#elif PLATFORM_LINUX
-    result.seconds = a.seconds - b.seconds;
-#else
-    result = a - b;
-#endif
-    return result;
-}
-
 static int timing_greater(timing_t a, timing_t b)
 {
 #if PLATFORM_MACOS
@@ -208,371 +242,794 @@ static double timing_to_double(timing_t t)
 #endif
 }
 
-static void fill_timing_data(
-		timing_t* timingData,
-		unsigned int timingDataLength,
-		unsigned int maxAlignment,
-		unsigned int stride
-	)
+static timing_t timing_from_seconds(double seconds)
 {
-	unsigned int currentAlignment;
-	unsigned int i;
+	timing_t result;
+#if PLATFORM_MACOS
+	result = seconds * 1e9;
+#elif PLATFORM_LINUX
+	result.seconds = seconds;
+#else
+	result = (timing_t)(seconds * CLOCKS_PER_SEC);
+#endif
+	return result;
+}
 
-	char* targetArray = NULL;
+/* When set, iterations run against this model instead of the real memory hierarchy. */
+static struct cache_sim* simulator = NULL;
 
-	for(currentAlignment = 1, i = 0; currentAlignment < maxAlignment; currentAlignment *= 2, ++i)
-	{
-		targetArray = realloc(targetArray, currentAlignment);
-		timingData[i] = timed_iteration(targetArray, currentAlignment, stride);
-	}
+/* Where a simulated buffer lives. Page aligned, like a fresh mmap. */
+#define SIMULATED_BUFFER_BASE	0x40000000ull
 
-	free(targetArray);
-}
+static void drop_default_session(void);
 
-/* There's probably a magical math formula involving logarithms that should be used here, but I'm too tired to find it. */
-static unsigned int determine_size_of_timing_data_required(unsigned int maxAlignment)
+void set_cache_simulator(struct cache_sim* sim)
 {
-	unsigned int size, currentAlignment;
+	simulator = sim;
+	drop_default_session();
 
-	for(
-		size = 0, currentAlignment = 1;
-		currentAlignment < maxAlignment;
-		++size, currentAlignment *= 2
-	);
+	if (simulator) {
+		flush_cache_sim(simulator);
+	}
+}
 
-	return size;
+static unsigned int greatest_common_divisor(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+
+	return a;
 }
 
 /*
-	This function essentially finds the biggest "jump" in timings.
-	A decent heuristic - it worked on my machine!
+	The access pattern of an iteration repeats every
+	dataSize / gcd(dataSize, stride) steps. Rather than simulating all
+	128M steps, run one period to reach the steady state, time whole
+	periods (at least a few thousand accesses) and scale that up to the
+	full iteration. Both kernels visit the same addresses.
 */
-static unsigned int get_cache_line_size_from_timing_data(
-		timing_t* timingData,
-		unsigned int numberOfDataPoints
-	)
+static timing_t simulated_iteration(unsigned int dataSize, unsigned int stride)
 {
-	unsigned int i;
-	timing_t delta;
+	static const unsigned int minimumMeasured = 4096;
 
-#if PLATFORM_MACOS
-	timing_t biggestJumpAmount = -9001;	/* It's under(?) 9000! */
-#elif PLATFORM_LINUX
-	timing_t biggestJumpAmount = (timing_t){.seconds = -9001};
-#else
-	timing_t biggestJumpAmount = -9001;
-#endif
+	const struct sim_config* config = get_cache_sim_config(simulator);
+	unsigned int period = dataSize / greatest_common_divisor(dataSize, stride % dataSize);
+	unsigned int measured, i;
+	double cycles = 0;
 
-	unsigned int locationOfBiggestJumpAmount = 0;
+	for (i = 0; i < period; ++i) {
+		sim_access(simulator, SIMULATED_BUFFER_BASE + (unsigned long long)i * stride % dataSize);
+	}
 
-	/* We ignore the first point. You can't get a delta from just one point! */
-	for(i = 1; i < numberOfDataPoints; ++i)
-	{
-		delta = timing_diff(timingData[i], timingData[i - 1]);
+	measured = ((minimumMeasured + period - 1) / period) * period;
 
-		if(timing_greater(delta, biggestJumpAmount))
-		{
-			biggestJumpAmount = delta;
-			locationOfBiggestJumpAmount = i;
-		}
+	for (i = 0; i < measured; ++i) {
+		cycles += sim_access(simulator, SIMULATED_BUFFER_BASE + (unsigned long long)i * stride % dataSize);
 	}
 
-	/*
-		The best timing data is at the point before the biggest jump,
-		because it's at the magical boundary that's painful to access.
-	*/
-	return int_pow(2, locationOfBiggestJumpAmount - 1);
+	return timing_from_seconds(cycles / measured * iterationSteps / (config->frequencyGHz * 1e9));
 }
 
-unsigned int get_cache_line(unsigned int max, unsigned int stride)
+static timing_t timed_kernel_iteration(iteration_kernel kernel, char* data, unsigned int dataSize, unsigned int stride)
 {
-	unsigned int timingDataLength = determine_size_of_timing_data_required(max);
-	timing_t* timingData = malloc(timingDataLength * sizeof(timing_t));
-
-	unsigned int result;
-
-	fill_timing_data(
-		timingData,
-		timingDataLength,
-		max,
-		stride
-	);
-	
-	result = get_cache_line_size_from_timing_data(
-		timingData, 
-		timingDataLength
-	);
-
-	free(timingData);
+	if (simulator) {
+		return simulated_iteration(dataSize, stride);
+	}
 
-	return result;
+	return timed_hardware_iteration(kernel, data, dataSize, stride);
 }
 
-/*
-	Detect actual cache line size by finding the stride where access pattern changes.
-	
-	When stride crosses the cache line boundary, the number of cache lines accessed
-	changes fundamentally. For cache line size C:
-	- Stride < C: Multiple strides access same cache line
-	- Stride >= C: Each stride accesses a different cache line
-	
-	The cache line size is where we see the biggest change in "time per stride unit".
-*/
-static unsigned int detect_cache_line_size(unsigned int maxSize)
+/* Average time of a single access in an iteration, in nanoseconds. */
+static double timing_to_nanos_per_access(timing_t t)
 {
-    /* Test specific strides - powers of 2 are most common for cache lines */
-    const unsigned int candidateStrides[] = {32, 64, 128, 256};
-    const unsigned int numCandidates = sizeof(candidateStrides) / sizeof(candidateStrides[0]);
-    
-    timing_t timings[16];
-    unsigned int i;
-    
-    char* targetArray = malloc(maxSize);
-    if (!targetArray) {
-        return 64; /* Fallback to common size */
-    }
-    
-    /* Test each candidate stride */
-    for (i = 0; i < numCandidates; i++) {
-        unsigned int stride = candidateStrides[i];
-        
-        /* Warm up */
-        timed_iteration(targetArray, maxSize, stride);
-        
-        /* Measure */
-        timings[i] = timed_iteration(targetArray, maxSize, stride);
-    }
-    
-    free(targetArray);
-    
-    /* 
-       Cache line detection: find where stride causes maximum time increase
-       
-       When stride = cache line, we transition from:
-       - stride < cache line: multiple accesses per cache line
-       - stride >= cache line: one access per cache line
-       
-       This causes a timing jump proportional to the cache line crossing.
-       
-       Calculate "time increase per stride unit" for each stride transition:
-       - From 32 to 64: expected jump if cache line > 64
-       - From 64 to 128: expected jump if cache line > 64, < 128, or = 128
-       - From 128 to 256: expected jump if cache line = 128
-    */
-    
-    /* Find the stride transition with biggest relative time increase */
-#if PLATFORM_MACOS
-    timing_t biggestJump = 0;
-#elif PLATFORM_LINUX
-    timing_t biggestJump = {0};
-#else
-    timing_t biggestJump = 0;
-#endif
-    unsigned int cacheLineSize = 64; /* Default */
-    
-    for (i = 1; i < numCandidates; i++) {
-        double timeAtSmallerStride = timing_to_double(timings[i-1]);
-        double timeAtLargerStride = timing_to_double(timings[i]);
-        unsigned int smallerStride = candidateStrides[i-1];
-        unsigned int largerStride = candidateStrides[i];
-        
-        if (timeAtSmallerStride > 0) {
-            /* Relative time increase when doubling stride */
-            double relativeJump = (timeAtLargerStride - timeAtSmallerStride) / timeAtSmallerStride;
-            
-            /* Time should roughly double when stride doubles (more cache line loads)
-               But if stride is still within cache line, time increase is smaller */
-            
-            /* Find the stride where this ratio is closest to 1.0 (linear scaling)
-               This indicates we've crossed the cache line boundary */
-            double ratioToLinear = (relativeJump > 1.0) ? 
-                (relativeJump - 1.0) : (1.0 - relativeJump);
-            
-            /* When stride doubles and time roughly doubles, we've crossed cache line */
-            if (ratioToLinear < timing_to_double(biggestJump) || timing_to_double(biggestJump) == 0) {
 #if PLATFORM_MACOS
-                biggestJump = ratioToLinear;
+	double nanos = t;
 #elif PLATFORM_LINUX
-                biggestJump = (timing_t){.seconds = ratioToLinear};
+	double nanos = t.seconds * 1e9;
 #else
-                biggestJump = ratioToLinear;
+	double nanos = (double)t / CLOCKS_PER_SEC * 1e9;
 #endif
-                /* The smaller stride is likely the cache line size */
-                cacheLineSize = smallerStride;
-            }
-        }
-    }
-    
-    /* 
-       Alternative: The cache line is where time increases most when stride increases.
-       When stride < cache line: time increases slowly (same cache line accesses)
-       When stride crosses cache line: time jumps (new cache line per access)
-    */
+	return nanos / iterationSteps;
+}
+
+static double timing_to_seconds(timing_t t)
+{
 #if PLATFORM_MACOS
-    timing_t maxAbsJump = 0;
+	return t / 1e9;
 #elif PLATFORM_LINUX
-    timing_t maxAbsJump = {0};
+	return t.seconds;
 #else
-    timing_t maxAbsJump = 0;
+	return (double)t / CLOCKS_PER_SEC;
 #endif
-    unsigned int jumpStride = 64;
-    
-    for (i = 1; i < numCandidates; i++) {
-        timing_t absJump = timing_diff(timings[i], timings[i-1]);
-        if (timing_greater(absJump, maxAbsJump)) {
-            maxAbsJump = absJump;
-            jumpStride = candidateStrides[i-1];
-        }
-    }
-    
-    /* The stride at the jump boundary is the cache line size */
-    if (timing_to_double(maxAbsJump) > 0) {
-        cacheLineSize = jumpStride;
-    }
-    
-    return cacheLineSize;
 }
 
+/* How many bytes each access of the detection reads and writes back */
+static unsigned int accessWidth = 1;
+
+/* The specialized kernel (see kernels.h) picked for the iteration being timed, and how long it runs */
+static access_kernel selectedKernel = NULL;
+static unsigned int selectedSteps = ITERATION_STEPS;
+
+static void iterate_with_selected_kernel(char* data, unsigned int dataSize, unsigned int stride)
+{
+	selectedKernel(data, dataSize, stride, selectedSteps);
+}
+
+static void iterate_through_nothing(char* data, unsigned int dataSize, unsigned int stride)
+{
+}
+
+/* Timer and loop overhead, measured once per kernel and buffer size */
+#define MAX_CALIBRATIONS	64
+#define CALIBRATION_STEPS	(ITERATION_STEPS / 16)
+#define CALIBRATION_RUNS	5
+
+static struct overhead_calibration calibrations[MAX_CALIBRATIONS];
+static unsigned int calibrationCount = 0;
+static double timerOverhead = -1;	/* Seconds. Negative until measured. */
+
 /*
-	Detect cache size at a specific level using timing analysis.
-	This function tests different working set sizes and finds the point
-	where access time increases significantly (cache boundary).
-	
-	minSize: Minimum size to test (in bytes)
-	maxSize: Maximum size to test (in bytes)
-	stride: Access stride - should match cache line size
-	
-	Returns: The cache size (the size that just fits in the cache,
-	             not the size that exceeds it)
+	Reading the timer twice in a row. The fastest of a few tries is the
+	overhead - anything slower was interrupted.
 */
-static unsigned int detect_cache_level(unsigned int minSize, unsigned int maxSize, unsigned int stride)
+static double measure_timer_overhead(void)
 {
-	unsigned int timingDataLength;
-	timing_t* timingData;
-	unsigned int currentSize;
+	double fastest = 0;
 	unsigned int i;
-	unsigned int numTests;
-	
-	/* Calculate number of test sizes within the range */
-	numTests = 0;
-	for (currentSize = minSize; currentSize <= maxSize; currentSize *= 2) {
-		numTests++;
-	}
-	
-	timingDataLength = numTests;
-	timingData = malloc(timingDataLength * sizeof(timing_t));
-	
-	if (!timingData) {
-		return 0;
-	}
-	
-	/* Fill timing data for each test size */
-	i = 0;
-	for (currentSize = minSize; currentSize <= maxSize; currentSize *= 2, i++) {
-		char* targetArray = malloc(currentSize);
-		if (!targetArray) {
-			free(timingData);
-			return 0;
+
+	for (i = 0; i < 32; i++) {
+		double t = timing_to_seconds(timed_hardware_iteration(iterate_through_nothing, NULL, 0, 0));
+
+		if (i == 0 || t < fastest) {
+			fastest = t;
 		}
-		
-		/* Warm up the cache */
-		timed_iteration(targetArray, currentSize, stride);
-		timed_iteration(targetArray, currentSize, stride);
-		
-		/* Measure access time */
-		timingData[i] = timed_iteration(targetArray, currentSize, stride);
-		
-		free(targetArray);
 	}
-	
-	/* Find the biggest jump in timing (cache boundary) */
-#if PLATFORM_MACOS
-	timing_t biggestJump = 0;
-#elif PLATFORM_LINUX
-	timing_t biggestJump = {0};
-#else
-	timing_t biggestJump = 0;
-#endif
-	unsigned int jumpLocation = 0;
-	
-	for (i = 1; i < numTests; i++) {
-		timing_t delta = timing_diff(timingData[i], timingData[i - 1]);
-		if (timing_greater(delta, biggestJump)) {
-			biggestJump = delta;
-			jumpLocation = i;
+
+	return fastest;
+}
+
+/* Nanoseconds per step of one kernel variant, timer overhead taken out. Fastest of CALIBRATION_RUNS. */
+static double calibrate_variant(char* data, unsigned int dataSize, unsigned int stride, enum kernel_variant variant)
+{
+	double fastest = 0;
+	unsigned int i;
+
+	selectedKernel = find_access_kernel(accessWidth, stride, dataSize, CALIBRATION_STEPS, variant);
+	selectedSteps = CALIBRATION_STEPS;
+
+	for (i = 0; i < CALIBRATION_RUNS; i++) {
+		double t = timing_to_seconds(timed_hardware_iteration(iterate_with_selected_kernel, data, dataSize, stride));
+
+		if (i == 0 || t < fastest) {
+			fastest = t;
 		}
 	}
-	
-	free(timingData);
-	
-	/* Return the size at the point BEFORE the jump (just fits in cache)
-	   The jump happens when we exceed the cache size, so the previous
-	   size is what fits in the cache */
-	if (jumpLocation > 0) {
-		unsigned int size = minSize;
-		for (i = 1; i < jumpLocation; i++) {
-			size *= 2;
+
+	selectedSteps = ITERATION_STEPS;
+
+	fastest -= timerOverhead;
+	return fastest > 0 ? fastest * 1e9 / CALIBRATION_STEPS : 0;
+}
+
+static const struct overhead_calibration* find_calibration(char* data, unsigned int dataSize, unsigned int stride)
+{
+	struct overhead_calibration* calibration;
+	unsigned int i;
+
+	for (i = 0; i < calibrationCount; i++) {
+		calibration = &calibrations[i];
+
+		if (calibration->width == accessWidth && calibration->stride == stride && calibration->size == dataSize) {
+			return calibration;
 		}
-		return size;
 	}
-	
-	/* If no significant jump found, estimate based on timing pattern
-	   Look for the first size where timing exceeds baseline by > 50% */
-	if (numTests >= 2 && timing_to_double(timingData[0]) > 0) {
-		for (i = 1; i < numTests; i++) {
-			if (timing_to_double(timingData[i]) > timing_to_double(timingData[0]) * 1.5) {
-				unsigned int size = minSize;
-				unsigned int j;
-				for (j = 1; j < i; j++) {
-					size *= 2;
-				}
-				return size;
-			}
-		}
+
+	if (calibrationCount == MAX_CALIBRATIONS) {
+		return NULL;
 	}
-	
-	/* Fallback: return estimated cache size based on max tested */
-	return maxSize / 2;
-}
 
-/*
-	Detect L1 cache size.
-	On M1: P-cores have 128KB L1D, E-cores have 64KB L1D
-*/
-unsigned int get_l1_cache(void)
-{
-	/* First detect cache line size, then use it for stride */
-	unsigned int cacheLine = detect_cache_line_size(1 * 1024 * 1024);
-	/* Test sizes from 16KB to 512KB to cover typical L1 sizes */
-	return detect_cache_level(16 * 1024, 512 * 1024, cacheLine);
+	/*
+		The shorter calibration runs can leave no kernel where the timed
+		one has one - more lines than CALIBRATION_STEPS divides into.
+		Those go uncorrected.
+	*/
+	if (!find_access_kernel(accessWidth, stride, dataSize, CALIBRATION_STEPS, KERNEL_EMPTY) ||
+		!find_access_kernel(accessWidth, stride, dataSize, CALIBRATION_STEPS, KERNEL_REGISTER)) {
+		return NULL;
+	}
+
+	profile_phase_begin("overhead calibration");
+
+	if (timerOverhead < 0) {
+		timerOverhead = measure_timer_overhead();
+	}
+
+	calibration = &calibrations[calibrationCount++];
+	calibration->width = accessWidth;
+	calibration->stride = stride;
+	calibration->size = dataSize;
+	calibration->emptyNanos = calibrate_variant(data, dataSize, stride, KERNEL_EMPTY);
+	calibration->registerNanos = calibrate_variant(data, dataSize, stride, KERNEL_REGISTER);
+
+	profile_phase_end();
+	return calibration;
 }
 
 /*
-	Detect L2 cache size.
-	On M1: Shared L2 is 12MB for P-cores, 4MB for E-cores
+	Takes the timer reads and the loop itself out of a measured
+	iteration, leaving the accesses. A sample that isn't longer than the
+	overhead is one the calibration doesn't describe, and is left as it is.
 */
-unsigned int get_l2_cache(void)
+static timing_t subtract_overhead(timing_t t, const struct overhead_calibration* calibration)
 {
-	/* First detect cache line size, then use it for stride */
-	unsigned int cacheLine = detect_cache_line_size(1 * 1024 * 1024);
-	/* Test sizes from 256KB to 16MB to cover typical L2 and M1 shared L2 */
-	return detect_cache_level(256 * 1024, 16 * 1024 * 1024, cacheLine);
+	double seconds = timing_to_seconds(t);
+	double overhead = timerOverhead + calibration->emptyNanos * 1e-9 * ITERATION_STEPS;
+
+	if (overhead >= seconds) {
+		return t;
+	}
+
+	return timing_from_seconds(seconds - overhead);
 }
 
 /*
-	Detect L3 cache size.
-	Note: M1 doesn't have traditional L3 cache - instead has System Level Cache (SLC).
-	We'll detect what's available in the 4MB-64MB range.
+	A specialized kernel whenever one fits, which is every size the
+	level sweeps use, with its overhead subtracted. Only buffers too
+	small to unroll over fall back to the generic loop, uncorrected.
 */
-unsigned int get_l3_cache(void)
+static timing_t timed_iteration(char* data, unsigned int dataSize, unsigned int stride)
 {
-	/* First detect cache line size, then use it for stride */
-	unsigned int cacheLine = detect_cache_line_size(1 * 1024 * 1024);
-	/* Test sizes from 4MB to 64MB to cover L3 and M1 SLC */
-	return detect_cache_level(4 * 1024 * 1024, 64 * 1024 * 1024, cacheLine);
-}
+	const struct overhead_calibration* calibration;
+	timing_t t;
 
-/* Get cache line size using native Linux sysfs */
+	if (simulator || !find_access_kernel(accessWidth, stride, dataSize, ITERATION_STEPS, KERNEL_ACCESS)) {
+		return timed_kernel_iteration(iterate_through_data, data, dataSize, stride);
+	}
+
+	calibration = find_calibration(data, dataSize, stride);
+
+	selectedKernel = find_access_kernel(accessWidth, stride, dataSize, ITERATION_STEPS, KERNEL_ACCESS);
+	t = timed_hardware_iteration(iterate_with_selected_kernel, data, dataSize, stride);
+
+	return calibration ? subtract_overhead(t, calibration) : t;
+}
+
+double get_timer_overhead(void)
+{
+	return timerOverhead < 0 ? 0 : timerOverhead * 1e9;
+}
+
+unsigned int get_overhead_calibrations(const struct overhead_calibration** result)
+{
+	*result = calibrations;
+	return calibrationCount;
+}
+
+static int useHugePages = 0;
+
+int set_cache_access_width(unsigned int width)
+{
+	if (!is_supported_access_width(width)) {
+		return -1;
+	}
+
+	accessWidth = width;
+	drop_default_session();
+	return 0;
+}
+
+void set_cache_huge_pages(int enabled)
+{
+	useHugePages = enabled;
+	drop_default_session();
+}
+
+/*
+	malloc, with the time it took charged to the current profile phase.
+	Buffers start on a cache line (of up to 128 bytes, M1's), so wide
+	accesses never straddle two; large mallocs are usually 16 bytes off.
+	With huge pages on, buffers are 2MB aligned and handed to THP, so the
+	TLB drops out of the picture. The result is still free()d normally.
+*/
+static char* profiled_malloc(unsigned int size)
+{
+	double begin = get_time_seconds();
+	char* data = NULL;
+
+#if PLATFORM_LINUX || PLATFORM_MACOS
+	static const unsigned int lineAlignment = 128;
+	void* aligned;
+	
+#if PLATFORM_LINUX
+	static const unsigned int hugePageSize = 2 * 1024 * 1024;
+	
+	if (useHugePages) {
+		if (posix_memalign(&aligned, hugePageSize, size) == 0) {
+			data = aligned;
+			madvise(data, size, MADV_HUGEPAGE);
+		}
+	} else
+#endif
+	if (posix_memalign(&aligned, lineAlignment, size) == 0) {
+		data = aligned;
+	}
+#else
+	data = malloc(size);
+#endif
+
+	profile_activity(PROFILE_ALLOCATION, get_time_seconds() - begin, 1, size);
+	return data;
+}
+
+/* An iteration whose only purpose is to get the caches (and pages) warmed up. */
+static void warm_up(char* data, unsigned int dataSize, unsigned int stride)
+{
+	timing_t t = timed_iteration(data, dataSize, stride);
+
+	profile_activity(PROFILE_WARMUP, timing_to_seconds(t), iterationSteps, (unsigned long long)iterationSteps * accessWidth);
+}
+
+/*
+	The level sweeps' accesses don't depend on each other, so they time
+	throughput. Latency needs every load to wait for the one before it:
+	a chain of pointers, one per stride, linked in random order so the
+	prefetchers can't follow it.
+*/
+#define CHASE_STEPS		(1024 * 1024)
+#define CHASE_RUNS		5
+
+static void* chase_chain(void* at, unsigned int steps)
+{
+	unsigned int i;
+
+	for (i = 0; i < steps; i++) {
+		at = *(void* volatile*)at;
+	}
+
+	return at;
+}
+
+static void* volatile chaseEnd;
+
+double measure_chase_latency(unsigned int size, unsigned int stride)
+{
+	unsigned int count = stride >= sizeof(void*) ? size / stride : 0;
+	unsigned int* order;
+	char* data;
+	void* at;
+	double fastest = 0;
+	unsigned int i;
+
+	if (simulator || count < 2) {
+		return -1;
+	}
+
+	order = malloc(count * sizeof(*order));
+	data = profiled_malloc(size);
+	if (!order || !data) {
+		free(order);
+		free(data);
+		return -1;
+	}
+
+	profile_phase_begin("latency chase");
+
+	shuffle_indices(order, count, 0x243F6A88);
+	for (i = 0; i < count; i++) {
+		*(void**)(data + (size_t)order[i] * stride) = data + (size_t)order[(i + 1) % count] * stride;
+	}
+	at = data + (size_t)order[0] * stride;
+	free(order);
+
+	if (timerOverhead < 0) {
+		timerOverhead = measure_timer_overhead();
+	}
+
+	/* Once around to bring the chain in */
+	at = chase_chain(at, count);
+
+	for (i = 0; i < CHASE_RUNS; i++) {
+		double begin = get_time_seconds();
+		double t;
+
+		at = chase_chain(at, CHASE_STEPS);
+		t = get_time_seconds() - begin;
+
+		if (i == 0 || t < fastest) {
+			fastest = t;
+		}
+	}
+	chaseEnd = at;
+
+	profile_phase_end();
+	free(data);
+
+	fastest -= timerOverhead;
+	return fastest > 0 ? fastest * 1e9 / CHASE_STEPS : -1;
+}
+
+/*
+	The clock. Before the first measurement the core is spun until its
+	clock settles, so the first sizes don't run at a lower one than the
+	rest. After that every trial notes the clock it actually ran at:
+	from perf's cycle counter if it's available, otherwise from a chain
+	of dependent adds right after the trial.
+*/
+static int clockPrepared = 0;
+static int cycleCounterOpen = 0;
+static double stableGHz = 0;
+
+static void prepare_clock(void)
+{
+	if (clockPrepared || simulator) {
+		return;
+	}
+
+	profile_phase_begin("frequency stabilization");
+	cycleCounterOpen = open_cycle_counter() == 0;
+	stableGHz = stabilize_core_frequency(1.0);
+	profile_phase_end();
+
+	clockPrepared = 1;
+}
+
+static double trial_clock(unsigned long long cycles, double seconds)
+{
+	if (simulator) {
+		return get_cache_sim_config(simulator)->frequencyGHz;
+	}
+
+	if (cycleCounterOpen && cycles > 0 && seconds > 0) {
+		return cycles / seconds / 1e9;
+	}
+
+	return measure_core_frequency();
+}
+
+double get_stable_core_frequency(int* fromPerf)
+{
+	*fromPerf = cycleCounterOpen;
+	return stableGHz;
+}
+
+/* Where measure_point records its trials. NULL if nobody is interested. */
+static struct result_set* recorder = NULL;
+static unsigned int measurementTrials = 1;
+
+void set_cache_recorder(struct result_set* results, unsigned int trials)
+{
+	recorder = results;
+
+	if(trials < 1)
+		trials = 1;
+	if(trials > RESULT_MAX_TRIALS)
+		trials = RESULT_MAX_TRIALS;
+
+	measurementTrials = trials;
+}
+
+/*
+	Times one point of a curve measurementTrials times. Every trial is
+	recorded, in nanoseconds and in cycles at the clock it ran at, and
+	the median is handed back to the analysis, so a single interrupted
+	trial can't fake a boundary.
+*/
+static timing_t measure_point(
+		char* data,
+		unsigned int dataSize,
+		unsigned int stride,
+		const char* curve,
+		unsigned int x
+	)
+{
+	timing_t samples[RESULT_MAX_TRIALS];
+	double clocks[RESULT_MAX_TRIALS];
+	char cyclesCurve[RESULT_NAME_LENGTH];
+	timing_t swap;
+	unsigned int i, j;
+
+	snprintf(cyclesCurve, sizeof(cyclesCurve), "%s_cyc", curve);
+
+	for(i = 0; i < measurementTrials; ++i)
+	{
+		unsigned long long cycles = read_cycle_counter();
+		double begin = get_time_seconds();
+
+		samples[i] = timed_iteration(data, dataSize, stride);
+		clocks[i] = trial_clock(read_cycle_counter() - cycles, get_time_seconds() - begin);
+		profile_activity(PROFILE_MEASUREMENT, timing_to_seconds(samples[i]), iterationSteps, (unsigned long long)iterationSteps * accessWidth);
+
+		if(recorder)
+		{
+			record_result_trial(recorder, curve, "ns", x, timing_to_nanos_per_access(samples[i]));
+			record_result_trial(recorder, cyclesCurve, "cycles", x, timing_to_nanos_per_access(samples[i]) * clocks[i]);
+		}
+	}
+
+	/* Insertion sort - there are only a handful of trials */
+	for(i = 1; i < measurementTrials; ++i)
+	{
+		for(j = i; j > 0 && timing_greater(samples[j - 1], samples[j]); --j)
+		{
+			swap = samples[j];
+			samples[j] = samples[j - 1];
+			samples[j - 1] = swap;
+		}
+	}
+
+	return samples[measurementTrials / 2];
+}
+
+static void fill_timing_data(
+		double* timingData,
+		unsigned int timingDataLength,
+		unsigned int maxAlignment,
+		unsigned int stride
+	)
+{
+	unsigned int currentAlignment;
+	unsigned int i;
+
+	char* targetArray = NULL;
+
+	for(currentAlignment = 1, i = 0; currentAlignment < maxAlignment; currentAlignment *= 2, ++i)
+	{
+		targetArray = realloc(targetArray, currentAlignment);
+		/* Starting at a single byte, most of these are too small to unroll over. They all get the generic loop, so they still compare. */
+		timingData[i] = timing_to_double(timed_kernel_iteration(iterate_through_data, targetArray, currentAlignment, stride));
+	}
+
+	free(targetArray);
+}
+
+/* There's probably a magical math formula involving logarithms that should be used here, but I'm too tired to find it. */
+static unsigned int determine_size_of_timing_data_required(unsigned int maxAlignment)
+{
+	unsigned int size, currentAlignment;
+
+	for(
+		size = 0, currentAlignment = 1;
+		currentAlignment < maxAlignment;
+		++size, currentAlignment *= 2
+	);
+
+	return size;
+}
+
+/* Relative change from one timing to the next. 0 if the first one is unusable. */
+static double relative_rise(double from, double to)
+{
+	if(from <= 0)
+		return 0;
+
+	return (to - from) / from;
+}
+
+/* Index of the first point that is significantly slower than the one before it, or -1. */
+static int find_first_rise(const double* timings, unsigned int count)
+{
+	unsigned int i;
+
+	for(i = 1; i < count; ++i)
+		if(relative_rise(timings[i - 1], timings[i]) > SIGNIFICANT_RISE)
+			return (int)i;
+
+	return -1;
+}
+
+/*
+	This used to be the biggest jump, which happily skipped L1 whenever
+	the L2 -> L3 step was steeper.
+
+	Conflict misses start before a cache is completely full, so on real
+	hardware a boundary can spread over two steps. When the next step
+	rises even more, it's taken instead.
+*/
+int find_first_boundary(const double* timings, unsigned int count)
+{
+	int i = find_first_rise(timings, count);
+
+	if(i < 0)
+		return -1;
+
+	if((unsigned int)i + 1 < count &&
+		relative_rise(timings[i], timings[i + 1]) > relative_rise(timings[i - 1], timings[i]))
+		++i;
+
+	return i - 1;
+}
+
+/*
+	The best timing data is at the point before the first boundary,
+	because it's at the magical boundary that's painful to access.
+*/
+static unsigned int get_cache_line_size_from_timing_data(
+		double* timingData,
+		unsigned int numberOfDataPoints
+	)
+{
+	int boundary = find_first_boundary(timingData, numberOfDataPoints);
+
+	/* No boundary at all. Everything fit, and the last point is the best we know. */
+	if(boundary < 0)
+		boundary = (int)numberOfDataPoints - 1;
+
+	return int_pow(2, (unsigned int)boundary);
+}
+
+unsigned int get_cache_line(unsigned int max, unsigned int stride)
+{
+	unsigned int timingDataLength = determine_size_of_timing_data_required(max);
+	double* timingData = malloc(timingDataLength * sizeof(double));
+
+	unsigned int result;
+
+	fill_timing_data(
+		timingData,
+		timingDataLength,
+		max,
+		stride
+	);
+	
+	result = get_cache_line_size_from_timing_data(
+		timingData, 
+		timingDataLength
+	);
+
+	free(timingData);
+
+	return result;
+}
+
+/*
+	Detect actual cache line size by finding the stride where access pattern changes.
+	
+	When stride crosses the cache line boundary, the number of cache lines accessed
+	changes fundamentally. For cache line size C:
+	- Stride < C: Multiple strides access same cache line
+	- Stride >= C: Each stride accesses a different cache line
+	
+	The cache line size is where the "time per access" stops growing with the stride.
+*/
+static unsigned int detect_cache_line_size(unsigned int maxSize)
+{
+    /* Test specific strides - powers of 2 are most common for cache lines */
+    const unsigned int candidateStrides[] = {32, 64, 128, 256};
+    const unsigned int numCandidates = sizeof(candidateStrides) / sizeof(candidateStrides[0]);
+    
+    double timings[16];
+    unsigned int i;
+    
+    char* targetArray;
+    
+    /* Accesses wider than the smallest candidate would straddle them, and bytes are all it takes */
+    unsigned int width = accessWidth;
+    
+    profile_phase_begin("detect_cache_line_size");
+    
+    targetArray = profiled_malloc(maxSize);
+    if (!targetArray) {
+        profile_phase_end();
+        return 64; /* Fallback to common size */
+    }
+    
+    accessWidth = 1;
+    
+    /* Test each candidate stride */
+    for (i = 0; i < numCandidates; i++) {
+        unsigned int stride = candidateStrides[i];
+        
+        /* Warm up */
+        warm_up(targetArray, maxSize, stride);
+        
+        /* Measure */
+        timings[i] = timing_to_double(measure_point(targetArray, maxSize, stride, "line_stride", stride));
+    }
+    
+    accessWidth = width;
+    free(targetArray);
+    profile_phase_end();
+    
+    /*
+       Per access, the time grows with the stride as long as several accesses
+       share a cache line (only stride / line of them miss), and stops growing
+       once every access misses on a line of its own. So the cache line is the
+       stride after the last significant rise.
+       
+       The larger strides touch fewer lines, which can only make them faster
+       (the footprint may drop into a smaller cache), never slower.
+    */
+    unsigned int cacheLineSize = candidateStrides[0];
+    
+    for (i = 1; i < numCandidates; i++) {
+        if (relative_rise(timings[i-1], timings[i]) > SIGNIFICANT_RISE) {
+            cacheLineSize = candidateStrides[i];
+        }
+    }
+    
+    return cacheLineSize;
+}
+
+/*
+	Times a fresh, warmed up buffer of "size" bytes. Every stride gets a
+	curve of its own, so overlapping ranges land on the same points.
+	Returns 0 on success, -1 if the buffer couldn't be allocated.
+*/
+static int measure_working_set(unsigned int size, unsigned int stride, timing_t* result)
+{
+	char curve[RESULT_NAME_LENGTH];
+	char* targetArray;
+
+	prepare_clock();
+
+	targetArray = profiled_malloc(size);
+	if (!targetArray) {
+		return -1;
+	}
+
+	/* Wider accesses make different curves. Byte wide ones keep the names stored results already use. */
+	if (accessWidth == 1) {
+		snprintf(curve, sizeof(curve), "sweep_s%u", stride);
+	} else {
+		snprintf(curve, sizeof(curve), "sweep_s%u_w%u", stride, accessWidth);
+	}
+
+	/* Warm up the cache */
+	warm_up(targetArray, size, stride);
+	warm_up(targetArray, size, stride);
+
+	/* Measure access time */
+	*result = measure_point(targetArray, size, stride, curve, size);
+
+	free(targetArray);
+	return 0;
+}
+
+void measure_cache_sweep(unsigned int minSize, unsigned int maxSize, unsigned int stride)
+{
+	unsigned int size;
+	timing_t ignored;
+
+	profile_phase_begin("measure_cache_sweep");
+
+	for (size = minSize; size <= maxSize; size *= 2) {
+		if (measure_working_set(size, stride, &ignored) != 0) {
+			break;
+		}
+	}
+
+	profile_phase_end();
+}
+
+double measure_access_time(unsigned int size, unsigned int stride, unsigned int steps)
+{
+	char* targetArray = profiled_malloc(size);
+	timing_t t;
+	double nanos;
+
+	if (!targetArray) {
+		return -1;
+	}
+
+	iterationSteps = steps;
+
+	t = timed_kernel_iteration(iterate_through_any_data, targetArray, size, stride);
+	profile_activity(PROFILE_WARMUP, timing_to_seconds(t), iterationSteps, iterationSteps * sizeof(char));
+
+	t = timed_kernel_iteration(iterate_through_any_data, targetArray, size, stride);
+	profile_activity(PROFILE_MEASUREMENT, timing_to_seconds(t), iterationSteps, iterationSteps * sizeof(char));
+
+	nanos = timing_to_nanos_per_access(t);
+	iterationSteps = ITERATION_STEPS;
+
+	free(targetArray);
+	return nanos;
+}
+
+/* Get cache line size using native Linux sysfs */
 #if PLATFORM_LINUX
 static unsigned int get_cache_line_linux(void)
 {
@@ -594,20 +1051,461 @@ static unsigned int get_cache_line_linux(void)
 #endif
 
 /*
-	Get all cache sizes in one call.
+	A measurement session. Every point it measures is kept, keyed by
+	working set size and stride, so levels with overlapping ranges (and
+	later queries for other levels) reuse them instead of measuring again.
 */
-void get_all_cache_sizes(unsigned int results[4])
+struct session_point
+{
+	unsigned int size;
+	unsigned int stride;
+	timing_t timing;
+};
+
+struct cache_session
+{
+	unsigned int lineSize;		/* 0 until known */
+	unsigned int levels[3];		/* 0 until known */
+	unsigned int memoryPlateau;	/* Where memory latency starts, 0 until seen */
+	double latencies[3];		/* Chase latency in nanoseconds, 0 until measured */
+
+	unsigned int pointCount;
+	struct session_point* points;
+};
+
+/* Where each level is searched for. The ranges overlap, shared points are measured once. */
+static const unsigned int levelRanges[3][2] = {
+	{16 * 1024, 512 * 1024},			/* L1: typical L1 sizes */
+	{256 * 1024, 16 * 1024 * 1024},		/* L2: typical L2 and M1 shared L2 */
+	{4 * 1024 * 1024, 64 * 1024 * 1024}	/* L3, or the SLC on M1 */
+};
+
+int get_cache_level_range(unsigned int level, unsigned int* minSize, unsigned int* maxSize)
 {
-	/* First detect cache line size to use as stride for other detections */
+	if (level < 1 || level > 3) {
+		return -1;
+	}
+
+	*minSize = levelRanges[level - 1][0];
+	*maxSize = levelRanges[level - 1][1];
+	return 0;
+}
+
+size_t get_set_beyond_level(size_t levelBytes, size_t maxBytes)
+{
+	size_t bytes = levelBytes * LEVEL_MEMORY_MULTIPLE;
+
+	return bytes < maxBytes ? bytes : maxBytes;
+}
+
+unsigned int get_level_targets(const unsigned int levels[3], unsigned int levelDivisor, size_t maxMemory, struct level_target targets[MAX_LEVEL_TARGETS])
+{
+	size_t lastLevel = 0;
+	size_t memory;
+	unsigned int count = 0;
+	unsigned int level;
+
+	for (level = 1; level <= 3; level++) {
+		if (levels[level - 1] == 0) {
+			continue;
+		}
+
+		targets[count].level = level;
+		targets[count].bytes = levels[level - 1] / levelDivisor;
+		count++;
+		lastLevel = levels[level - 1];
+	}
+
+	memory = get_set_beyond_level(lastLevel, maxMemory);
+	if (memory < MIN_MEMORY_SET && MIN_MEMORY_SET <= maxMemory) {
+		memory = MIN_MEMORY_SET;
+	}
+
+	targets[count].level = 0;
+	targets[count].bytes = memory;
+	return count + 1;
+}
+
+/* Returns 0 on success, -1 if a new point was needed and couldn't be measured. */
+static int session_measure(struct cache_session* session, unsigned int size, unsigned int stride, timing_t* result)
+{
+	struct session_point* points;
+	unsigned int i;
+
+	for (i = 0; i < session->pointCount; i++) {
+		if (session->points[i].size == size && session->points[i].stride == stride) {
+			*result = session->points[i].timing;
+			return 0;
+		}
+	}
+
+	if (measure_working_set(size, stride, result) != 0) {
+		return -1;
+	}
+
+	points = realloc(session->points, (session->pointCount + 1) * sizeof(struct session_point));
+	if (points) {
+		session->points = points;
+		points[session->pointCount].size = size;
+		points[session->pointCount].stride = stride;
+		points[session->pointCount].timing = *result;
+		session->pointCount++;
+	}
+
+	return 0;
+}
+
+/* Consecutive points that have to agree before the sweep is on the memory plateau */
+#define PLATEAU_POINTS		3
+
+/* How close they have to be. Anything short of a significant rise is noise. */
+#define PLATEAU_TOLERANCE	(SIGNIFICANT_RISE / 2)
+
+/*
+	Whether a sweep whose last point was "lastSize" is sitting on the
+	memory plateau: its last PLATEAU_POINTS points agree, and the session
+	has already seen "levels" separate rises below them - one for each
+	cache up to the one being looked for. The count is what tells memory
+	apart from a large last level cache, which is just as flat.
+
+	Returns the size the plateau starts at, or 0. The last cache ends
+	somewhere in the last rise before it, which "fits" and "misses" are
+	set to the two sides of. Sizes just past a cache can still get some
+	hits, so that rise isn't necessarily right below the plateau.
+*/
+static unsigned int find_memory_plateau(
+		const struct cache_session* session,
+		unsigned int stride,
+		unsigned int lastSize,
+		unsigned int levels,
+		unsigned int* fits,
+		unsigned int* misses
+	)
+{
+	unsigned int sizes[64];
+	double timings[64];
+	unsigned int count = 0;
+	unsigned int rises = 0;
+	unsigned int lastRise = 0;
+	unsigned int i, j, start;
+	int rising = 0;
+
+	/* The session's points for this stride, smallest first */
+	for (i = 0; i < session->pointCount && count < 64; i++) {
+		const struct session_point* point = &session->points[i];
+
+		if (point->stride != stride || point->size > lastSize) {
+			continue;
+		}
+
+		for (j = count; j > 0 && sizes[j - 1] > point->size; j--) {
+			sizes[j] = sizes[j - 1];
+			timings[j] = timings[j - 1];
+		}
+		sizes[j] = point->size;
+		timings[j] = timing_to_double(point->timing);
+		count++;
+	}
+
+	if (count < PLATEAU_POINTS + 1) {
+		return 0;
+	}
+
+	start = count - PLATEAU_POINTS;
+
+	for (i = start + 1; i < count; i++) {
+		double change = relative_rise(timings[i - 1], timings[i]);
+
+		if (change > PLATEAU_TOLERANCE || change < -PLATEAU_TOLERANCE) {
+			return 0;
+		}
+	}
+
+	/* A boundary spread over two steps is still one cache */
+	for (i = 1; i <= start; i++) {
+		if (relative_rise(timings[i - 1], timings[i]) > SIGNIFICANT_RISE) {
+			rises += !rising;
+			rising = 1;
+			lastRise = i;
+		} else {
+			rising = 0;
+		}
+	}
+
+	if (rises < levels) {
+		return 0;
+	}
+
+	*fits = sizes[lastRise - 1];
+	*misses = sizes[lastRise];
+	return sizes[start];
+}
+
+/*
+	Detect cache size at a specific level using timing analysis.
+	This function tests different working set sizes and finds the point
+	where access time increases significantly (cache boundary).
+	
+	Sizes are measured lazily, from the smallest up, and the sweep stops
+	as soon as the boundary is certain - one point after the first rise,
+	which is all find_first_boundary ever looks at.
+	
+	On parts whose last level cache is smaller than the range, there's
+	no rise in it at all, only memory. The sweep stops once it's clearly
+	on the memory plateau instead of streaming through the largest (and
+	slowest) buffers, and the boundary is looked for in the gap below.
+	
+	minSize: Minimum size to test (in bytes)
+	maxSize: Maximum size to test (in bytes)
+	stride: Access stride - should match cache line size
+	level: Which cache this is, 1 to 3
+	
+	Returns: The cache size (the size that just fits in the cache,
+	             not the size that exceeds it), or maxSize if even that
+	             still fits
+*/
+static unsigned int detect_cache_level(struct cache_session* session, unsigned int minSize, unsigned int maxSize, unsigned int stride, unsigned int level)
+{
+	double timingData[32];
+	timing_t timing;
+	unsigned int currentSize;
+	unsigned int numTests;
+	unsigned int i;
+	unsigned int plateau = 0, fits = 0, misses = 0;
+	int rise, boundary = -1;
+	char phase[48];
+	struct size_of_data formattedMin = unitfy_data_size(minSize);
+	struct size_of_data formattedMax = unitfy_data_size(maxSize);
+	
+	snprintf(phase, sizeof(phase), "detect_cache_level %u%s-%u%s",
+		formattedMin.quantity, formattedMin.unit, formattedMax.quantity, formattedMax.unit);
+	
+	/* Calculate number of test sizes within the range */
+	numTests = 0;
+	for (currentSize = minSize; currentSize <= maxSize && numTests < 32; currentSize *= 2) {
+		numTests++;
+	}
+	
+	profile_phase_begin(phase);
+	
+	for (i = 0, currentSize = minSize; i < numTests; i++, currentSize *= 2) {
+		if (session_measure(session, currentSize, stride, &timing) != 0) {
+			profile_phase_end();
+			return 0;
+		}
+		timingData[i] = timing_to_double(timing);
+		
+		rise = find_first_rise(timingData, i + 1);
+		if (rise >= 0 && (i > (unsigned int)rise || i == numTests - 1)) {
+			boundary = find_first_boundary(timingData, i + 1);
+			break;
+		}
+		
+		if (rise < 0 && i + 1 >= PLATEAU_POINTS) {
+			plateau = find_memory_plateau(session, stride, currentSize, level, &fits, &misses);
+			if (plateau) {
+				break;
+			}
+		}
+	}
+	
+	if (plateau) {
+		unsigned int count = 0;
+		
+		if (!session->memoryPlateau || plateau < session->memoryPlateau) {
+			session->memoryPlateau = plateau;
+		}
+		
+		/* Fill in the sizes skipped over in the last rise, they weren't in any range so far */
+		for (currentSize = fits; currentSize <= misses && count < 32; currentSize *= 2) {
+			if (session_measure(session, currentSize, stride, &timing) != 0) {
+				break;
+			}
+			timingData[count++] = timing_to_double(timing);
+		}
+		
+		profile_phase_end();
+		
+		boundary = find_first_boundary(timingData, count);
+		return boundary < 0 ? fits : fits << boundary;
+	}
+	
+	profile_phase_end();
+	
+	/* Nothing got slower - the cache is at least as big as the largest size tried */
+	if (boundary < 0) {
+		return maxSize;
+	}
+	
+	/* Return the size at the point BEFORE the jump (just fits in cache)
+	   The jump happens when we exceed the cache size, so the previous
+	   size is what fits in the cache */
+	return minSize << boundary;
+}
+
+struct cache_session* create_cache_session(void)
+{
+	return calloc(1, sizeof(struct cache_session));
+}
+
+void free_cache_session(struct cache_session* session)
+{
+	if (session) {
+		free(session->points);
+		free(session);
+	}
+}
+
+unsigned int cache_session_line_size(struct cache_session* session)
+{
+	if (session->lineSize) {
+		return session->lineSize;
+	}
+	
 	#if PLATFORM_LINUX
-		unsigned int cacheLine = get_cache_line_linux();
-	#else
-		unsigned int cacheLine = detect_cache_line_size(1 * 1024 * 1024);
+		if (!simulator) {
+			profile_phase_begin("sysfs cache line");
+			session->lineSize = get_cache_line_linux();
+			profile_phase_end();
+		}
 	#endif
-	results[0] = detect_cache_level(16 * 1024, 512 * 1024, cacheLine);  /* L1 */
-	results[1] = detect_cache_level(256 * 1024, 16 * 1024 * 1024, cacheLine);  /* L2 */
-	results[2] = detect_cache_level(4 * 1024 * 1024, 64 * 1024 * 1024, cacheLine);  /* L3/SLC */
-	results[3] = cacheLine;  /* Cache line */
+	
+	if (!session->lineSize) {
+		session->lineSize = detect_cache_line_size(1 * 1024 * 1024);
+	}
+	
+	return session->lineSize;
+}
+
+unsigned int cache_session_level(struct cache_session* session, unsigned int level)
+{
+	unsigned int cacheLine;
+	
+	if (level < 1 || level > 3) {
+		return 0;
+	}
+	
+	if (!session->levels[level - 1]) {
+		/* First detect cache line size, then use it for stride */
+		cacheLine = cache_session_line_size(session);
+		session->levels[level - 1] = detect_cache_level(
+			session,
+			levelRanges[level - 1][0],
+			levelRanges[level - 1][1],
+			cacheLine,
+			level
+		);
+	}
+	
+	return session->levels[level - 1];
+}
+
+int cache_session_level_latency(struct cache_session* session, unsigned int level, double* nanos, double* cycles)
+{
+	unsigned int size = cache_session_level(session, level);
+	int fromPerf;
+
+	if (!size) {
+		return -1;
+	}
+
+	/* Half the level, so the stack and page tables don't push the chain out of it */
+	if (!session->latencies[level - 1]) {
+		double latency = measure_chase_latency(size / 2, session->lineSize);
+
+		if (latency < 0) {
+			return -1;
+		}
+		session->latencies[level - 1] = latency;
+	}
+
+	*nanos = session->latencies[level - 1];
+	*cycles = *nanos * get_stable_core_frequency(&fromPerf);
+	return 0;
 }
 
+unsigned int cache_session_memory_plateau(const struct cache_session* session)
+{
+	return session->memoryPlateau;
+}
+
+/* The session behind the one-shot get_*_cache functions, so they share their work too. */
+static struct cache_session* defaultSession = NULL;
+
+static struct cache_session* get_default_session(void)
+{
+	if (!defaultSession) {
+		defaultSession = create_cache_session();
+	}
+	
+	return defaultSession;
+}
 
+/* Forgets everything measured so far - the machine being measured changed. */
+static void drop_default_session(void)
+{
+	free_cache_session(defaultSession);
+	defaultSession = NULL;
+}
+
+/*
+	Detect L1 cache size.
+	On M1: P-cores have 128KB L1D, E-cores have 64KB L1D
+*/
+unsigned int get_l1_cache(void)
+{
+	return cache_session_level(get_default_session(), 1);
+}
+
+/*
+	Detect L2 cache size.
+	On M1: Shared L2 is 12MB for P-cores, 4MB for E-cores
+*/
+unsigned int get_l2_cache(void)
+{
+	return cache_session_level(get_default_session(), 2);
+}
+
+/*
+	Detect L3 cache size.
+	Note: M1 doesn't have traditional L3 cache - instead has System Level Cache (SLC).
+	We'll detect what's available in the 4MB-64MB range.
+*/
+unsigned int get_l3_cache(void)
+{
+	return cache_session_level(get_default_session(), 3);
+}
+
+int get_cache_level_latency(unsigned int level, double* nanos, double* cycles)
+{
+	return cache_session_level_latency(get_default_session(), level, nanos, cycles);
+}
+
+unsigned int get_memory_plateau(void)
+{
+	return defaultSession ? cache_session_memory_plateau(defaultSession) : 0;
+}
+
+/*
+	Get all cache sizes in one call.
+*/
+void get_all_cache_sizes(unsigned int results[4])
+{
+	struct cache_session* session = get_default_session();
+	
+	profile_phase_begin("get_all_cache_sizes");
+	
+	results[0] = cache_session_level(session, 1);  /* L1 */
+	results[1] = cache_session_level(session, 2);  /* L2 */
+	results[2] = cache_session_level(session, 3);  /* L3/SLC */
+	results[3] = cache_session_line_size(session);  /* Cache line */
+	
+	if (recorder) {
+		record_result_capacity(recorder, "L1", results[0]);
+		record_result_capacity(recorder, "L2", results[1]);
+		record_result_capacity(recorder, "L3", results[2]);
+		record_result_capacity(recorder, "line", results[3]);
+	}
+	
+	profile_phase_end();
+}
@@ -1,6 +1,8 @@
 #ifndef CACHE_INC
 #define CACHE_INC
 
+#include <stddef.h>
+
 /*
 	The maximum is the absolute maximum size that can be returned.
 	This function uses a heuristic to determine the cache line, or
@@ -11,6 +13,40 @@
 */
 unsigned int get_cache_line(unsigned int max, unsigned int stride);
 
+/*
+	A measurement session. Asking it for a level measures only the sizes
+	needed to find that level's boundary, and every point measured is
+	kept: later queries for other levels (whose ranges overlap) reuse
+	them, and the cache line is only detected once.
+*/
+struct cache_session;
+struct cache_session* create_cache_session(void);
+void free_cache_session(struct cache_session* session);
+
+unsigned int cache_session_line_size(struct cache_session* session);
+
+/* level is 1, 2 or 3. Returns 0 for anything else. */
+unsigned int cache_session_level(struct cache_session* session, unsigned int level);
+
+/*
+	Load-to-use latency of "level" (detecting it first if needed): a
+	dependent chase over half of it with measure_chase_latency, once per
+	session. In nanoseconds, and in cycles of the stable core clock.
+	Returns -1 if the level wasn't found or the chase can't run.
+*/
+int cache_session_level_latency(struct cache_session* session, unsigned int level, double* nanos, double* cycles);
+
+/*
+	The smallest working set that runs at memory latency, if a level's
+	sweep got that far - the sweep stops there. 0 if it was never seen.
+*/
+unsigned int cache_session_memory_plateau(const struct cache_session* session);
+
+/*
+	The functions below share one process-wide session, so calling them
+	one after another doesn't measure anything twice.
+*/
+
 /*
 	Detect L1 cache size using timing-based analysis.
 	Tests working set sizes from 16KB to 512KB range.
@@ -40,5 +76,140 @@ unsigned int get_l3_cache(void);
 */
 void get_all_cache_sizes(unsigned int results[4]);
 
+/* cache_session_level_latency and cache_session_memory_plateau for the shared session. */
+int get_cache_level_latency(unsigned int level, double* nanos, double* cycles);
+unsigned int get_memory_plateau(void);
+
+/*
+	The clock (in GHz) the core settled at before measuring started, 0
+	before that. "fromPerf" tells whether each trial's own clock comes
+	from perf's cycle counter, or from timing dependent adds after it.
+*/
+double get_stable_core_frequency(int* fromPerf);
+
+/*
+	Load-to-use latency over a "size" byte working set, in nanoseconds:
+	a dependent chase through one pointer per "stride" bytes, in random
+	order, fastest of a few runs with the timer overhead taken out.
+	-1 if it can't run: no memory, a stride too small for a pointer, or
+	the simulator is selected (it has no memory to chase through).
+*/
+double measure_chase_latency(unsigned int size, unsigned int stride);
+
+/*
+	Records every point measured from now on into "results" (pass NULL
+	to stop), repeating each measurement "trials" times. The analysis
+	then works on the median of the trials.
+
+	Recording is what makes runs comparable later; see results.h.
+*/
+struct result_set;
+void set_cache_recorder(struct result_set* results, unsigned int trials);
+
+/*
+	Back measurement buffers with transparent huge pages (Linux only),
+	which takes TLB misses out of the large working sets. Everything the
+	shared session measured so far is forgotten.
+*/
+void set_cache_huge_pages(int enabled);
+
+/*
+	How many bytes each access of the level sweeps reads and writes back:
+	1 (the default), 4, 8, 16, 32 or 64. Returns -1 for anything else,
+	or a width this compiler can't generate. The line size is always
+	detected with single bytes. Everything the shared session measured
+	so far is forgotten.
+*/
+int set_cache_access_width(unsigned int width);
+
+/*
+	Before a kernel first runs over a buffer size, it's timed without
+	any accesses (just the loop) and with a register add in place of
+	each one. The timer read back to back is timed once. Both the timer
+	and the loop overhead are subtracted from every sample the level
+	sweeps take. Times are in nanoseconds, per access unless noted.
+*/
+struct overhead_calibration
+{
+	unsigned int width;
+	unsigned int stride;
+	unsigned int size;
+	double emptyNanos;		/* What gets subtracted */
+	double registerNanos;	/* For comparison: an ALU op where the access would be */
+};
+
+/* Per pair of timer reads. 0 until something was calibrated. */
+double get_timer_overhead(void);
+
+/* Every calibration so far, in the order they were taken. Returns how many. */
+unsigned int get_overhead_calibrations(const struct overhead_calibration** calibrations);
+
+/*
+	Runs every measurement against a simulated cache hierarchy (see
+	cache_sim.h) instead of the real one, until called with NULL. The
+	simulator is flushed first, so results are fully deterministic.
+	Everything the shared session measured so far is forgotten.
+*/
+struct cache_sim;
+void set_cache_simulator(struct cache_sim* sim);
+
+/*
+	Measures every power of two working set from minSize to maxSize with
+	the given stride, without analysing anything. Only useful with a
+	recorder set - it's how fixed benchmark grids are collected.
+*/
+void measure_cache_sweep(unsigned int minSize, unsigned int maxSize, unsigned int stride);
+
+/*
+	Finds the first cache boundary in timings taken at increasing sizes:
+	the first step where the time goes up by more than SIGNIFICANT_RISE.
+	Returns the index of the last point before the boundary, or -1 if
+	the timings never rise significantly.
+*/
+int find_first_boundary(const double* timings, unsigned int count);
+
+/* How much slower a point has to be than the one before it to count as a boundary rather than noise. */
+#define SIGNIFICANT_RISE	0.2
+
+/* The sizes a level is searched between. Returns -1 for a level other than 1, 2 or 3. */
+int get_cache_level_range(unsigned int level, unsigned int* minSize, unsigned int* maxSize);
+
+/*
+	Working sets for benchmarks that run once in each detected level and
+	once from memory. A set beyond a level is LEVEL_MEMORY_MULTIPLE times
+	it, so hardly any of it can still be cached; the memory one is that
+	for the last level found, at least MIN_MEMORY_SET.
+*/
+#define LEVEL_MEMORY_MULTIPLE	4
+#define MIN_MEMORY_SET			((size_t)64 * 1024 * 1024)
+#define MAX_MEMORY_SET			((size_t)512 * 1024 * 1024)	/* What most probes allow it */
+#define MAX_LEVEL_TARGETS		4
+
+struct level_target
+{
+	unsigned int level;			/* 1 to 3, or 0 for memory */
+	size_t bytes;
+};
+
+/* LEVEL_MEMORY_MULTIPLE times "levelBytes", up to "maxBytes" */
+size_t get_set_beyond_level(size_t levelBytes, size_t maxBytes);
+
+/*
+	"levels" are L1 to L3, 0 for any that weren't found. Each found level
+	gets a target of its size over "levelDivisor", then memory one up to
+	"maxMemory". Returns how many targets there are, memory last.
+*/
+unsigned int get_level_targets(const unsigned int levels[3], unsigned int levelDivisor, size_t maxMemory, struct level_target targets[MAX_LEVEL_TARGETS]);
+
+/*
+	Average time of one access, in nanoseconds, to a freshly warmed up
+	buffer of "size" bytes - which doesn't have to be a power of two -
+	over "steps" accesses instead of the usual 128M. It's walked by a
+	different loop than the rest of the detection uses, so these timings
+	only compare with each other. Nothing is recorded. Returns -1 if the
+	buffer couldn't be allocated.
+*/
+double measure_access_time(unsigned int size, unsigned int stride, unsigned int steps);
+
 #endif
 
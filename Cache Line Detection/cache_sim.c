@@ -0,0 +1,218 @@
+#include "cache_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+	One set-associative structure - a cache level or the TLB. Entries
+	hold (block number + 1), so 0 can mean "invalid".
+*/
+struct sim_array
+{
+	unsigned int sets;
+	unsigned int ways;
+	unsigned int blockSize;
+	unsigned long long* tags;
+	unsigned long long* ages;	/* LRU: time of last use. PLRU: the MRU bit. */
+};
+
+struct cache_sim
+{
+	struct sim_config config;
+	struct sim_array levels[SIM_MAX_LEVELS];
+	struct sim_array tlb;
+	unsigned long long clock;
+};
+
+static int init_array(struct sim_array* array, unsigned int entries, unsigned int ways, unsigned int blockSize)
+{
+	if(ways == 0 || blockSize == 0 || entries < ways)
+		return -1;
+
+	array->ways = ways;
+	array->sets = entries / ways;
+	array->blockSize = blockSize;
+	array->tags = calloc((size_t)array->sets * ways, sizeof(unsigned long long));
+	array->ages = calloc((size_t)array->sets * ways, sizeof(unsigned long long));
+
+	return (array->tags && array->ages) ? 0 : -1;
+}
+
+static void free_array(struct sim_array* array)
+{
+	free(array->tags);
+	free(array->ages);
+}
+
+static void clear_array(struct sim_array* array)
+{
+	if(!array->tags)
+		return;
+
+	memset(array->tags, 0, (size_t)array->sets * array->ways * sizeof(unsigned long long));
+	memset(array->ages, 0, (size_t)array->sets * array->ways * sizeof(unsigned long long));
+}
+
+static void touch_way(struct cache_sim* sim, struct sim_array* array, unsigned long long* ages, unsigned int way)
+{
+	unsigned int i;
+
+	if(sim->config.replacement == SIM_REPLACEMENT_LRU)
+	{
+		ages[way] = ++sim->clock;
+		return;
+	}
+
+	/* Bit-PLRU: once every way is marked, start over with just this one */
+	ages[way] = 1;
+
+	for(i = 0; i < array->ways; ++i)
+		if(!ages[i])
+			return;
+
+	for(i = 0; i < array->ways; ++i)
+		ages[i] = (i == way);
+}
+
+static unsigned int pick_victim(struct cache_sim* sim, const struct sim_array* array, const unsigned long long* tags, const unsigned long long* ages)
+{
+	unsigned int victim = 0;
+	unsigned int i;
+
+	for(i = 0; i < array->ways; ++i)
+		if(!tags[i])
+			return i;
+
+	if(sim->config.replacement == SIM_REPLACEMENT_PLRU)
+	{
+		/* The first way that wasn't used recently */
+		for(i = 0; i < array->ways; ++i)
+			if(!ages[i])
+				return i;
+
+		return 0;
+	}
+
+	for(i = 1; i < array->ways; ++i)
+		if(ages[i] < ages[victim])
+			victim = i;
+
+	return victim;
+}
+
+/* Returns 1 on a hit. A miss allocates the block, evicting as needed. */
+static int access_array(struct cache_sim* sim, struct sim_array* array, unsigned long long address, int allocate)
+{
+	unsigned long long block = address / array->blockSize;
+	size_t first = (size_t)(block % array->sets) * array->ways;
+	unsigned long long* tags = &array->tags[first];
+	unsigned long long* ages = &array->ages[first];
+	unsigned int way;
+
+	for(way = 0; way < array->ways; ++way)
+	{
+		if(tags[way] == block + 1)
+		{
+			touch_way(sim, array, ages, way);
+			return 1;
+		}
+	}
+
+	if(allocate)
+	{
+		way = pick_victim(sim, array, tags, ages);
+		tags[way] = block + 1;
+		touch_way(sim, array, ages, way);
+	}
+
+	return 0;
+}
+
+struct cache_sim* create_cache_sim(const struct sim_config* config)
+{
+	struct cache_sim* sim;
+	unsigned int i;
+
+	if(config->levelCount == 0 || config->levelCount > SIM_MAX_LEVELS || config->lineSize == 0)
+		return NULL;
+
+	sim = calloc(1, sizeof(struct cache_sim));
+	if(!sim)
+		return NULL;
+
+	sim->config = *config;
+
+	for(i = 0; i < config->levelCount; ++i)
+	{
+		const struct sim_level_config* level = &config->levels[i];
+
+		if(init_array(&sim->levels[i], level->size / config->lineSize, level->ways, config->lineSize) != 0)
+		{
+			free_cache_sim(sim);
+			return NULL;
+		}
+	}
+
+	if(config->tlbEntries > 0 &&
+		init_array(&sim->tlb, config->tlbEntries, config->tlbWays, config->pageSize) != 0)
+	{
+		free_cache_sim(sim);
+		return NULL;
+	}
+
+	return sim;
+}
+
+void free_cache_sim(struct cache_sim* sim)
+{
+	unsigned int i;
+
+	if(!sim)
+		return;
+
+	for(i = 0; i < SIM_MAX_LEVELS; ++i)
+		free_array(&sim->levels[i]);
+
+	free_array(&sim->tlb);
+	free(sim);
+}
+
+const struct sim_config* get_cache_sim_config(const struct cache_sim* sim)
+{
+	return &sim->config;
+}
+
+void flush_cache_sim(struct cache_sim* sim)
+{
+	unsigned int i;
+
+	for(i = 0; i < sim->config.levelCount; ++i)
+		clear_array(&sim->levels[i]);
+
+	clear_array(&sim->tlb);
+	sim->clock = 0;
+}
+
+unsigned int sim_access(struct cache_sim* sim, unsigned long long address)
+{
+	unsigned int latency = 0;
+	unsigned int level, fill;
+
+	if(sim->tlb.tags && !access_array(sim, &sim->tlb, address, 1))
+		latency += sim->config.tlbMissLatency;
+
+	for(level = 0; level < sim->config.levelCount; ++level)
+		if(access_array(sim, &sim->levels[level], address, 0))
+			break;
+
+	if(level < sim->config.levelCount)
+		latency += sim->config.levels[level].latency;
+	else
+		latency += sim->config.memoryLatency;
+
+	/* Bring the line into every level above the one that had it */
+	for(fill = 0; fill < level; ++fill)
+		access_array(sim, &sim->levels[fill], address, 1);
+
+	return latency;
+}
@@ -0,0 +1,61 @@
+#ifndef CACHE_SIM_INC
+#define CACHE_SIM_INC
+
+/*
+	A deterministic software model of a cache hierarchy.
+
+	The detection heuristics can be pointed at it instead of real
+	hardware (see set_cache_simulator in cache.h), which makes them
+	testable against a known ground truth. It isn't meant to be cycle
+	accurate, only to produce the same shape of curves real machines do.
+*/
+
+#define SIM_MAX_LEVELS	4
+
+enum sim_replacement
+{
+	SIM_REPLACEMENT_LRU,
+	SIM_REPLACEMENT_PLRU	/* Bit-PLRU (a.k.a. MRU bits), works with any associativity */
+};
+
+struct sim_level_config
+{
+	unsigned int size;		/* In bytes */
+	unsigned int ways;
+	unsigned int latency;	/* Load-to-use latency of a hit, in cycles */
+};
+
+struct sim_config
+{
+	unsigned int lineSize;
+
+	unsigned int levelCount;
+	struct sim_level_config levels[SIM_MAX_LEVELS];
+
+	unsigned int memoryLatency;	/* In cycles */
+	enum sim_replacement replacement;
+
+	/* A single level TLB. tlbEntries = 0 leaves translation out entirely. */
+	unsigned int tlbEntries;
+	unsigned int tlbWays;
+	unsigned int pageSize;
+	unsigned int tlbMissLatency;	/* Page walk, added on top of the data access */
+
+	double frequencyGHz;
+};
+
+struct cache_sim;
+
+/* Returns NULL if the configuration makes no sense or memory runs out. */
+struct cache_sim* create_cache_sim(const struct sim_config* config);
+void free_cache_sim(struct cache_sim* sim);
+
+const struct sim_config* get_cache_sim_config(const struct cache_sim* sim);
+
+/* Invalidates every cache line and TLB entry. */
+void flush_cache_sim(struct cache_sim* sim);
+
+/* Simulates one load. Returns its latency in cycles. */
+unsigned int sim_access(struct cache_sim* sim, unsigned long long address);
+
+#endif
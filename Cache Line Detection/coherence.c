@@ -0,0 +1,498 @@
+#include "coherence.h"
+#include "threads.h"
+#include "affinity.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* relationNames[RELATION_COUNT] = {"Same CPU", "SMT sibling", "Same L3", "Other socket"};
+static const char* stateNames[STATE_COUNT] = {"Modified", "Exclusive", "Shared", "Invalid"};
+
+const char* coherence_relation_name(enum coherence_relation relation)
+{
+	return (unsigned int)relation < RELATION_COUNT ? relationNames[relation] : "?";
+}
+
+const char* coherence_state_name(enum coherence_state state)
+{
+	return (unsigned int)state < STATE_COUNT ? stateNames[state] : "?";
+}
+
+#if defined(__x86_64__) && PLATFORM_LINUX && HAVE_THREADS
+
+#include <emmintrin.h>
+
+#define LINES				256
+#define LINE_STRIDE			128				/* Every other 64B line */
+#define TRIALS				25
+
+/* What the measurer is waiting for, handed from thread to thread */
+enum step
+{
+	STEP_IDLE,
+	STEP_HELPER,
+	STEP_OWNER,
+	STEP_MEASURE,
+	STEP_DONE
+};
+
+enum role
+{
+	ROLE_MEASURER,
+	ROLE_OWNER,
+	ROLE_HELPER
+};
+
+struct coherence_line
+{
+	struct coherence_line* next;
+	uint64_t value;
+};
+
+struct coherence_run
+{
+	char* buffer;
+	struct coherence_line* head;
+	struct coherence_line* order[LINES];	/* The chase's order, for the stores */
+
+	unsigned int step;						/* Only through set_step and wait_for */
+	enum coherence_state state;
+	int ownerInline;						/* Same CPU: the measurer prepares the lines itself */
+	int hasHelper;
+	enum role roles[3];
+
+	struct coherence_cell* cells;			/* By state */
+};
+
+/* Where a CPU sits, from sysfs */
+struct cpu_place
+{
+	int package;
+	int core;
+	char l3[128];							/* shared_cpu_list, empty if unknown */
+};
+
+static int read_cpu_file(int cpu, const char* file, char* text, size_t size)
+{
+	char path[256];
+	FILE* fp;
+	size_t length;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+	fp = fopen(path, "r");
+	if(!fp)
+		return -1;
+
+	if(!fgets(text, (int)size, fp))
+	{
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	length = strlen(text);
+	if(length > 0 && text[length - 1] == '\n')
+		text[length - 1] = '\0';
+
+	return 0;
+}
+
+/* The cache index sysfs gives L3, -1 if there isn't one */
+static int find_l3_index(void)
+{
+	char file[64];
+	char text[16];
+	int index;
+
+	for(index = 0; index < 16; ++index)
+	{
+		snprintf(file, sizeof(file), "cache/index%d/level", index);
+		if(read_cpu_file(0, file, text, sizeof(text)) != 0)
+			return -1;
+		if(atoi(text) == 3)
+			return index;
+	}
+
+	return -1;
+}
+
+static void get_cpu_place(int cpu, int l3Index, struct cpu_place* place)
+{
+	char text[32];
+	char file[64];
+
+	place->package = read_cpu_file(cpu, "topology/physical_package_id", text, sizeof(text)) == 0 ? atoi(text) : 0;
+	place->core = read_cpu_file(cpu, "topology/core_id", text, sizeof(text)) == 0 ? atoi(text) : cpu;
+	place->l3[0] = '\0';
+
+	if(l3Index >= 0)
+	{
+		snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", l3Index);
+		if(read_cpu_file(cpu, file, place->l3, sizeof(place->l3)) != 0)
+			place->l3[0] = '\0';
+	}
+}
+
+static int stands_in(const struct cpu_place* measurer, const struct cpu_place* other, enum coherence_relation relation)
+{
+	const int sibling = other->package == measurer->package && other->core == measurer->core;
+	const int sameL3 = measurer->l3[0] && other->l3[0] ? strcmp(measurer->l3, other->l3) == 0 : other->package == measurer->package;
+
+	switch(relation)
+	{
+	case RELATION_SMT_SIBLING:
+		return sibling;
+	case RELATION_SAME_L3:
+		return !sibling && sameL3;
+	case RELATION_OTHER_SOCKET:
+		return other->package != measurer->package;
+	default:
+		return 0;
+	}
+}
+
+/*
+	The measurer is the first CPU the affinity mask allows. Then an
+	owner for every relation, and a helper that is neither the owner
+	nor the measurer, preferably off the measurer's core so its copy
+	isn't found there, all from the mask too. The measurer is -1 if the
+	mask allows none of the online CPUs.
+*/
+static void choose_cpus(struct coherence_result* result)
+{
+	const int cpus = get_cpu_count();
+	const int l3Index = find_l3_index();
+	struct cpu_place* places = calloc((size_t)cpus, sizeof(struct cpu_place));
+	char* allowed = calloc((size_t)cpus, 1);
+	unsigned int relation;
+	int cpu;
+
+	result->measurer = -1;
+	for(relation = 0; relation < RELATION_COUNT; ++relation)
+	{
+		result->owners[relation] = -1;
+		result->helpers[relation] = -1;
+	}
+
+	if(!places || !allowed)
+	{
+		free(places);
+		free(allowed);
+		return;
+	}
+
+	for(cpu = 0; cpu < cpus; ++cpu)
+	{
+		allowed[cpu] = (char)is_cpu_allowed(cpu);
+		if(allowed[cpu] && result->measurer < 0)
+			result->measurer = cpu;
+		get_cpu_place(cpu, l3Index, &places[cpu]);
+	}
+
+	if(result->measurer < 0)
+	{
+		free(places);
+		free(allowed);
+		return;
+	}
+	result->owners[RELATION_SAME_CPU] = result->measurer;
+
+	for(relation = RELATION_SMT_SIBLING; relation < RELATION_COUNT; ++relation)
+		for(cpu = 0; cpu < cpus && result->owners[relation] < 0; ++cpu)
+			if(allowed[cpu] && cpu != result->measurer && stands_in(&places[result->measurer], &places[cpu], (enum coherence_relation)relation))
+				result->owners[relation] = cpu;
+
+	for(relation = 0; relation < RELATION_COUNT; ++relation)
+	{
+		int fallback = -1;
+
+		if(result->owners[relation] < 0)
+			continue;
+
+		for(cpu = 0; cpu < cpus && result->helpers[relation] < 0; ++cpu)
+		{
+			if(!allowed[cpu] || cpu == result->measurer || cpu == result->owners[relation])
+				continue;
+
+			if(!stands_in(&places[result->measurer], &places[cpu], RELATION_SMT_SIBLING))
+				result->helpers[relation] = cpu;
+			else if(fallback < 0)
+				fallback = cpu;
+		}
+
+		if(result->helpers[relation] < 0)
+			result->helpers[relation] = fallback;
+	}
+
+	free(places);
+	free(allowed);
+}
+
+/*
+	Hands the lines to the next thread. Release and acquire, so what one
+	thread did to the lines is done before the next one is told to go.
+*/
+static void set_step(struct coherence_run* run, unsigned int step)
+{
+	__atomic_store_n(&run->step, step, __ATOMIC_RELEASE);
+}
+
+static unsigned int wait_for(struct coherence_run* run, unsigned int first, unsigned int second)
+{
+	unsigned int seen;
+
+	while((seen = __atomic_load_n(&run->step, __ATOMIC_ACQUIRE)) != first && seen != second)
+		_mm_pause();
+
+	return seen;
+}
+
+static void flush_lines(struct coherence_run* run)
+{
+	unsigned int i;
+
+	for(i = 0; i < LINES; ++i)
+		_mm_clflush(run->buffer + (size_t)i * LINE_STRIDE);
+	_mm_mfence();
+}
+
+static void read_lines(struct coherence_run* run)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for(i = 0; i < LINES; ++i)
+		sum += ((volatile struct coherence_line*)(run->buffer + (size_t)i * LINE_STRIDE))->value;
+
+	__asm__ volatile("" : : "r"(sum) : "memory");
+	_mm_mfence();
+}
+
+static void write_lines(struct coherence_run* run)
+{
+	unsigned int i;
+
+	for(i = 0; i < LINES; ++i)
+		((volatile struct coherence_line*)(run->buffer + (size_t)i * LINE_STRIDE))->value++;
+
+	_mm_mfence();
+}
+
+static void owner_prepare(struct coherence_run* run)
+{
+	if(run->state == STATE_MODIFIED || run->state == STATE_INVALID)
+		write_lines(run);
+	else
+		read_lines(run);
+}
+
+/* Flushed from everywhere, then handed to the helper and owner to put in "state" */
+static void prepare(struct coherence_run* run)
+{
+	flush_lines(run);
+
+	if(run->state == STATE_SHARED)
+		set_step(run, STEP_HELPER);
+	else if(!run->ownerInline)
+		set_step(run, STEP_OWNER);
+
+	if(run->ownerInline)
+	{
+		if(run->state == STATE_SHARED)
+			wait_for(run, STEP_OWNER, STEP_OWNER);
+		owner_prepare(run);
+	}
+	else
+		wait_for(run, STEP_MEASURE, STEP_MEASURE);
+
+	if(run->state == STATE_INVALID)
+		flush_lines(run);
+}
+
+static double time_loads(struct coherence_run* run)
+{
+	const struct coherence_line* line = run->head;
+	double begin = get_time_seconds();
+	unsigned int i;
+
+	for(i = 0; i < LINES; ++i)
+		line = line->next;
+
+	__asm__ volatile("" : : "r"(line) : "memory");
+	return (get_time_seconds() - begin) * 1e9 / LINES;
+}
+
+static double time_stores(struct coherence_run* run)
+{
+	double begin = get_time_seconds();
+	unsigned int i;
+
+	for(i = 0; i < LINES; ++i)
+	{
+		((volatile struct coherence_line*)run->order[i])->value = i;
+		_mm_mfence();
+	}
+
+	return (get_time_seconds() - begin) * 1e9 / LINES;
+}
+
+static void measure_states(struct coherence_run* run)
+{
+	double loads[TRIALS];
+	double stores[TRIALS];
+	unsigned int state, trial;
+
+	for(state = 0; state < STATE_COUNT; ++state)
+	{
+		if(state == STATE_SHARED && !run->hasHelper)
+			continue;
+
+		run->state = (enum coherence_state)state;
+		for(trial = 0; trial < TRIALS; ++trial)
+		{
+			prepare(run);
+			loads[trial] = time_loads(run);
+			prepare(run);
+			stores[trial] = time_stores(run);
+		}
+
+		run->cells[state].supported = 1;
+		run->cells[state].loadNanos = sample_median(loads, TRIALS);
+		run->cells[state].storeNanos = sample_median(stores, TRIALS);
+	}
+
+	set_step(run, STEP_DONE);
+}
+
+static void coherence_thread(unsigned int index, void* context)
+{
+	struct coherence_run* run = context;
+
+	switch(run->roles[index])
+	{
+	case ROLE_MEASURER:
+		measure_states(run);
+		break;
+	case ROLE_OWNER:
+		while(wait_for(run, STEP_OWNER, STEP_DONE) != STEP_DONE)
+		{
+			owner_prepare(run);
+			set_step(run, STEP_MEASURE);
+		}
+		break;
+	case ROLE_HELPER:
+		while(wait_for(run, STEP_HELPER, STEP_DONE) != STEP_DONE)
+		{
+			read_lines(run);
+			set_step(run, STEP_OWNER);
+		}
+		break;
+	}
+}
+
+/* The lines linked in a random order, the measurer's own pointers to them too */
+static void link_lines(struct coherence_run* run)
+{
+	unsigned int order[LINES];
+	unsigned int i;
+
+	shuffle_indices(order, LINES, 0x5BD1E995);
+
+	for(i = 0; i < LINES; ++i)
+		run->order[i] = (struct coherence_line*)(run->buffer + (size_t)order[i] * LINE_STRIDE);
+	for(i = 0; i < LINES; ++i)
+	{
+		run->order[i]->next = run->order[(i + 1) % LINES];
+		run->order[i]->value = 0;
+	}
+
+	run->head = run->order[0];
+}
+
+static int measure_relation(struct coherence_result* result, enum coherence_relation relation, char* buffer)
+{
+	struct coherence_run run;
+	int cpus[3];
+	unsigned int count = 0;
+
+	memset(&run, 0, sizeof(run));
+	run.buffer = buffer;
+	run.ownerInline = relation == RELATION_SAME_CPU;
+	run.hasHelper = result->helpers[relation] >= 0;
+	run.cells = result->cells[relation];
+	set_step(&run, STEP_IDLE);
+	link_lines(&run);
+
+	cpus[count] = result->measurer;
+	run.roles[count++] = ROLE_MEASURER;
+	if(!run.ownerInline)
+	{
+		cpus[count] = result->owners[relation];
+		run.roles[count++] = ROLE_OWNER;
+	}
+	if(run.hasHelper)
+	{
+		cpus[count] = result->helpers[relation];
+		run.roles[count++] = ROLE_HELPER;
+	}
+
+	return run_threads_on_cpus(count, cpus, coherence_thread, &run);
+}
+
+int measure_coherence(struct coherence_result* result, const char** failure)
+{
+	unsigned int relation;
+	char* buffer;
+
+	memset(result, 0, sizeof(*result));
+	choose_cpus(result);
+
+	if(result->measurer < 0)
+	{
+		*failure = "the affinity mask allows none of the online CPUs";
+		return -1;
+	}
+
+	buffer = aligned_alloc(4096, (size_t)LINES * LINE_STRIDE);
+	if(!buffer)
+	{
+		*failure = "out of memory";
+		return -1;
+	}
+
+	profile_phase_begin("coherence probe");
+	for(relation = 0; relation < RELATION_COUNT; ++relation)
+	{
+		if(result->owners[relation] < 0)
+			continue;
+
+		if(measure_relation(result, (enum coherence_relation)relation, buffer) != 0)
+		{
+			profile_phase_end();
+			free(buffer);
+			*failure = "couldn't start the threads, or pin them to their CPUs";
+			return -1;
+		}
+	}
+	profile_phase_end();
+
+	free(buffer);
+	return 0;
+}
+
+#else
+
+int measure_coherence(struct coherence_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs x86-64 Linux";
+	return -1;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef COHERENCE_INC
+#define COHERENCE_INC
+
+/*
+	What a load or a store costs depending on where the line is and in
+	which MESI state. One CPU measures; an owner prepares the lines
+	first, from the same logical CPU, its SMT sibling, another core on
+	the same L3, or a core on another socket:
+
+		Modified	the owner wrote them
+		Exclusive	the owner read them, nobody else has a copy
+		Shared		a helper CPU read them, then the owner
+		Invalid		the owner wrote them, then they were flushed from
+					every cache, so they come from memory
+
+	Loads are a pointer chase through the lines in random order; stores
+	are each followed by mfence, so every one waits for its read for
+	ownership. Lines are two apart, so the adjacent line prefetcher
+	can't fetch one with another.
+
+	CPUs come from sysfs, within the affinity mask: the measurer is the
+	first CPU it allows, the others the first that stand in each
+	relation to it. Every thread is pinned, and the run fails if one
+	can't be. Needs x86-64 Linux.
+*/
+
+enum coherence_relation
+{
+	RELATION_SAME_CPU,
+	RELATION_SMT_SIBLING,
+	RELATION_SAME_L3,
+	RELATION_OTHER_SOCKET,
+
+	RELATION_COUNT
+};
+
+enum coherence_state
+{
+	STATE_MODIFIED,
+	STATE_EXCLUSIVE,
+	STATE_SHARED,
+	STATE_INVALID,
+
+	STATE_COUNT
+};
+
+struct coherence_cell
+{
+	int supported;							/* 0 for Shared without a helper CPU */
+	double loadNanos;						/* Medians of the trials */
+	double storeNanos;
+};
+
+struct coherence_result
+{
+	int measurer;
+	int owners[RELATION_COUNT];				/* -1 where no CPU stands in that relation */
+	int helpers[RELATION_COUNT];			/* For Shared; -1 if there's no third CPU */
+	struct coherence_cell cells[RELATION_COUNT][STATE_COUNT];
+};
+
+const char* coherence_relation_name(enum coherence_relation relation);
+const char* coherence_state_name(enum coherence_state state);
+
+/* Returns 0 on success, -1 with "failure" set where it can't run. */
+int measure_coherence(struct coherence_result* result, const char** failure);
+
+#endif
@@ -0,0 +1,153 @@
+#include "compare.h"
+#include "results.h"
+#include "stats.h"
+#include "format.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Bandwidths regress when they go down, everything else (latencies) when it goes up. */
+static int higher_is_better(const struct result_curve* curve)
+{
+	return strstr(curve->unit, "/s") != NULL;
+}
+
+static unsigned int compare_capacities(const struct result_set* baseline, const struct result_set* current)
+{
+	unsigned int changes = 0;
+	unsigned int i;
+
+	for(i = 0; i < baseline->capacityCount; ++i)
+	{
+		const struct result_capacity* before = &baseline->capacities[i];
+		const struct result_capacity* after = find_result_capacity(current, before->name);
+
+		if(!after)
+		{
+			printf("  %-8s missing from the current run\n", before->name);
+			continue;
+		}
+
+		if(before->bytes != after->bytes)
+		{
+			struct size_of_data formattedBefore = unitfy_data_size(before->bytes);
+			struct size_of_data formattedAfter = unitfy_data_size(after->bytes);
+
+			printf("  %-8s changed: %u%s -> %u%s\n",
+				before->name,
+				formattedBefore.quantity, formattedBefore.unit,
+				formattedAfter.quantity, formattedAfter.unit);
+			++changes;
+		}
+	}
+
+	return changes;
+}
+
+static unsigned int compare_curve(
+		const struct result_curve* before,
+		const struct result_curve* after,
+		double thresholdPercent,
+		double alpha
+	)
+{
+	unsigned int regressions = 0;
+	unsigned int i;
+
+	for(i = 0; i < before->pointCount; ++i)
+	{
+		const struct result_point* pointBefore = &before->points[i];
+		const struct result_point* pointAfter = find_result_point(after, pointBefore->x);
+		double meanBefore, meanAfter, change, pValue;
+		int worse;
+
+		if(!pointAfter || pointBefore->trialCount == 0 || pointAfter->trialCount == 0)
+			continue;
+
+		meanBefore = sample_mean(pointBefore->trials, pointBefore->trialCount);
+		meanAfter = sample_mean(pointAfter->trials, pointAfter->trialCount);
+
+		if(meanBefore == 0)
+			continue;
+
+		change = (meanAfter - meanBefore) / meanBefore * 100;
+		worse = higher_is_better(before) ? (change < -thresholdPercent) : (change > thresholdPercent);
+
+		if(!worse)
+			continue;
+
+		pValue = welch_t_test(
+			pointBefore->trials, pointBefore->trialCount,
+			pointAfter->trials, pointAfter->trialCount
+		);
+
+		/* A single trial can't be tested. Show it, but don't fail the comparison on it. */
+		if(pValue < 0)
+		{
+			printf("  %-14s x=%-10u %10.4g -> %10.4g %s (%+.1f%%, untested: need 2+ trials)\n",
+				before->name, pointBefore->x, meanBefore, meanAfter, before->unit, change);
+			continue;
+		}
+
+		if(pValue < alpha)
+		{
+			printf("  %-14s x=%-10u %10.4g -> %10.4g %s (%+.1f%%, p=%.2g)\n",
+				before->name, pointBefore->x, meanBefore, meanAfter, before->unit, change, pValue);
+			++regressions;
+		}
+	}
+
+	return regressions;
+}
+
+int compare_result_files(
+		const char* baselinePath,
+		const char* currentPath,
+		double thresholdPercent,
+		double alpha
+	)
+{
+	struct result_set* baseline;
+	struct result_set* current;
+	unsigned int regressions = 0, capacityChanges;
+	unsigned int i;
+
+	baseline = load_result_set(baselinePath);
+	if(!baseline)
+	{
+		fprintf(stderr, "Can't read results from %s\n", baselinePath);
+		return 2;
+	}
+
+	current = load_result_set(currentPath);
+	if(!current)
+	{
+		fprintf(stderr, "Can't read results from %s\n", currentPath);
+		free_result_set(baseline);
+		return 2;
+	}
+
+	printf("Comparing %s (baseline) against %s\n", baselinePath, currentPath);
+	printf("Threshold: %.1f%%, significance level: %g\n\n", thresholdPercent, alpha);
+
+	printf("Capacity changes:\n");
+	capacityChanges = compare_capacities(baseline, current);
+	if(capacityChanges == 0)
+		printf("  none\n");
+
+	printf("\nSignificant regressions:\n");
+	for(i = 0; i < baseline->curveCount; ++i)
+	{
+		const struct result_curve* after = find_result_curve(current, baseline->curves[i].name);
+
+		if(after)
+			regressions += compare_curve(&baseline->curves[i], after, thresholdPercent, alpha);
+	}
+	if(regressions == 0)
+		printf("  none\n");
+
+	free_result_set(baseline);
+	free_result_set(current);
+
+	return (regressions > 0 || capacityChanges > 0) ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+#ifndef COMPARE_INC
+#define COMPARE_INC
+
+/*
+	Compares two saved result files (see results.h) point by point.
+
+	A point counts as a regression when it got worse by more than
+	thresholdPercent and Welch's t-test over the trials says the change
+	is significant at level alpha. Any change in a detected capacity is
+	reported as well.
+
+	Returns 0 if nothing regressed, 1 if something did and 2 if the
+	files couldn't be read - ready to be used as an exit code.
+*/
+int compare_result_files(
+		const char* baselinePath,
+		const char* currentPath,
+		double thresholdPercent,
+		double alpha
+	);
+
+#endif
@@ -0,0 +1,258 @@
+#include "dram.h"
+#include "cache.h"
+#include "stats.h"
+#include "profile.h"
+#include "fast_math.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (PLATFORM_LINUX || PLATFORM_MACOS)
+
+#include <emmintrin.h>
+
+#if PLATFORM_LINUX
+#include <sys/mman.h>
+#endif
+
+#define LINE				64
+#define HUGE_PAGE			(2 * 1024 * 1024)
+
+/* The buffer is LLC_MULTIPLE times the LLC, within these bounds */
+#define LLC_MULTIPLE		8
+#define MIN_BUFFER			((size_t)256 * 1024 * 1024)
+#define MAX_BUFFER			((size_t)1024 * 1024 * 1024)
+
+#define PAIRS				4096
+#define PAIR_ROUNDS			64
+
+#define FIRST_STRIDE		128
+#define STRIDE_LINES		32
+#define STRIDE_ROUNDS		2048
+#define STRIDE_TRIALS		5
+
+#define TRIALS				3
+
+static uint64_t sink;
+
+/* The buffer's memory is all zeros, so the second address doesn't move, but the load waits for the first */
+static void run_pair(const char* first, const char* second, unsigned int rounds)
+{
+	uint64_t value = 0;
+	unsigned int round;
+
+	for(round = 0; round < rounds; ++round)
+	{
+		_mm_clflush(first);
+		_mm_clflush(second);
+		_mm_mfence();
+
+		value = *(volatile const uint64_t*)(first + value);
+		value = *(volatile const uint64_t*)(second + value);
+	}
+
+	sink = value;
+}
+
+/* Median nanoseconds per access */
+static double time_pair(const char* first, const char* second)
+{
+	double samples[TRIALS];
+	unsigned int trial;
+
+	run_pair(first, second, PAIR_ROUNDS);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		run_pair(first, second, PAIR_ROUNDS);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / (2 * PAIR_ROUNDS);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+static void run_stride(const char* base, size_t stride, unsigned int rounds)
+{
+	uint64_t sum = 0;
+	unsigned int round, line;
+
+	for(round = 0; round < rounds; ++round)
+	{
+		for(line = 0; line < STRIDE_LINES; ++line)
+			sum += *(volatile const uint64_t*)(base + line * stride);
+
+		for(line = 0; line < STRIDE_LINES; ++line)
+			_mm_clflush(base + line * stride);
+		_mm_mfence();
+	}
+
+	sink = sum;
+}
+
+static double time_rounds(const char* base, size_t stride)
+{
+	double begin = get_time_seconds();
+
+	run_stride(base, stride, STRIDE_ROUNDS);
+	return (get_time_seconds() - begin) * 1e9 / ((double)STRIDE_ROUNDS * STRIDE_LINES);
+}
+
+/*
+	Median nanoseconds per line at "stride" and at it plus a line. Their
+	trials take turns, so whatever else the machine is doing lands on
+	both alike.
+*/
+static void time_stride(const char* base, size_t stride, double* aligned, double* offset)
+{
+	double alignedSamples[STRIDE_TRIALS];
+	double offsetSamples[STRIDE_TRIALS];
+	unsigned int trial;
+
+	run_stride(base, stride, STRIDE_ROUNDS / 16);
+	run_stride(base, stride + LINE, STRIDE_ROUNDS / 16);
+
+	for(trial = 0; trial < STRIDE_TRIALS; ++trial)
+	{
+		alignedSamples[trial] = time_rounds(base, stride);
+		offsetSamples[trial] = time_rounds(base, stride + LINE);
+	}
+
+	*aligned = sample_median(alignedSamples, STRIDE_TRIALS);
+	*offset = sample_median(offsetSamples, STRIDE_TRIALS);
+}
+
+static size_t buffer_size(size_t llcSize)
+{
+	size_t size = llcSize * LLC_MULTIPLE;
+
+	if(size < MIN_BUFFER)
+		size = MIN_BUFFER;
+	if(size > MAX_BUFFER)
+		size = MAX_BUFFER;
+
+	return (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+}
+
+/*
+	Conflicts are the pairs more than SIGNIFICANT_RISE slower than the
+	median; with dozens of banks they're a few percent at most, so the
+	median is a hit.
+*/
+static void measure_rows(char* buffer, size_t size, struct dram_result* result)
+{
+	const char* fixed = buffer + size / 2;
+	double* times = malloc(PAIRS * sizeof(double));
+	unsigned int state = 2463534242u;
+	unsigned int hits = 0;
+	double limit;
+	unsigned int i;
+
+	if(!times)
+		return;
+
+	for(i = 0; i < PAIRS; ++i)
+	{
+		size_t line = next_random(&state) % (size / LINE);
+
+		times[i] = time_pair(fixed, buffer + line * LINE);
+	}
+
+	result->pairs = PAIRS;
+	limit = sample_median(times, PAIRS) * (1 + SIGNIFICANT_RISE);
+
+	/* Hits first, conflicts after them, in place */
+	for(i = 0; i < PAIRS; ++i)
+	{
+		if(times[i] <= limit)
+		{
+			double hit = times[i];
+
+			times[i] = times[hits];
+			times[hits++] = hit;
+		}
+	}
+
+	result->conflicts = PAIRS - hits;
+	result->rowHitNanos = sample_median(times, hits);
+	if(result->conflicts)
+		result->rowConflictNanos = sample_median(times + hits, result->conflicts);
+
+	free(times);
+}
+
+static int is_singled_out(const struct dram_result* result, unsigned int i)
+{
+	return result->aligned[i] > result->offset[i] * (1 + SIGNIFICANT_RISE);
+}
+
+/* A stride that really shares a channel or bank passes that on to twice it, so a lone slow stride is noise */
+static void measure_strides(const char* buffer, size_t size, struct dram_result* result)
+{
+	size_t stride;
+	unsigned int i;
+
+	for(stride = FIRST_STRIDE; result->strideCount < DRAM_MAX_STRIDES && STRIDE_LINES * (stride + LINE) <= size; stride *= 2)
+	{
+		i = result->strideCount++;
+
+		result->strides[i] = (unsigned int)stride;
+		time_stride(buffer, stride, &result->aligned[i], &result->offset[i]);
+	}
+
+	for(i = 0; i + 1 < result->strideCount; ++i)
+	{
+		if(is_singled_out(result, i) && is_singled_out(result, i + 1))
+		{
+			result->interleavePeriod = result->strides[i];
+			break;
+		}
+	}
+}
+
+int measure_dram(size_t llcSize, struct dram_result* result, const char** failure)
+{
+	const size_t size = buffer_size(llcSize);
+	void* buffer;
+
+	memset(result, 0, sizeof(*result));
+
+	if(posix_memalign(&buffer, HUGE_PAGE, size) != 0)
+	{
+		*failure = "not enough memory for a buffer several times the LLC";
+		return -1;
+	}
+
+#if PLATFORM_LINUX
+	result->hugePages = madvise(buffer, size, MADV_HUGEPAGE) == 0;
+#endif
+
+	/* Faults every page in before anything is timed */
+	memset(buffer, 0, size);
+	result->bufferSize = size;
+
+	profile_phase_begin("DRAM row buffer probe");
+	measure_rows(buffer, size, result);
+	profile_phase_end();
+
+	profile_phase_begin("DRAM interleaving probe");
+	measure_strides(buffer, size, result);
+	profile_phase_end();
+
+	free(buffer);
+	return 0;
+}
+
+#else
+
+int measure_dram(size_t llcSize, struct dram_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs clflush, on x86-64 Linux or macOS";
+	return -1;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef DRAM_INC
+#define DRAM_INC
+
+#include <stddef.h>
+
+/*
+	What's past the last cache: DRAM rows, banks and channels, over a
+	buffer several times the size of the LLC, flushing every line after
+	touching it so each access really goes to memory.
+
+	Row buffer: a fixed address and a random other one are flushed and
+	loaded in turn, the second load depending on the first. If both are
+	in one bank but different rows, every load closes the row the other
+	one opened (a conflict); otherwise each finds its own row still open
+	(a hit). Most pairs hit, the few that are slower conflict, and how
+	few says roughly how many banks (across channels and ranks) there are.
+
+	Interleaving: rounds of independent loads, a line every "stride"
+	bytes, compared against the same stride plus a line. Once a stride
+	is a multiple of the span addresses rotate through channels and banks
+	in, all its loads queue on one of them while the offset stride still
+	spreads out; prefetchers and the TLB treat both alike.
+
+	Physical addresses decide all of this. The buffer is handed to
+	transparent huge pages where there are any, so at least the low 21
+	bits of the virtual address are physical too. Under a hypervisor the
+	guest's physical addresses may not be the machine's.
+
+	x86-64 Linux and macOS only: it needs clflush.
+*/
+
+#define DRAM_MAX_STRIDES	16		/* 128B and up, in powers of two */
+
+struct dram_result
+{
+	size_t bufferSize;
+	int hugePages;							/* Whether THP was asked for */
+
+	/* Per access, each including its share of the flushing */
+	unsigned int pairs;						/* Random addresses tried */
+	unsigned int conflicts;					/* How many were slower */
+	double rowHitNanos;
+	double rowConflictNanos;				/* 0 if none were slower */
+
+	/* Nanoseconds per line, at each stride and at it plus a line */
+	unsigned int strideCount;
+	unsigned int strides[DRAM_MAX_STRIDES];
+	double aligned[DRAM_MAX_STRIDES];
+	double offset[DRAM_MAX_STRIDES];
+
+	/* The smallest stride much slower than its offset one, 0 if there's none */
+	unsigned int interleavePeriod;
+};
+
+/*
+	"llcSize" is the last level cache's size as far as the caller knows,
+	0 if it doesn't. Returns 0 on success, -1 if the probe can't run here,
+	with "failure" saying why.
+*/
+int measure_dram(size_t llcSize, struct dram_result* result, const char** failure);
+
+#endif
@@ -39,3 +39,29 @@ int is_power_of_two(unsigned int num)
 {
 	return ((num & (num - 1)) == 0) && num;
 }
+
+unsigned int next_random(unsigned int* state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+void shuffle_indices(unsigned int* order, unsigned int count, unsigned int seed)
+{
+	unsigned int i;
+
+	for(i = 0; i < count; ++i)
+		order[i] = i;
+
+	/* Fisher-Yates */
+	for(i = count; i > 1; --i)
+	{
+		unsigned int j = next_random(&seed) % i;
+		unsigned int swap = order[i - 1];
+
+		order[i - 1] = order[j];
+		order[j] = swap;
+	}
+}
@@ -4,4 +4,14 @@
 unsigned int int_pow(unsigned int base, unsigned int exponent);
 int is_power_of_two(unsigned int num);
 
+/*
+	A 32-bit xorshift generator, rather than the C library's, so a given
+	seed gives the same numbers everywhere. Advances "state", which must
+	not start at 0, and returns it.
+*/
+unsigned int next_random(unsigned int* state);
+
+/* Fills "order" with a random permutation of 0 to count - 1, from next_random. */
+void shuffle_indices(unsigned int* order, unsigned int count, unsigned int seed);
+
 #endif
@@ -0,0 +1,278 @@
+#include "faults.h"
+#include "threads.h"
+#include "affinity.h"
+#include "cache.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* methodNames[FAULT_METHOD_COUNT] = {"4KB touch", "THP touch", "MAP_POPULATE", "MADV_POPULATE_WRITE"};
+
+const char* fault_method_name(enum fault_method method)
+{
+	return (unsigned int)method < FAULT_METHOD_COUNT ? methodNames[method] : "?";
+}
+
+#if PLATFORM_LINUX && HAVE_THREADS
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+/* Older headers don't have it; older kernels refuse it with EINVAL */
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE	23
+#endif
+
+#define PAGE_4K				4096
+#define HUGE_PAGE			((size_t)2 * 1024 * 1024)
+
+/* Split between the threads, so the total work is the same at every count */
+#define REGION_SIZE			((size_t)256 * 1024 * 1024)
+#define TRIALS				3
+
+struct fault_run
+{
+	enum fault_method method;
+	char* region;							/* NULL for MAP_POPULATE, where each thread maps its own */
+	size_t slice;							/* Bytes per thread, a multiple of 2MB */
+	struct thread_barrier barrier;
+
+	double* begin;
+	double* end;
+	int* failed;
+};
+
+static void fault_thread(unsigned int index, void* context)
+{
+	struct fault_run* run = context;
+	char* slice = run->region ? run->region + index * run->slice : NULL;
+	size_t offset;
+
+	thread_barrier_wait(&run->barrier);
+	run->begin[index] = get_time_seconds();
+
+	switch(run->method)
+	{
+	case FAULT_MAP_POPULATE:
+		slice = mmap(NULL, run->slice, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if(slice == MAP_FAILED)
+			run->failed[index] = 1;
+		break;
+	case FAULT_POPULATE_WRITE:
+		if(madvise(slice, run->slice, MADV_POPULATE_WRITE) != 0)
+			run->failed[index] = 1;
+		break;
+	default:
+		for(offset = 0; offset < run->slice; offset += PAGE_4K)
+			*(volatile char*)(slice + offset) = 1;
+		break;
+	}
+
+	run->end[index] = get_time_seconds();
+
+	if(run->method == FAULT_MAP_POPULATE && slice != MAP_FAILED)
+		munmap(slice, run->slice);
+}
+
+static double minor_faults(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (double)usage.ru_minflt;
+}
+
+/*
+	A fresh region for the threads to back, 2MB aligned, with THP asked
+	for or ruled out. Returns the aligned start; "mapping" and "mapped"
+	are what to munmap.
+*/
+static char* map_region(enum fault_method method, size_t size, char** mapping, size_t* mapped)
+{
+	char* raw;
+	char* region;
+
+	*mapped = size + HUGE_PAGE;
+	raw = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(raw == MAP_FAILED)
+		return NULL;
+
+	region = (char*)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+	madvise(region, size, method == FAULT_TOUCH_THP ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+
+	*mapping = raw;
+	return region;
+}
+
+/* Seconds of wall time and minor faults for one trial, -1 if the method failed */
+static double time_trial(enum fault_method method, unsigned int threads, size_t slice, double* faults)
+{
+	struct fault_run run;
+	char* mapping = NULL;
+	size_t mapped = 0;
+	double before, begin, end;
+	int failed = 0;
+	unsigned int t;
+
+	run.method = method;
+	run.slice = slice;
+	run.region = NULL;
+	run.begin = calloc(threads, sizeof(double));
+	run.end = calloc(threads, sizeof(double));
+	run.failed = calloc(threads, sizeof(int));
+
+	if(!run.begin || !run.end || !run.failed)
+		failed = 1;
+
+	if(!failed && method != FAULT_MAP_POPULATE)
+	{
+		run.region = map_region(method, slice * threads, &mapping, &mapped);
+		if(!run.region)
+			failed = 1;
+	}
+
+	if(!failed)
+	{
+		thread_barrier_init(&run.barrier, threads);
+		before = minor_faults();
+		failed = run_pinned_threads(threads, fault_thread, &run) != 0;
+		*faults = minor_faults() - before;
+		thread_barrier_destroy(&run.barrier);
+	}
+
+	begin = failed ? 0 : run.begin[0];
+	end = failed ? 0 : run.end[0];
+	for(t = 0; !failed && t < threads; ++t)
+	{
+		if(run.failed[t])
+			failed = 1;
+		if(run.begin[t] < begin)
+			begin = run.begin[t];
+		if(run.end[t] > end)
+			end = run.end[t];
+	}
+
+	if(mapping)
+		munmap(mapping, mapped);
+	free(run.begin);
+	free(run.end);
+	free(run.failed);
+
+	return failed ? -1 : end - begin;
+}
+
+/* Medians of the trials. Returns -1 if the method failed. */
+static int measure_point(enum fault_method method, unsigned int threads, struct fault_point* point)
+{
+	const size_t slice = (REGION_SIZE / threads) & ~(HUGE_PAGE - 1);
+	double seconds[TRIALS];
+	double faults[TRIALS];
+	double wall, faultCount;
+	unsigned int trial;
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		seconds[trial] = time_trial(method, threads, slice, &faults[trial]);
+		if(seconds[trial] < 0)
+			return -1;
+	}
+
+	wall = sample_median(seconds, TRIALS);
+	faultCount = sample_median(faults, TRIALS);
+
+	point->threads = threads;
+	point->nanosPerPage = wall * 1e9 / (slice * threads / PAGE_4K);
+	point->faults = faultCount;
+	if(faultCount > 0)
+	{
+		point->nanosPerFault = wall * 1e9 * threads / faultCount;
+		point->faultsPerSecond = faultCount / wall;
+	}
+
+	return 0;
+}
+
+static void measure_curve(enum fault_method method, unsigned int maxThreads, struct fault_curve* curve)
+{
+	unsigned int threads = 1;
+
+	curve->supported = 1;
+
+	while(curve->count < FAULT_MAX_POINTS)
+	{
+		if(measure_point(method, threads, &curve->points[curve->count]) != 0)
+		{
+			/* The method itself, not the thread count, if it failed on one thread */
+			if(curve->count == 0)
+				curve->supported = 0;
+			return;
+		}
+		curve->count++;
+
+		if(threads == maxThreads)
+			return;
+		threads = threads * 2 > maxThreads ? maxThreads : threads * 2;
+	}
+}
+
+/* Only thread counts up to the CPU count say anything about the kernel */
+static void find_ceiling(struct fault_result* result)
+{
+	const struct fault_curve* curve = &result->curves[FAULT_TOUCH_4K];
+	unsigned int i;
+
+	for(i = 1; i < curve->count && curve->points[i].threads <= result->cpus; ++i)
+	{
+		const struct fault_point* before = &curve->points[i - 1];
+
+		if(curve->points[i].faultsPerSecond < before->faultsPerSecond * (1 + SIGNIFICANT_RISE))
+		{
+			result->ceilingFaultsPerSecond = before->faultsPerSecond;
+			result->ceilingThreads = before->threads;
+			return;
+		}
+	}
+}
+
+int measure_page_faults(unsigned int maxThreads, struct fault_result* result, const char** failure)
+{
+	unsigned int method;
+
+	memset(result, 0, sizeof(*result));
+	result->regionSize = REGION_SIZE;
+	result->cpus = (unsigned int)get_cpu_count();
+
+	if(maxThreads == 0)
+		maxThreads = result->cpus;
+	if(maxThreads > REGION_SIZE / HUGE_PAGE)
+		maxThreads = REGION_SIZE / HUGE_PAGE;
+
+	profile_phase_begin("page fault probe");
+	for(method = 0; method < FAULT_METHOD_COUNT; ++method)
+		measure_curve((enum fault_method)method, maxThreads, &result->curves[method]);
+	profile_phase_end();
+
+	if(!result->curves[FAULT_TOUCH_4K].supported)
+	{
+		*failure = "couldn't map and fault in a fresh region";
+		return -1;
+	}
+
+	find_ceiling(result);
+	return 0;
+}
+
+#else
+
+int measure_page_faults(unsigned int maxThreads, struct fault_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs Linux";
+	return -1;
+}
+
+#endif
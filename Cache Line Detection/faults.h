@@ -0,0 +1,79 @@
+#ifndef FAULTS_INC
+#define FAULTS_INC
+
+#include <stddef.h>
+
+/*
+	What it costs to get fresh anonymous memory backed, the first-touch
+	cost the level sweeps used to pay unseen in their warm-up pass.
+
+	Four ways of backing a region, each on 1, 2, 4... threads sharing it
+	in equal slices:
+
+		4KB touch		a write to every page, THP turned off for the region
+		THP touch		the same with MADV_HUGEPAGE on a 2MB aligned region
+		MAP_POPULATE	mmap doing it all up front, each thread its own slice
+		POPULATE_WRITE	madvise(MADV_POPULATE_WRITE) over each slice (Linux 5.14)
+
+	Faults are counted by the kernel (minor faults in getrusage), so a
+	THP fault counts once for 2MB and populating may count none at all.
+
+	All the threads of a process fault under its one mm (and, on older
+	kernels, its mmap lock), so past some rate adding threads stops
+	adding faults per second; that rate is the ceiling reported.
+
+	Linux only.
+*/
+
+enum fault_method
+{
+	FAULT_TOUCH_4K,
+	FAULT_TOUCH_THP,
+	FAULT_MAP_POPULATE,
+	FAULT_POPULATE_WRITE,
+
+	FAULT_METHOD_COUNT
+};
+
+#define FAULT_MAX_POINTS		8
+
+struct fault_point
+{
+	unsigned int threads;
+	double nanosPerPage;					/* Wall time per 4KB of region, all threads together */
+	double faults;							/* Minor faults it took, per trial */
+	double nanosPerFault;					/* Each thread's time per fault it took, 0 without faults */
+	double faultsPerSecond;					/* All threads together */
+};
+
+struct fault_curve
+{
+	int supported;							/* 0 if the kernel refused the method */
+	unsigned int count;
+	struct fault_point points[FAULT_MAX_POINTS];
+};
+
+struct fault_result
+{
+	size_t regionSize;
+	unsigned int cpus;
+	struct fault_curve curves[FAULT_METHOD_COUNT];
+
+	/*
+		From the 4KB touch curve: the faults per second at the last thread
+		count before doubling the threads gained less than SIGNIFICANT_RISE,
+		and that count. 0 if it kept scaling up to the CPU count.
+	*/
+	double ceilingFaultsPerSecond;
+	unsigned int ceilingThreads;
+};
+
+const char* fault_method_name(enum fault_method method);
+
+/*
+	"maxThreads" 0 means one per logical CPU. Returns 0 on success, -1 if
+	the probe can't run here, with "failure" saying why.
+*/
+int measure_page_faults(unsigned int maxThreads, struct fault_result* result, const char** failure);
+
+#endif
@@ -0,0 +1,313 @@
+#include "flush.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* instructionNames[FLUSH_INSTRUCTION_COUNT] = {"clflush", "clflushopt", "clwb"};
+
+const char* flush_instruction_name(enum flush_instruction instruction)
+{
+	return (unsigned int)instruction < FLUSH_INSTRUCTION_COUNT ? instructionNames[instruction] : "?";
+}
+
+#if defined(__x86_64__) && defined(__GNUC__) && (PLATFORM_LINUX || PLATFORM_MACOS)
+
+#include <cpuid.h>
+#include <emmintrin.h>
+
+#define LINE				64
+
+#define COST_LINES			4096
+#define COST_TRIALS			9
+
+#define CHAIN_LINES			256
+#define CHAIN_STRIDE		128				/* Every other line */
+#define COLD_TRIALS			25
+
+/* Bytes of other data read to push the chain out of a level, as a multiple of it */
+#define EVICTION_MULTIPLE	2
+
+static int has_instruction(enum flush_instruction instruction)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if(instruction == FLUSH_CLFLUSH)
+		return 1;
+
+	if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return 0;
+
+	return instruction == FLUSH_CLFLUSHOPT ? (ebx >> 23) & 1 : (ebx >> 24) & 1;
+}
+
+/* By mnemonic, so the compiler doesn't need -mclflushopt or -mclwb */
+static void flush_line(enum flush_instruction instruction, char* line)
+{
+	switch(instruction)
+	{
+	case FLUSH_CLFLUSHOPT:
+		__asm__ volatile("clflushopt %0" : "+m"(*line));
+		break;
+	case FLUSH_CLWB:
+		__asm__ volatile("clwb %0" : "+m"(*line));
+		break;
+	default:
+		_mm_clflush(line);
+		break;
+	}
+}
+
+static char* allocate_lines(size_t size)
+{
+	void* block;
+
+	return posix_memalign(&block, 4096, size) == 0 ? block : NULL;
+}
+
+/* Clean: flushed, then read back, so the cache holds them unmodified. Dirty: written. */
+static void prepare_lines(char* buffer, int dirty)
+{
+	unsigned int i;
+
+	if(dirty)
+	{
+		for(i = 0; i < COST_LINES; ++i)
+			((volatile char*)buffer)[(size_t)i * LINE]++;
+	}
+	else
+	{
+		for(i = 0; i < COST_LINES; ++i)
+			_mm_clflush(buffer + (size_t)i * LINE);
+		_mm_mfence();
+
+		for(i = 0; i < COST_LINES; ++i)
+			(void)((volatile char*)buffer)[(size_t)i * LINE];
+	}
+
+	_mm_mfence();
+}
+
+/* Nanoseconds per line */
+static double time_flushes(enum flush_instruction instruction, char* buffer, int fenceEach)
+{
+	double begin = get_time_seconds();
+	unsigned int i;
+
+	for(i = 0; i < COST_LINES; ++i)
+	{
+		flush_line(instruction, buffer + (size_t)i * LINE);
+		if(fenceEach)
+			_mm_mfence();
+	}
+	_mm_mfence();
+
+	return (get_time_seconds() - begin) * 1e9 / COST_LINES;
+}
+
+/* Median over the trials, each on freshly prepared lines */
+static double measure_cost(enum flush_instruction instruction, char* buffer, int dirty, int fenceEach)
+{
+	double samples[COST_TRIALS];
+	unsigned int trial;
+
+	for(trial = 0; trial < COST_TRIALS; ++trial)
+	{
+		prepare_lines(buffer, dirty);
+		samples[trial] = time_flushes(instruction, buffer, fenceEach);
+	}
+
+	return sample_median(samples, COST_TRIALS);
+}
+
+int measure_flush_costs(struct flush_result* result, const char** failure)
+{
+	char* buffer = allocate_lines((size_t)COST_LINES * LINE);
+	unsigned int instruction;
+
+	memset(result, 0, sizeof(*result));
+	result->lines = COST_LINES;
+
+	if(!buffer)
+	{
+		*failure = "out of memory";
+		return -1;
+	}
+	memset(buffer, 0, (size_t)COST_LINES * LINE);
+
+	profile_phase_begin("flush instruction costs");
+	for(instruction = 0; instruction < FLUSH_INSTRUCTION_COUNT; ++instruction)
+	{
+		struct flush_cost* cost = &result->costs[instruction];
+
+		if(!has_instruction((enum flush_instruction)instruction))
+			continue;
+
+		cost->supported = 1;
+		cost->cleanLatency = measure_cost((enum flush_instruction)instruction, buffer, 0, 1);
+		cost->dirtyLatency = measure_cost((enum flush_instruction)instruction, buffer, 1, 1);
+		cost->cleanThroughput = measure_cost((enum flush_instruction)instruction, buffer, 0, 0);
+		cost->dirtyThroughput = measure_cost((enum flush_instruction)instruction, buffer, 1, 0);
+	}
+	profile_phase_end();
+
+	free(buffer);
+	return 0;
+}
+
+struct chain
+{
+	char* lines;
+	void* head;
+	enum flush_instruction evictor;
+};
+
+/* Each line points at the next, in random order */
+static void link_chain(struct chain* chain)
+{
+	unsigned int order[CHAIN_LINES];
+	unsigned int i;
+
+	shuffle_indices(order, CHAIN_LINES, 0x6A09E667);
+
+	for(i = 0; i < CHAIN_LINES; ++i)
+		*(void**)(chain->lines + (size_t)order[i] * CHAIN_STRIDE) = chain->lines + (size_t)order[(i + 1) % CHAIN_LINES] * CHAIN_STRIDE;
+
+	chain->head = chain->lines + (size_t)order[0] * CHAIN_STRIDE;
+}
+
+static void flush_chain(const struct chain* chain)
+{
+	unsigned int i;
+
+	for(i = 0; i < CHAIN_LINES; ++i)
+		flush_line(chain->evictor, chain->lines + (size_t)i * CHAIN_STRIDE);
+	_mm_mfence();
+}
+
+static void* chase(void* at, unsigned int steps)
+{
+	unsigned int i;
+
+	for(i = 0; i < steps; ++i)
+		at = *(void**)at;
+
+	__asm__ volatile("" : "+r"(at) : : "memory");
+	return at;
+}
+
+/* One read per line, enough to push older lines out of whatever is smaller */
+static void read_through(const char* buffer, size_t size)
+{
+	uint64_t sum = 0;
+	size_t offset;
+
+	for(offset = 0; offset < size; offset += LINE)
+		sum += ((const volatile char*)buffer)[offset];
+
+	__asm__ volatile("" : : "r"(sum) : "memory");
+}
+
+/* Per access, with the chain in "level" and none above it; 0 is memory */
+static double time_cold(const struct chain* chain, unsigned int level, const char* eviction, size_t evictionSize)
+{
+	double samples[COLD_TRIALS];
+	unsigned int trial;
+
+	for(trial = 0; trial < COLD_TRIALS; ++trial)
+	{
+		double begin;
+
+		flush_chain(chain);
+
+		if(level > 0)
+		{
+			chase(chain->head, CHAIN_LINES * 2);
+			if(level > 1)
+				read_through(eviction, evictionSize);
+		}
+
+		begin = get_time_seconds();
+		chase(chain->head, CHAIN_LINES);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / CHAIN_LINES;
+	}
+
+	return sample_median(samples, COLD_TRIALS);
+}
+
+int measure_cold_latency(const unsigned int levels[3], struct cold_result* result, const char** failure)
+{
+	struct chain chain;
+	size_t evictionSize = 0;
+	char* eviction = NULL;
+	unsigned int level;
+
+	memset(result, 0, sizeof(*result));
+	result->evictor = has_instruction(FLUSH_CLFLUSHOPT) ? FLUSH_CLFLUSHOPT : FLUSH_CLFLUSH;
+	result->chainLines = CHAIN_LINES;
+
+	/* Enough to read through the largest level above one being measured */
+	for(level = 2; level <= 3; ++level)
+		if(levels[level - 1] && levels[level - 2] && (size_t)levels[level - 2] * EVICTION_MULTIPLE > evictionSize)
+			evictionSize = (size_t)levels[level - 2] * EVICTION_MULTIPLE;
+
+	chain.evictor = result->evictor;
+	chain.lines = allocate_lines((size_t)CHAIN_LINES * CHAIN_STRIDE);
+	if(evictionSize)
+		eviction = allocate_lines(evictionSize);
+
+	if(!chain.lines || (evictionSize && !eviction))
+	{
+		free(chain.lines);
+		free(eviction);
+		*failure = "out of memory";
+		return -1;
+	}
+
+	if(eviction)
+		memset(eviction, 1, evictionSize);
+	link_chain(&chain);
+
+	profile_phase_begin("cold latency");
+	for(level = 1; level <= 3; ++level)
+	{
+		if(!levels[level - 1] || (level > 1 && !levels[level - 2]))
+			continue;
+
+		result->levels[result->count].level = level;
+		result->levels[result->count].nanos = time_cold(&chain, level, eviction,
+			level > 1 ? (size_t)levels[level - 2] * EVICTION_MULTIPLE : 0);
+		result->count++;
+	}
+
+	result->levels[result->count].level = 0;
+	result->levels[result->count].nanos = time_cold(&chain, 0, NULL, 0);
+	result->count++;
+	profile_phase_end();
+
+	free(chain.lines);
+	free(eviction);
+	return 0;
+}
+
+#else
+
+int measure_flush_costs(struct flush_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs clflush, on x86-64 Linux or macOS";
+	return -1;
+}
+
+int measure_cold_latency(const unsigned int levels[3], struct cold_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs clflush, on x86-64 Linux or macOS";
+	return -1;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef FLUSH_INC
+#define FLUSH_INC
+
+/*
+	The cache line flush and write back instructions, and what they make
+	possible: latencies measured from a known cold state instead of
+	after the huge warm up loops the level sweeps rely on.
+
+	Costs are per line, over a 256KB buffer of clean lines (flushed, then
+	read) or dirty ones (written):
+
+		Latency		each flush followed by mfence, so it has to finish
+		Throughput	flushes back to back, one mfence at the end
+
+	clflush is ordered against other clflushes, clflushopt and clwb
+	aren't; clwb writes a dirty line back without having to evict it.
+	The last two are only tried where CPUID reports them.
+
+	Cold latency is a pointer chase through a few lines in random order,
+	128B apart so the adjacent line prefetcher stays out of it. Before
+	each timed chase the lines are flushed from every cache; for memory
+	that's all, for a level they're read back in, then pushed out of the
+	levels above it by reading twice the next level up's worth of other
+	data.
+
+	x86-64 Linux and macOS only, with GCC or Clang.
+*/
+
+enum flush_instruction
+{
+	FLUSH_CLFLUSH,
+	FLUSH_CLFLUSHOPT,
+	FLUSH_CLWB,
+
+	FLUSH_INSTRUCTION_COUNT
+};
+
+struct flush_cost
+{
+	int supported;
+
+	/* Nanoseconds per line, medians of the trials */
+	double cleanLatency;
+	double dirtyLatency;
+	double cleanThroughput;
+	double dirtyThroughput;
+};
+
+struct flush_result
+{
+	unsigned int lines;
+	struct flush_cost costs[FLUSH_INSTRUCTION_COUNT];
+};
+
+#define COLD_MAX_LEVELS		4
+
+struct cold_level
+{
+	unsigned int level;						/* 1 to 3, or 0 for memory */
+	double nanos;							/* Per access, median of the trials */
+};
+
+struct cold_result
+{
+	enum flush_instruction evictor;			/* clflushopt where there is one */
+	unsigned int chainLines;
+
+	unsigned int count;
+	struct cold_level levels[COLD_MAX_LEVELS];
+};
+
+const char* flush_instruction_name(enum flush_instruction instruction);
+
+/* Returns 0 on success, -1 with "failure" set where it can't run. */
+int measure_flush_costs(struct flush_result* result, const char** failure);
+
+/*
+	"levels" are L1 to L3 in bytes, 0 for any that weren't found; a
+	level is only measured if the one above it is known. Returns 0 on
+	success, -1 with "failure" set where it can't run or out of memory.
+*/
+int measure_cold_latency(const unsigned int levels[3], struct cold_result* result, const char** failure);
+
+#endif
@@ -0,0 +1,129 @@
+#include "frequency.h"
+#include "platform.h"
+
+#include <string.h>
+
+#if PLATFORM_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* About a millisecond's worth on anything current */
+#define CHAIN_ADDS			(4 * 1024 * 1024)
+
+/* Agreement that counts as stable */
+#define STABLE_TOLERANCE	0.01
+
+#if defined(__GNUC__)
+
+/*
+	Every add depends on the one before, so they can't overlap. The asm
+	keeps the compiler from folding them together, and adding a register
+	rather than a constant keeps the core from doing the same: recent
+	ones fold small immediate adds away at rename.
+*/
+#define DEPENDENT_ADD(x, y)	do { (x) += (y); __asm__ volatile("" : "+r"(x)); } while(0)
+
+double measure_core_frequency(void)
+{
+	unsigned long long x = 0;
+	unsigned long long y = 1;
+	unsigned int i;
+	double begin, seconds;
+
+	__asm__ volatile("" : "+r"(y));
+	begin = get_time_seconds();
+
+	for(i = 0; i < CHAIN_ADDS / 8; ++i)
+	{
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+		DEPENDENT_ADD(x, y);
+	}
+
+	seconds = get_time_seconds() - begin;
+
+	return seconds > 0 ? CHAIN_ADDS / seconds / 1e9 : 0;
+}
+
+#else
+
+double measure_core_frequency(void)
+{
+	return 0;
+}
+
+#endif
+
+double stabilize_core_frequency(double timeoutSeconds)
+{
+	double deadline = get_time_seconds() + timeoutSeconds;
+	double previous = measure_core_frequency();
+	double current = previous;
+
+	while(previous > 0 && get_time_seconds() < deadline)
+	{
+		current = measure_core_frequency();
+
+		if(current > previous * (1 - STABLE_TOLERANCE) && current < previous * (1 + STABLE_TOLERANCE))
+			break;
+
+		previous = current;
+	}
+
+	return current;
+}
+
+#if PLATFORM_LINUX
+
+static int cycleCounter = -1;
+
+int open_cycle_counter(void)
+{
+	struct perf_event_attr attributes;
+
+	if(cycleCounter >= 0)
+		return 0;
+
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+	attributes.exclude_kernel = 1;	/* What paranoid level 2 allows, and the kernel isn't being measured anyway */
+	attributes.exclude_hv = 1;
+
+	/* This thread, on whatever CPU it runs */
+	cycleCounter = (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+
+	return cycleCounter >= 0 ? 0 : -1;
+}
+
+unsigned long long read_cycle_counter(void)
+{
+	unsigned long long cycles;
+
+	if(cycleCounter < 0 || read(cycleCounter, &cycles, sizeof(cycles)) != sizeof(cycles))
+		return 0;
+
+	return cycles;
+}
+
+#else
+
+int open_cycle_counter(void)
+{
+	return -1;
+}
+
+unsigned long long read_cycle_counter(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FREQUENCY_INC
+#define FREQUENCY_INC
+
+/*
+	Core clock tracking. Turbo ramps and power state changes mean the
+	first sizes of a sweep can run at a different clock than the last,
+	which looks exactly like a cache boundary.
+*/
+
+/*
+	The clock in GHz, from timing a chain of dependent adds - one per
+	cycle on every core of the last decade or so. Takes about a
+	millisecond. 0 if it can't be measured with this compiler.
+*/
+double measure_core_frequency(void);
+
+/*
+	Spins on measure_core_frequency until two measurements in a row
+	agree within 1%, or timeoutSeconds runs out. Returns the last one.
+*/
+double stabilize_core_frequency(double timeoutSeconds);
+
+/*
+	Counts the cycles the calling thread really runs, with perf's cycles
+	event (APERF, on x86). Returns 0 on success, -1 where perf doesn't
+	allow it: not Linux, no PMU in a VM, or perf_event_paranoid.
+*/
+int open_cycle_counter(void);
+
+/* User space cycles since open_cycle_counter, 0 if it isn't open. */
+unsigned long long read_cycle_counter(void);
+
+#endif
@@ -0,0 +1,631 @@
+#include "hash.h"
+#include "cache.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if PLATFORM_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Per trial, and trials per point */
+#define LOOKUPS				(512 * 1024)
+#define TRIALS				3
+
+/* Evictions before a cuckoo insert gives up */
+#define MAX_KICKS			500
+
+/*
+	Below the usual MAX_MEMORY_SET: every scheme and load factor builds
+	its own table, so a table twice this size doubles an already long
+	run for little more than what this one shows. Where it's less than
+	LEVEL_MEMORY_MULTIPLE times the last level, a table this size would
+	still mostly be cached, so there's no memory table at all.
+*/
+#define MAX_MEMORY_TABLE	((size_t)128 * 1024 * 1024)
+
+/* Swiss control bytes: the high bit marks an empty slot, tags are the key's top 7 bits */
+#define EMPTY_CONTROL		0x80
+
+#if defined(__SSE2__)
+#define CONTROL_CHUNK		16
+#else
+#define CONTROL_CHUNK		8
+#endif
+
+static const unsigned int bucketLines[HASH_WIDTHS] = {1, 2, 4};
+static const double loadFactors[HASH_LOADS] = {0.50, 0.75, 0.90};
+
+static const char* schemeNames[HASH_SCHEME_COUNT] = {"Linear", "Cuckoo", "Swiss"};
+
+const char* hash_scheme_name(enum hash_scheme scheme)
+{
+	return (unsigned int)scheme < HASH_SCHEME_COUNT ? schemeNames[scheme] : "?";
+}
+
+struct table
+{
+	enum hash_scheme scheme;
+	uint64_t* keys;							/* 0 is an empty slot */
+	unsigned char* control;					/* Swiss only, a byte per slot */
+	size_t buckets;							/* Or Swiss groups; a power of two */
+	unsigned int slots;						/* Per bucket */
+	unsigned int random;					/* Picks cuckoo victims */
+
+	void* keyBlock;
+	void* controlBlock;
+};
+
+/* Lines a lookup remembers having read; past that, each new one counts without being remembered */
+#define LINES_SEEN			64
+
+/* Distinct lines the lookups read, each lookup's counted apart */
+struct line_count
+{
+	uintptr_t seen[LINES_SEEN];				/* This lookup's so far */
+	unsigned int seenCount;
+	unsigned int lines;
+	unsigned int shift;
+};
+
+/*
+	The n-th key. splitmix64's finalizer is a bijection that only maps 0
+	to 0, so keys from n >= 1 are distinct, never empty, and random
+	enough to use their bits as the hashes directly.
+*/
+static uint64_t nth_key(uint64_t n)
+{
+	n ^= n >> 30;
+	n *= 0xBF58476D1CE4E5B9ULL;
+	n ^= n >> 27;
+	n *= 0x94D049BB133111EBULL;
+	n ^= n >> 31;
+
+	return n;
+}
+
+/* Low bits pick the first bucket, bits from 32 up the cuckoo's second; the tag is above both */
+static size_t first_bucket(const struct table* table, uint64_t key)
+{
+	return (size_t)key & (table->buckets - 1);
+}
+
+static size_t second_bucket(const struct table* table, uint64_t key)
+{
+	return (size_t)(key >> 32) & (table->buckets - 1);
+}
+
+/* Counts the line "at" is in, unless this lookup has read it already */
+static void touch(struct line_count* count, const void* at)
+{
+	uintptr_t line;
+	unsigned int i;
+
+	if(!count)
+		return;
+
+	line = (uintptr_t)at >> count->shift;
+	for(i = 0; i < count->seenCount; ++i)
+		if(count->seen[i] == line)
+			return;
+
+	if(count->seenCount < LINES_SEEN)
+		count->seen[count->seenCount++] = line;
+	count->lines++;
+}
+
+static unsigned int lowest_index(uint64_t mask)
+{
+#if defined(__GNUC__)
+	return (unsigned int)__builtin_ctzll(mask);
+#else
+	unsigned int index = 0;
+
+	while(!(mask & 1))
+	{
+		mask >>= 1;
+		index++;
+	}
+	return index;
+#endif
+}
+
+/*
+	A bit for each of the first "width" control bytes that's equal to
+	"tag" (match_tag) or empty (match_empty). With SSE2 a bit per byte; without, the
+	high bit of each byte of a word, so indices come out of lowest_index
+	eight times too big (MASK_INDEX undoes it). The word version can flag
+	a byte above a real match that doesn't, harmless since keys are
+	compared anyway; empties are just the high bits, so those are exact.
+*/
+#if defined(__SSE2__)
+
+#define MASK_INDEX(bit)		(bit)
+
+static uint64_t match_tag(const unsigned char* control, unsigned char tag, unsigned int width)
+{
+	__m128i bytes = width >= 16 ? _mm_load_si128((const __m128i*)control) : _mm_loadl_epi64((const __m128i*)control);
+	unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)tag)));
+
+	return width >= 16 ? mask : mask & 0xFF;
+}
+
+static uint64_t match_empty(const unsigned char* control, unsigned int width)
+{
+	__m128i bytes = width >= 16 ? _mm_load_si128((const __m128i*)control) : _mm_loadl_epi64((const __m128i*)control);
+	unsigned int mask = (unsigned int)_mm_movemask_epi8(bytes);
+
+	return width >= 16 ? mask : mask & 0xFF;
+}
+
+#else
+
+#define MASK_INDEX(bit)		((bit) >> 3)
+
+#define LOW_BYTES			0x0101010101010101ULL
+#define HIGH_BITS			0x8080808080808080ULL
+
+static uint64_t match_tag(const unsigned char* control, unsigned char tag, unsigned int width)
+{
+	uint64_t word;
+
+	memcpy(&word, control, sizeof(word));
+	word ^= LOW_BYTES * tag;
+
+	return (word - LOW_BYTES) & ~word & HIGH_BITS;
+}
+
+static uint64_t match_empty(const unsigned char* control, unsigned int width)
+{
+	uint64_t word;
+
+	memcpy(&word, control, sizeof(word));
+	return word & HIGH_BITS;
+}
+
+#endif
+
+/* Filled from the front and never emptied, so an empty slot ends the bucket */
+static int scan_bucket(const uint64_t* slot, unsigned int slots, uint64_t key, struct line_count* count)
+{
+	unsigned int s;
+
+	for(s = 0; s < slots; ++s)
+	{
+		touch(count, slot + s);
+		if(slot[s] == key)
+			return 1;
+		if(slot[s] == 0)
+			return 0;
+	}
+
+	return 0;
+}
+
+static int place_in_bucket(uint64_t* slot, unsigned int slots, uint64_t key)
+{
+	unsigned int s;
+
+	for(s = 0; s < slots; ++s)
+	{
+		if(slot[s] == 0)
+		{
+			slot[s] = key;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int linear_find(const struct table* table, uint64_t key, struct line_count* count)
+{
+	size_t bucket = first_bucket(table, key);
+	unsigned int s;
+
+	for(;;)
+	{
+		const uint64_t* slot = table->keys + bucket * table->slots;
+
+		for(s = 0; s < table->slots; ++s)
+		{
+			touch(count, slot + s);
+			if(slot[s] == key)
+				return 1;
+			if(slot[s] == 0)
+				return 0;
+		}
+
+		bucket = (bucket + 1) & (table->buckets - 1);
+	}
+}
+
+static int linear_insert(struct table* table, uint64_t key)
+{
+	size_t bucket = first_bucket(table, key);
+
+	while(!place_in_bucket(table->keys + bucket * table->slots, table->slots, key))
+		bucket = (bucket + 1) & (table->buckets - 1);
+
+	return 0;
+}
+
+static int cuckoo_find(const struct table* table, uint64_t key, struct line_count* count)
+{
+	return scan_bucket(table->keys + first_bucket(table, key) * table->slots, table->slots, key, count) ||
+		scan_bucket(table->keys + second_bucket(table, key) * table->slots, table->slots, key, count);
+}
+
+/* A random walk of evictions. Returns -1 if it gave up, with some key, not necessarily this one, left out. */
+static int cuckoo_insert(struct table* table, uint64_t key)
+{
+	size_t bucket = first_bucket(table, key);
+	unsigned int kick;
+
+	if(place_in_bucket(table->keys + bucket * table->slots, table->slots, key) ||
+		place_in_bucket(table->keys + second_bucket(table, key) * table->slots, table->slots, key))
+		return 0;
+
+	for(kick = 0; kick < MAX_KICKS; ++kick)
+	{
+		uint64_t* slot = table->keys + bucket * table->slots + next_random(&table->random) % table->slots;
+		uint64_t victim = *slot;
+
+		*slot = key;
+		key = victim;
+
+		bucket = first_bucket(table, key) == bucket ? second_bucket(table, key) : first_bucket(table, key);
+		if(place_in_bucket(table->keys + bucket * table->slots, table->slots, key))
+			return 0;
+	}
+
+	return -1;
+}
+
+/* Groups probed quadratically, which visits all of them when there's a power of two */
+static int swiss_find(const struct table* table, uint64_t key, struct line_count* count)
+{
+	const unsigned char tag = (unsigned char)(key >> 57);
+	size_t group = first_bucket(table, key);
+	size_t step = 0;
+	unsigned int chunk;
+
+	for(;;)
+	{
+		const unsigned char* control = table->control + group * table->slots;
+		const uint64_t* keys = table->keys + group * table->slots;
+
+		for(chunk = 0; chunk < table->slots; chunk += CONTROL_CHUNK)
+		{
+			uint64_t matches = match_tag(control + chunk, tag, table->slots - chunk);
+
+			touch(count, control + chunk);
+			while(matches)
+			{
+				unsigned int s = chunk + MASK_INDEX(lowest_index(matches));
+
+				touch(count, keys + s);
+				if(keys[s] == key)
+					return 1;
+				matches &= matches - 1;
+			}
+
+			if(match_empty(control + chunk, table->slots - chunk))
+				return 0;
+		}
+
+		group = (group + ++step) & (table->buckets - 1);
+	}
+}
+
+static int swiss_insert(struct table* table, uint64_t key)
+{
+	size_t group = first_bucket(table, key);
+	size_t step = 0;
+	unsigned int chunk;
+
+	for(;;)
+	{
+		unsigned char* control = table->control + group * table->slots;
+
+		for(chunk = 0; chunk < table->slots; chunk += CONTROL_CHUNK)
+		{
+			uint64_t empties = match_empty(control + chunk, table->slots - chunk);
+
+			if(empties)
+			{
+				unsigned int s = chunk + MASK_INDEX(lowest_index(empties));
+
+				control[s] = (unsigned char)(key >> 57);
+				table->keys[group * table->slots + s] = key;
+				return 0;
+			}
+		}
+
+		group = (group + ++step) & (table->buckets - 1);
+	}
+}
+
+static int find_key(const struct table* table, uint64_t key, struct line_count* count)
+{
+	switch(table->scheme)
+	{
+	case HASH_LINEAR:
+		return linear_find(table, key, count);
+	case HASH_CUCKOO:
+		return cuckoo_find(table, key, count);
+	default:
+		return swiss_find(table, key, count);
+	}
+}
+
+static int insert_key(struct table* table, uint64_t key)
+{
+	switch(table->scheme)
+	{
+	case HASH_LINEAR:
+		return linear_insert(table, key);
+	case HASH_CUCKOO:
+		return cuckoo_insert(table, key);
+	default:
+		return swiss_insert(table, key);
+	}
+}
+
+static void* aligned_block(size_t size, unsigned int lineSize, void** block)
+{
+	*block = malloc(size + lineSize);
+	if(!*block)
+		return NULL;
+
+	return (void*)(((uintptr_t)*block + lineSize - 1) & ~(uintptr_t)(lineSize - 1));
+}
+
+static void destroy_table(struct table* table)
+{
+	free(table->keyBlock);
+	free(table->controlBlock);
+}
+
+/* "tableBytes" of keys, a power of two, in buckets of "bucketBytes" */
+static int create_table(struct table* table, enum hash_scheme scheme, size_t tableBytes, unsigned int bucketBytes, unsigned int lineSize)
+{
+	const size_t slots = tableBytes / sizeof(uint64_t);
+
+	memset(table, 0, sizeof(*table));
+	table->scheme = scheme;
+	table->slots = bucketBytes / sizeof(uint64_t);
+	table->buckets = slots / table->slots;
+	table->random = 0x9E3779B9;
+
+	/* Written out now, so page faults don't land in the first load factor's inserts */
+	table->keys = aligned_block(tableBytes, lineSize, &table->keyBlock);
+	if(table->keys)
+		memset(table->keys, 0, tableBytes);
+
+	if(scheme == HASH_SWISS)
+	{
+		table->control = aligned_block(slots, lineSize, &table->controlBlock);
+		if(table->control)
+			memset(table->control, EMPTY_CONTROL, slots);
+	}
+
+	if(!table->keys || (scheme == HASH_SWISS && !table->control))
+	{
+		destroy_table(table);
+		return -1;
+	}
+
+	return 0;
+}
+
+#if PLATFORM_LINUX
+
+/* Last level misses, as perf's generic event has it, on this thread in user space */
+static int open_miss_counter(void)
+{
+	struct perf_event_attr attributes;
+
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+
+	return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+static double read_miss_counter(int counter)
+{
+	unsigned long long misses;
+
+	if(counter < 0 || read(counter, &misses, sizeof(misses)) != sizeof(misses))
+		return -1;
+
+	return (double)misses;
+}
+
+static void close_miss_counter(int counter)
+{
+	if(counter >= 0)
+		close(counter);
+}
+
+#else
+
+static int open_miss_counter(void)
+{
+	return -1;
+}
+
+static double read_miss_counter(int counter)
+{
+	return -1;
+}
+
+static void close_miss_counter(int counter)
+{
+}
+
+#endif
+
+/*
+	LOOKUPS lookups, alternating a key the table holds with one it
+	doesn't; "count" adds up the lines each one reads, NULL when timing.
+	Returns how many were found, so the lookups can't be dropped.
+*/
+static size_t run_lookups(const struct table* table, size_t inserted, unsigned int seed, struct line_count* count)
+{
+	unsigned int state = seed;
+	size_t found = 0;
+	unsigned int i;
+
+	for(i = 0; i < LOOKUPS; ++i)
+	{
+		uint64_t pick = next_random(&state);
+		uint64_t n = (i & 1) ? inserted + 1 + pick : 1 + ((pick * inserted) >> 32);
+
+		if(count)
+			count->seenCount = 0;
+		found += find_key(table, nth_key(n), count);
+	}
+
+	return found;
+}
+
+static volatile size_t sink;
+
+static void measure_point(const struct table* table, size_t inserted, unsigned int lineSize, int counter, struct hash_point* point)
+{
+	struct line_count count;
+	double samples[TRIALS];
+	double before, after;
+	unsigned int trial;
+
+	/* Counting the lines doubles as the warm up */
+	memset(&count, 0, sizeof(count));
+	while((1u << count.shift) < lineSize)
+		count.shift++;
+	sink = run_lookups(table, inserted, 1, &count);
+
+	before = read_miss_counter(counter);
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		sink = run_lookups(table, inserted, 2 + trial, NULL);
+		samples[trial] = LOOKUPS / (get_time_seconds() - begin);
+	}
+	after = read_miss_counter(counter);
+
+	point->supported = 1;
+	point->lookupsPerSecond = sample_median(samples, TRIALS);
+	point->linesPerLookup = (double)count.lines / LOOKUPS;
+	point->missesPerLookup = before >= 0 && after >= 0 ? (after - before) / ((double)TRIALS * LOOKUPS) : -1;
+}
+
+/* Every scheme and width, each table filled through the load factors in turn */
+static int measure_target(struct hash_result* result, struct hash_target* target, int counter)
+{
+	unsigned int scheme, width, load;
+
+	for(scheme = 0; scheme < HASH_SCHEME_COUNT; ++scheme)
+	{
+		for(width = 0; width < HASH_WIDTHS; ++width)
+		{
+			struct table table;
+			size_t inserted = 0;
+			int full = 0;
+
+			if(create_table(&table, (enum hash_scheme)scheme, target->tableBytes, result->bucketBytes[width], result->lineSize) != 0)
+				return -1;
+
+			for(load = 0; load < HASH_LOADS && !full; ++load)
+			{
+				const size_t goal = (size_t)(loadFactors[load] * (double)(target->tableBytes / sizeof(uint64_t)));
+
+				for(; inserted < goal && !full; ++inserted)
+					full = insert_key(&table, nth_key(inserted + 1)) != 0;
+
+				if(!full)
+					measure_point(&table, inserted, result->lineSize, counter, &target->points[scheme][width][load]);
+			}
+
+			destroy_table(&table);
+		}
+	}
+
+	return 0;
+}
+
+/* The largest power of two up to "bytes", and at least four of the widest buckets */
+static void add_target(struct hash_result* result, unsigned int level, size_t bytes)
+{
+	const size_t smallest = (size_t)4 * result->bucketBytes[HASH_WIDTHS - 1];
+	size_t tableBytes = smallest;
+
+	while(tableBytes * 2 <= bytes)
+		tableBytes *= 2;
+
+	result->targets[result->count].level = level;
+	result->targets[result->count].tableBytes = tableBytes;
+	result->count++;
+}
+
+int measure_hash_tables(unsigned int lineSize, const unsigned int levels[3], struct hash_result* result)
+{
+	struct level_target targets[MAX_LEVEL_TARGETS];
+	unsigned int count, level, i;
+	int counter;
+
+	if(!is_power_of_two(lineSize) || lineSize < 64 || lineSize > 1024)
+		return -1;
+
+	memset(result, 0, sizeof(*result));
+	result->lineSize = lineSize;
+	for(i = 0; i < HASH_WIDTHS; ++i)
+		result->bucketBytes[i] = bucketLines[i] * lineSize;
+	for(i = 0; i < HASH_LOADS; ++i)
+		result->loads[i] = loadFactors[i];
+
+	/* Half of each level, as the other benchmarks size their working sets */
+	count = get_level_targets(levels, 2, MAX_MEMORY_TABLE, targets);
+
+	for(level = 3; level > 0 && levels[level - 1] == 0; --level)
+		;
+	if(level > 0 && (size_t)levels[level - 1] * LEVEL_MEMORY_MULTIPLE > MAX_MEMORY_TABLE)
+		--count;
+
+	for(i = 0; i < count; ++i)
+		add_target(result, targets[i].level, targets[i].bytes);
+
+	counter = open_miss_counter();
+	result->counted = counter >= 0;
+
+	profile_phase_begin("hash table probe");
+	for(i = 0; i < result->count; ++i)
+	{
+		if(measure_target(result, &result->targets[i], counter) != 0)
+		{
+			profile_phase_end();
+			close_miss_counter(counter);
+			return -1;
+		}
+	}
+	profile_phase_end();
+
+	close_miss_counter(counter);
+	return 0;
+}
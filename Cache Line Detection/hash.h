@@ -0,0 +1,81 @@
+#ifndef HASH_INC
+#define HASH_INC
+
+#include <stddef.h>
+
+/*
+	What a lookup costs in an open addressing table of 64-bit keys, for
+	three ways of probing:
+
+		Linear	buckets of slots, filled from the front; a key goes in
+				the first bucket from its hash with room, so a lookup
+				scans buckets until the key or an empty slot
+		Cuckoo	buckets as above, but a key lives in one of two, evicting
+				another to its other bucket if both are full; a lookup
+				never reads more than those two
+		Swiss	a control byte per slot, 7 bits of hash or empty, kept
+				apart from the keys; a lookup compares a group's control
+				bytes at once (SSE2, or eight at a time in a word where
+				there's none) and only reads the keys whose bytes match
+
+	Buckets, and Swiss groups of keys, are 1, 2 and 4 lines. Each table
+	fills half of a cache level, or four times the last level for memory,
+	up to 128MB - a last level over 32MB gets no memory table, since one
+	that size would still be mostly cached. Each is measured at 50%, 75%
+	and 90% full, with lookups half for keys it holds and half for keys
+	it doesn't.
+
+	Lines per lookup count the distinct lines a lookup reads, worked out
+	from the probe sequence. Misses per lookup are the last level misses
+	perf counts, where it's allowed to (Linux, a PMU, perf_event_paranoid).
+*/
+
+enum hash_scheme
+{
+	HASH_LINEAR,
+	HASH_CUCKOO,
+	HASH_SWISS,
+
+	HASH_SCHEME_COUNT
+};
+
+#define HASH_WIDTHS			3				/* Lines per bucket: 1, 2 and 4 */
+#define HASH_LOADS			3
+#define HASH_MAX_TARGETS	4
+
+struct hash_point
+{
+	int supported;							/* 0 where cuckoo couldn't place every key */
+	double lookupsPerSecond;				/* Median of the trials */
+	double linesPerLookup;
+	double missesPerLookup;					/* -1 without the perf counter */
+};
+
+struct hash_target
+{
+	unsigned int level;						/* 1 to 3, or 0 for memory */
+	size_t tableBytes;						/* The keys; Swiss control bytes add an eighth */
+	struct hash_point points[HASH_SCHEME_COUNT][HASH_WIDTHS][HASH_LOADS];
+};
+
+struct hash_result
+{
+	unsigned int lineSize;
+	unsigned int bucketBytes[HASH_WIDTHS];
+	double loads[HASH_LOADS];
+	int counted;							/* Whether the miss counter opened */
+
+	unsigned int count;
+	struct hash_target targets[HASH_MAX_TARGETS];
+};
+
+const char* hash_scheme_name(enum hash_scheme scheme);
+
+/*
+	"levels" are L1 to L3, 0 for any that weren't found. Returns 0 on
+	success, -1 if lineSize isn't a power of two from 64 to 1024 bytes or
+	a table couldn't be allocated.
+*/
+int measure_hash_tables(unsigned int lineSize, const unsigned int levels[3], struct hash_result* result);
+
+#endif
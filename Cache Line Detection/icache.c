@@ -0,0 +1,263 @@
+#include "icache.h"
+#include "cache.h"
+#include "frequency.h"
+#include "stats.h"
+#include "profile.h"
+#include "fast_math.h"
+#include "jit.h"
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_CODE_GENERATION
+
+#include <unistd.h>
+
+#define MIN_CODE_SIZE		1024
+#define MAX_CODE_SIZE		(1024 * 1024)
+#define MIN_PAGES			4
+#define MAX_PAGES			4096
+
+/* One taken jump per line, even where lines are bigger */
+#define JUMP_SPACING		64
+
+/* Instructions executed per trial, and trials per point */
+#define NOP_STEPS			(16 * 1024 * 1024)
+#define JUMP_STEPS			(4 * 1024 * 1024)
+#define TRIALS				5
+
+typedef void (*generated_code)(void);
+
+/*
+	The encodings. Every instruction is a whole number of 32 bit words on
+	AArch64, and on x86-64 the no-op is the recommended 4 byte one, so
+	the no-op run is the same instruction count per byte on both.
+*/
+#if defined(__x86_64__)
+
+static void emit_nop(unsigned char* at)
+{
+	static const unsigned char nop[4] = {0x0f, 0x1f, 0x40, 0x00};
+
+	memcpy(at, nop, sizeof(nop));
+}
+
+static void emit_jump(unsigned char* at, const unsigned char* target)
+{
+	int displacement = (int)(target - (at + 5));
+
+	at[0] = 0xe9;
+	memcpy(at + 1, &displacement, sizeof(displacement));
+}
+
+static void emit_return(unsigned char* at)
+{
+	at[0] = 0xc3;
+}
+
+#else
+
+static void emit_word(unsigned char* at, unsigned int word)
+{
+	memcpy(at, &word, sizeof(word));
+}
+
+static void emit_nop(unsigned char* at)
+{
+	emit_word(at, 0xd503201f);
+}
+
+static void emit_jump(unsigned char* at, const unsigned char* target)
+{
+	int words = (int)(target - at) / 4;
+
+	emit_word(at, 0x14000000 | ((unsigned int)words & 0x3ffffff));
+}
+
+static void emit_return(unsigned char* at)
+{
+	emit_word(at, 0xd65f03c0);
+}
+
+#endif
+
+static generated_code seal_code(unsigned char* code, size_t size, size_t entry)
+{
+	union
+	{
+		unsigned char* data;
+		generated_code function;
+	} entryPoint;
+
+	if(jit_seal(code, size) != 0)
+		return NULL;
+
+	entryPoint.data = code + entry;
+	return entryPoint.function;
+}
+
+/* Median nanoseconds per instruction over TRIALS runs of about "steps" instructions, after a warm-up call */
+static double time_code(generated_code code, unsigned int perCall, unsigned int steps)
+{
+	double samples[TRIALS];
+	unsigned int calls = steps / perCall > 0 ? steps / perCall : 1;
+	unsigned int trial, i;
+
+	code();
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		for(i = 0; i < calls; ++i)
+			code();
+
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / ((double)calls * perCall);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+/* A straight run of no-ops "size" bytes long, the last instruction a return */
+static double time_nops(unsigned int size)
+{
+	unsigned char* code = jit_alloc(size);
+	generated_code entry;
+	unsigned int at;
+	double nanos = -1;
+
+	if(!code)
+		return -1;
+
+	for(at = 0; at + 4 < size; at += 4)
+		emit_nop(code + at);
+	emit_return(code + at);
+
+	entry = seal_code(code, size, 0);
+	if(entry)
+		nanos = time_code(entry, size / 4, NOP_STEPS);
+
+	jit_free(code, size);
+	return nanos;
+}
+
+/*
+	"count" blocks "spacing" bytes apart, each one a jump to the next in
+	random order, so neither the next line prefetcher nor sequential
+	fetch gets ahead. The last one returns. Within its block each jump
+	sits "offsetStep" bytes further than in the block before, which for
+	page-sized blocks keeps them from all landing in the same L1I set.
+*/
+static double time_jumps(unsigned int count, unsigned int spacing, unsigned int offsetStep)
+{
+	size_t size = (size_t)count * spacing;
+	unsigned char* code;
+	unsigned int* order;
+	generated_code entry;
+	unsigned int i;
+	double nanos = -1;
+
+	order = malloc(count * sizeof(unsigned int));
+	if(!order)
+		return -1;
+
+	code = jit_alloc(size);
+	if(!code)
+	{
+		free(order);
+		return -1;
+	}
+
+	shuffle_indices(order, count, 2463534242u);
+
+#define BLOCK(i)	(code + (size_t)order[i] * spacing + (order[i] * offsetStep) % spacing)
+	for(i = 0; i + 1 < count; ++i)
+		emit_jump(BLOCK(i), BLOCK(i + 1));
+	emit_return(BLOCK(count - 1));
+
+	entry = seal_code(code, size, (size_t)(BLOCK(0) - code));
+#undef BLOCK
+
+	if(entry)
+		nanos = time_code(entry, count, JUMP_STEPS);
+
+	jit_free(code, size);
+	free(order);
+	return nanos;
+}
+
+static int add_point(struct icache_curve* curve, unsigned int size, double nanos)
+{
+	if(nanos < 0)
+		return -1;
+
+	curve->sizes[curve->count] = size;
+	curve->nanos[curve->count] = nanos;
+	curve->count++;
+	return 0;
+}
+
+static unsigned int curve_boundary(const struct icache_curve* curve)
+{
+	int boundary = find_first_boundary(curve->nanos, curve->count);
+
+	return boundary < 0 ? 0 : curve->sizes[boundary];
+}
+
+int detect_instruction_caches(struct icache_result* result, const char** failure)
+{
+	unsigned int size, pages;
+	int status = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->pageSize = (unsigned int)sysconf(_SC_PAGESIZE);
+
+	profile_phase_begin("frequency stabilization");
+	result->ghz = stabilize_core_frequency(1.0);
+	profile_phase_end();
+
+	profile_phase_begin("instruction probe");
+
+	for(size = MIN_CODE_SIZE; status == 0 && size <= MAX_CODE_SIZE; size *= 2)
+		status = add_point(&result->nops, size, time_nops(size));
+
+	for(size = MIN_CODE_SIZE; status == 0 && size <= MAX_CODE_SIZE; size *= 2)
+		status = add_point(&result->lines, size, time_jumps(size / JUMP_SPACING, JUMP_SPACING, 0));
+
+	for(pages = MIN_PAGES; status == 0 && pages <= MAX_PAGES; pages *= 2)
+		status = add_point(&result->pages, pages * result->pageSize, time_jumps(pages, result->pageSize, JUMP_SPACING));
+
+	profile_phase_end();
+
+	if(status != 0)
+	{
+		*failure = jit_failure();
+		return -1;
+	}
+
+	result->l1iSize = curve_boundary(&result->lines);
+	result->itlbReach = curve_boundary(&result->pages);
+
+	/*
+		Where there's no decoded cache the no-ops' first step is the L1I
+		itself, and where it holds about as much code as the L1I the two
+		can't be told apart.
+	*/
+	result->uopCacheReach = curve_boundary(&result->nops);
+	if(result->l1iSize && result->uopCacheReach >= result->l1iSize)
+		result->uopCacheReach = 0;
+
+	return 0;
+}
+
+#else
+
+int detect_instruction_caches(struct icache_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "generating code is only supported on x86-64 and AArch64";
+	return -1;
+}
+
+#endif
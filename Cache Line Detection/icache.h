@@ -0,0 +1,51 @@
+#ifndef ICACHE_INC
+#define ICACHE_INC
+
+/*
+	The instruction side. Code of increasing size is generated into
+	executable memory and run, the same way the data side walks buffers
+	of increasing size:
+
+	- a straight run of no-ops, which first outgrows the decoded (uop)
+	  cache where the core has one,
+	- a chain of jumps, one per 64 byte line in random order, which
+	  outgrows the L1 instruction cache,
+	- a chain of jumps, one per page in random order, which outgrows the
+	  instruction TLB.
+
+	Needs x86-64 or AArch64, and a system that lets a process turn
+	memory it wrote into code.
+*/
+
+#define ICACHE_MAX_POINTS	16
+
+struct icache_curve
+{
+	unsigned int count;
+	unsigned int sizes[ICACHE_MAX_POINTS];	/* Bytes of code spanned */
+	double nanos[ICACHE_MAX_POINTS];		/* Per instruction executed */
+};
+
+struct icache_result
+{
+	double ghz;							/* The clock the curves were run at */
+	unsigned int pageSize;
+
+	struct icache_curve nops;
+	struct icache_curve lines;
+	struct icache_curve pages;
+
+	unsigned int uopCacheReach;			/* Bytes of no-ops, 0 if no step before the L1I one */
+	unsigned int l1iSize;				/* 0 if no boundary was found */
+	unsigned int itlbReach;				/* Bytes of code, pages times pageSize */
+};
+
+/*
+	Returns 0 on success. Returns -1 if code can't be generated here, and
+	"failure" says why: an unsupported architecture, or a W^X policy
+	(SELinux execmem, PaX, hardened runtimes) refusing executable
+	mappings.
+*/
+int detect_instruction_caches(struct icache_result* result, const char** failure);
+
+#endif
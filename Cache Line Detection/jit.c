@@ -0,0 +1,68 @@
+#include "jit.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static char failureText[128] = "";
+
+const char* jit_failure(void)
+{
+	return failureText;
+}
+
+#if HAVE_CODE_GENERATION
+
+#include <errno.h>
+#include <sys/mman.h>
+
+unsigned char* jit_alloc(size_t size)
+{
+	void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+
+	if(memory == MAP_FAILED)
+	{
+		snprintf(failureText, sizeof(failureText), "can't map %zu bytes: %s", size, strerror(errno));
+		return NULL;
+	}
+
+	return memory;
+}
+
+int jit_seal(unsigned char* code, size_t size)
+{
+	if(mprotect(code, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		snprintf(failureText, sizeof(failureText), "executable memory is refused here (W^X policy?): %s", strerror(errno));
+		return -1;
+	}
+
+#if defined(__aarch64__)
+	__builtin___clear_cache((char*)code, (char*)code + size);
+#endif
+
+	return 0;
+}
+
+void jit_free(unsigned char* code, size_t size)
+{
+	munmap(code, size);
+}
+
+#else
+
+unsigned char* jit_alloc(size_t size)
+{
+	snprintf(failureText, sizeof(failureText), "generating code is only supported on x86-64 and AArch64 Linux and macOS");
+	return NULL;
+}
+
+int jit_seal(unsigned char* code, size_t size)
+{
+	return -1;
+}
+
+void jit_free(unsigned char* code, size_t size)
+{
+}
+
+#endif
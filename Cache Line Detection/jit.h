@@ -0,0 +1,31 @@
+#ifndef JIT_INC
+#define JIT_INC
+
+#include "platform.h"
+
+#include <stddef.h>
+
+/*
+	Memory for generated code. It's written while writable, then sealed
+	into executable, and is never both at once - all W^X policies allow,
+	where they allow even that.
+*/
+
+#if (PLATFORM_LINUX || PLATFORM_MACOS) && (defined(__x86_64__) || defined(__aarch64__))
+#define HAVE_CODE_GENERATION	1
+#else
+#define HAVE_CODE_GENERATION	0
+#endif
+
+/* Writable memory for "size" bytes of code. NULL on failure, see jit_failure. */
+unsigned char* jit_alloc(size_t size);
+
+/* Makes the code executable. Returns 0 on success, -1 if the system refuses. */
+int jit_seal(unsigned char* code, size_t size);
+
+void jit_free(unsigned char* code, size_t size);
+
+/* Why the last jit_alloc or jit_seal failed */
+const char* jit_failure(void);
+
+#endif
@@ -0,0 +1,191 @@
+#include "kernels.h"
+#include "fast_math.h"
+#include "platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	With GCC on x86-64 Linux every kernel is built several times, for the
+	baseline and for the wider vector extensions, and the loader (ifunc)
+	picks the best one this CPU runs. Elsewhere there's just the one.
+*/
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && PLATFORM_LINUX
+#define KERNEL_CLONES	__attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define KERNEL_CLONES
+#endif
+
+/* Accesses per trip through a kernel's loop */
+#define UNROLL	8
+
+/*
+	The access types. They're allowed to be unaligned and to alias the
+	char buffer. Without GCC's vector extensions the wide accesses
+	aren't available.
+*/
+#if defined(__GNUC__)
+typedef uint8_t access1_t __attribute__((aligned(1), may_alias));
+typedef uint32_t access4_t __attribute__((aligned(1), may_alias));
+typedef uint64_t access8_t __attribute__((aligned(1), may_alias));
+typedef uint8_t access16_t __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint8_t access32_t __attribute__((vector_size(32), aligned(1), may_alias));
+typedef uint8_t access64_t __attribute__((vector_size(64), aligned(1), may_alias));
+#define HAVE_WIDE_ACCESS	1
+#else
+typedef uint8_t access1_t;
+#define HAVE_WIDE_ACCESS	0
+#endif
+
+/*
+	Keeps the compiler from optimizing away what the overhead variants
+	do, without adding any work of its own (where there's inline asm).
+*/
+#if defined(__GNUC__)
+#define OPAQUE(x)			__asm__ volatile("" : : "r"(x))
+#define OPAQUE_UPDATE(x)	__asm__ volatile("" : "+r"(x))
+#else
+static volatile uintptr_t opaqueSink;
+#define OPAQUE(x)			(opaqueSink = (uintptr_t)(x))
+#define OPAQUE_UPDATE(x)	(opaqueSink = (uintptr_t)(x))
+#endif
+
+/* What happens at each address: the real access, nothing, or a register add in its place */
+#define TOUCH_1(a)			(*(access1_t*)(a) += 1)
+#define TOUCH_4(a)			(*(access4_t*)(a) += 1)
+#define TOUCH_8(a)			(*(access8_t*)(a) += 1)
+#define TOUCH_16(a)			(*(access16_t*)(a) += 1)
+#define TOUCH_32(a)			(*(access32_t*)(a) += 1)
+#define TOUCH_64(a)			(*(access64_t*)(a) += 1)
+#define TOUCH_EMPTY(a)		OPAQUE(a)
+#define TOUCH_REGISTER(a)	do { reg += 1; OPAQUE_UPDATE(reg); } while(0)
+
+#define UNROLLED(OP, p, stride) \
+	do { \
+		OP((p) + 0 * (stride)); \
+		OP((p) + 1 * (stride)); \
+		OP((p) + 2 * (stride)); \
+		OP((p) + 3 * (stride)); \
+		OP((p) + 4 * (stride)); \
+		OP((p) + 5 * (stride)); \
+		OP((p) + 6 * (stride)); \
+		OP((p) + 7 * (stride)); \
+	} while(0)
+
+/* One kernel loop. STRIDE is either a constant or the "stride" argument. */
+#define DEFINE_LOOP(NAME, OP, STRIDE) \
+	static KERNEL_CLONES void NAME(char* data, unsigned int dataSize, unsigned int stride, unsigned int steps) \
+	{ \
+		char* const end = data + dataSize; \
+		const unsigned int perPass = dataSize / (STRIDE); \
+		const size_t step = (size_t)UNROLL * (STRIDE); \
+		uintptr_t reg = 0; \
+		char* p; \
+		\
+		for(; steps >= perPass; steps -= perPass) \
+			for(p = data; p < end; p += step) \
+				UNROLLED(OP, p, (STRIDE)); \
+		\
+		OPAQUE(reg); \
+	}
+
+/* A kernel with the stride baked in, and its overhead variants */
+#define DEFINE_KERNEL(WIDTH, STRIDE) \
+	DEFINE_LOOP(kernel_w##WIDTH##_s##STRIDE, TOUCH_##WIDTH, STRIDE) \
+	DEFINE_LOOP(kernel_w##WIDTH##_s##STRIDE##_empty, TOUCH_EMPTY, STRIDE) \
+	DEFINE_LOOP(kernel_w##WIDTH##_s##STRIDE##_register, TOUCH_REGISTER, STRIDE)
+
+/* The same for whatever stride it's given */
+#define DEFINE_ANY_STRIDE_KERNEL(WIDTH) \
+	DEFINE_LOOP(kernel_w##WIDTH##_any, TOUCH_##WIDTH, stride) \
+	DEFINE_LOOP(kernel_w##WIDTH##_any_empty, TOUCH_EMPTY, stride) \
+	DEFINE_LOOP(kernel_w##WIDTH##_any_register, TOUCH_REGISTER, stride)
+
+/* The strides the detection actually uses: candidate lines, and pages for the TLB */
+#define DEFINE_WIDTH(WIDTH) \
+	DEFINE_KERNEL(WIDTH, 32) \
+	DEFINE_KERNEL(WIDTH, 64) \
+	DEFINE_KERNEL(WIDTH, 128) \
+	DEFINE_KERNEL(WIDTH, 256) \
+	DEFINE_KERNEL(WIDTH, 4096) \
+	DEFINE_ANY_STRIDE_KERNEL(WIDTH)
+
+#define KERNEL_ENTRY(WIDTH, STRIDE, NAME) \
+	{WIDTH, STRIDE, {NAME, NAME##_empty, NAME##_register}}
+
+#define WIDTH_ENTRIES(WIDTH) \
+	KERNEL_ENTRY(WIDTH, 32, kernel_w##WIDTH##_s32), \
+	KERNEL_ENTRY(WIDTH, 64, kernel_w##WIDTH##_s64), \
+	KERNEL_ENTRY(WIDTH, 128, kernel_w##WIDTH##_s128), \
+	KERNEL_ENTRY(WIDTH, 256, kernel_w##WIDTH##_s256), \
+	KERNEL_ENTRY(WIDTH, 4096, kernel_w##WIDTH##_s4096), \
+	KERNEL_ENTRY(WIDTH, 0, kernel_w##WIDTH##_any)
+
+DEFINE_WIDTH(1)
+#if HAVE_WIDE_ACCESS
+DEFINE_WIDTH(4)
+DEFINE_WIDTH(8)
+DEFINE_WIDTH(16)
+DEFINE_WIDTH(32)
+DEFINE_WIDTH(64)
+#endif
+
+/* stride 0 takes any stride */
+struct kernel_entry
+{
+	unsigned int width;
+	unsigned int stride;
+	access_kernel variants[KERNEL_VARIANT_COUNT];
+};
+
+static const struct kernel_entry kernels[] = {
+	WIDTH_ENTRIES(1),
+#if HAVE_WIDE_ACCESS
+	WIDTH_ENTRIES(4),
+	WIDTH_ENTRIES(8),
+	WIDTH_ENTRIES(16),
+	WIDTH_ENTRIES(32),
+	WIDTH_ENTRIES(64)
+#endif
+};
+
+int is_supported_access_width(unsigned int width)
+{
+	unsigned int i;
+
+	for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+		if(kernels[i].width == width)
+			return 1;
+
+	return 0;
+}
+
+access_kernel find_access_kernel(
+		unsigned int width,
+		unsigned int stride,
+		unsigned int dataSize,
+		unsigned int steps,
+		enum kernel_variant variant
+	)
+{
+	access_kernel found = NULL;
+	unsigned int i;
+
+	if(width > stride || !is_power_of_two(dataSize) || !is_power_of_two(stride) ||
+		dataSize < UNROLL * stride || steps % (dataSize / stride) != 0)
+		return NULL;
+
+	for(i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+	{
+		if(kernels[i].width != width)
+			continue;
+
+		if(kernels[i].stride == stride)
+			return kernels[i].variants[variant];
+
+		if(kernels[i].stride == 0)
+			found = kernels[i].variants[variant];
+	}
+
+	return found;
+}
@@ -0,0 +1,49 @@
+#ifndef KERNELS_INC
+#define KERNELS_INC
+
+/*
+	Specialized measurement kernels. Each one walks a buffer with pointer
+	increments, eight accesses per loop, so all that's left per access is
+	the access itself - unlike the multiply and mask of the generic loop,
+	which costs about as much as an L1 hit.
+
+	There's one per access width (how many bytes each access reads and
+	writes back) and common stride, with the stride a compile time
+	constant, plus one per width for any other stride.
+*/
+
+/* Runs "steps" accesses over the buffer, a pass at a time */
+typedef void (*access_kernel)(char* data, unsigned int dataSize, unsigned int stride, unsigned int steps);
+
+/* 1, 4, 8, 16, 32 or 64 bytes. */
+int is_supported_access_width(unsigned int width);
+
+/*
+	Every kernel comes with two variants for measuring its overhead: the
+	same loop with no access at all, and with a register add in place of
+	each access.
+*/
+enum kernel_variant
+{
+	KERNEL_ACCESS,
+	KERNEL_EMPTY,
+	KERNEL_REGISTER,
+
+	KERNEL_VARIANT_COUNT
+};
+
+/*
+	The best kernel for the job, or NULL if none fits and the caller has
+	to fall back on the generic loop: the buffer must hold a power of two
+	multiple of eight strides, "steps" must be whole passes over it, and
+	an access can't be wider than the stride.
+*/
+access_kernel find_access_kernel(
+		unsigned int width,
+		unsigned int stride,
+		unsigned int dataSize,
+		unsigned int steps,
+		enum kernel_variant variant
+	);
+
+#endif
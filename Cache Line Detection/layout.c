@@ -0,0 +1,456 @@
+#include "layout.h"
+#include "cache.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Elements the lines touched are counted over, rounded up to whole blocks */
+#define ANALYSIS_ELEMENTS	4096
+
+/* Bytes of AoS array each trial sweeps, at least, and trials per point */
+#define TRIAL_BYTES			((size_t)64 * 1024 * 1024)
+#define TRIALS				5
+
+static const char* kindNames[LAYOUT_KIND_COUNT] = {"AoS", "SoA", "AoSoA"};
+
+const char* layout_kind_name(enum layout_kind kind)
+{
+	return (unsigned int)kind < LAYOUT_KIND_COUNT ? kindNames[kind] : "?";
+}
+
+/* Where every field of every element lives, in each layout, for a given element count */
+struct geometry
+{
+	unsigned int count;
+	unsigned int sizes[LAYOUT_MAX_FIELDS];
+	unsigned int hotCount;
+	unsigned int hot[LAYOUT_MAX_FIELDS];	/* Indices of the hot fields */
+
+	unsigned int structSize;
+	unsigned int offsets[LAYOUT_MAX_FIELDS];
+
+	unsigned int blockLength;
+	size_t blockSize;
+	size_t blockOffsets[LAYOUT_MAX_FIELDS];
+
+	size_t arrayOffsets[LAYOUT_MAX_FIELDS];	/* SoA */
+
+	size_t footprint[LAYOUT_KIND_COUNT];
+};
+
+static unsigned int field_alignment(unsigned int size)
+{
+	unsigned int alignment = 1;
+
+	while(alignment < 8 && size % (alignment * 2) == 0)
+		alignment *= 2;
+
+	return alignment;
+}
+
+static size_t align_up(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static void build_geometry(const struct struct_description* description, unsigned int lineSize, unsigned int blockLength, size_t elements, struct geometry* geometry)
+{
+	unsigned int largestAlignment = 1;
+	size_t at = 0;
+	unsigned int f;
+
+	memset(geometry, 0, sizeof(*geometry));
+	geometry->count = description->count;
+	geometry->blockLength = blockLength;
+
+	for(f = 0; f < description->count; ++f)
+	{
+		unsigned int alignment = field_alignment(description->sizes[f]);
+
+		geometry->sizes[f] = description->sizes[f];
+		if(description->hot[f])
+			geometry->hot[geometry->hotCount++] = f;
+		if(alignment > largestAlignment)
+			largestAlignment = alignment;
+
+		at = align_up(at, alignment);
+		geometry->offsets[f] = (unsigned int)at;
+		at += description->sizes[f];
+	}
+	geometry->structSize = (unsigned int)align_up(at, largestAlignment);
+
+	for(at = 0, f = 0; f < description->count; ++f)
+	{
+		at = align_up(at, field_alignment(description->sizes[f]));
+		geometry->blockOffsets[f] = at;
+		at += (size_t)blockLength * description->sizes[f];
+	}
+	geometry->blockSize = align_up(at, largestAlignment);
+
+	for(at = 0, f = 0; f < description->count; ++f)
+	{
+		geometry->arrayOffsets[f] = at;
+		at = align_up(at + elements * description->sizes[f], lineSize);
+	}
+
+	geometry->footprint[LAYOUT_AOS] = elements * geometry->structSize;
+	geometry->footprint[LAYOUT_SOA] = at;
+	geometry->footprint[LAYOUT_AOSOA] = (elements + blockLength - 1) / blockLength * geometry->blockSize;
+}
+
+static size_t field_offset(const struct geometry* geometry, enum layout_kind kind, size_t element, unsigned int field)
+{
+	switch(kind)
+	{
+	case LAYOUT_AOS:
+		return element * geometry->structSize + geometry->offsets[field];
+	case LAYOUT_SOA:
+		return geometry->arrayOffsets[field] + element * geometry->sizes[field];
+	default:
+		return element / geometry->blockLength * geometry->blockSize + geometry->blockOffsets[field] +
+			element % geometry->blockLength * geometry->sizes[field];
+	}
+}
+
+/* Every line a hot byte is in, marked, over ANALYSIS_ELEMENTS elements */
+static double lines_per_element(const struct geometry* geometry, enum layout_kind kind, unsigned int lineSize, size_t elements)
+{
+	const size_t lines = (geometry->footprint[kind] + lineSize - 1) / lineSize;
+	unsigned char* touched = calloc(lines, 1);
+	size_t element, line, count = 0;
+	unsigned int h;
+
+	if(!touched)
+		return -1;
+
+	for(element = 0; element < elements; ++element)
+	{
+		for(h = 0; h < geometry->hotCount; ++h)
+		{
+			unsigned int field = geometry->hot[h];
+			size_t first = field_offset(geometry, kind, element, field);
+
+			for(line = first / lineSize; line <= (first + geometry->sizes[field] - 1) / lineSize; ++line)
+				touched[line] = 1;
+		}
+	}
+
+	for(line = 0; line < lines; ++line)
+		count += touched[line];
+
+	free(touched);
+	return (double)count / elements;
+}
+
+int analyse_layouts(const struct struct_description* description, unsigned int lineSize, unsigned int blockLength, struct layout_analysis* analysis)
+{
+	struct geometry geometry;
+	unsigned int smallestHot = 0;
+	size_t elements;
+	unsigned int f, kind;
+
+	memset(analysis, 0, sizeof(*analysis));
+
+	if(description->count == 0 || description->count > LAYOUT_MAX_FIELDS || blockLength > LAYOUT_MAX_BLOCK || !is_power_of_two(lineSize))
+		return -1;
+
+	for(f = 0; f < description->count; ++f)
+	{
+		if(description->sizes[f] == 0 || description->sizes[f] > LAYOUT_MAX_FIELD_SIZE)
+			return -1;
+
+		if(description->hot[f])
+		{
+			analysis->hotBytes += description->sizes[f];
+			if(smallestHot == 0 || description->sizes[f] < smallestHot)
+				smallestHot = description->sizes[f];
+		}
+	}
+
+	if(analysis->hotBytes == 0)
+		return -1;
+
+	if(blockLength == 0)
+		blockLength = lineSize / smallestHot ? lineSize / smallestHot : 1;
+
+	elements = align_up(ANALYSIS_ELEMENTS, blockLength);
+	build_geometry(description, lineSize, blockLength, elements, &geometry);
+
+	analysis->lineSize = lineSize;
+	analysis->structSize = geometry.structSize;
+	analysis->blockLength = blockLength;
+
+	for(kind = 0; kind < LAYOUT_KIND_COUNT; ++kind)
+	{
+		analysis->linesPerElement[kind] = lines_per_element(&geometry, (enum layout_kind)kind, lineSize, elements);
+		if(analysis->linesPerElement[kind] < 0)
+			return -1;
+
+		analysis->usefulFraction[kind] = analysis->hotBytes / (analysis->linesPerElement[kind] * lineSize);
+	}
+
+	return 0;
+}
+
+/*
+	Sums "count" instances of one field, "stride" bytes apart, the way
+	code would read it: whole words, then what's left over. Common sizes
+	get a reader with the size baked in, so the loop is a load and an
+	add; the rest share one that takes the size as it comes.
+*/
+typedef uint64_t (*field_reader)(const char* at, size_t stride, size_t count, unsigned int size);
+
+#define DEFINE_SMALL_READER(SIZE, TYPE) \
+	static uint64_t read_##SIZE(const char* at, size_t stride, size_t count, unsigned int size) \
+	{ \
+		uint64_t sum = 0; \
+		TYPE value; \
+		size_t i; \
+		\
+		for(i = 0; i < count; ++i, at += stride) \
+		{ \
+			memcpy(&value, at, sizeof(value)); \
+			sum += value; \
+		} \
+		\
+		return sum; \
+	}
+
+#define DEFINE_WORDS_READER(SIZE) \
+	static uint64_t read_##SIZE(const char* at, size_t stride, size_t count, unsigned int size) \
+	{ \
+		uint64_t sum = 0; \
+		uint64_t word; \
+		size_t i; \
+		unsigned int w; \
+		\
+		for(i = 0; i < count; ++i, at += stride) \
+		{ \
+			for(w = 0; w < (SIZE) / 8; ++w) \
+			{ \
+				memcpy(&word, at + w * 8, sizeof(word)); \
+				sum += word; \
+			} \
+		} \
+		\
+		return sum; \
+	}
+
+DEFINE_SMALL_READER(1, uint8_t)
+DEFINE_SMALL_READER(2, uint16_t)
+DEFINE_SMALL_READER(4, uint32_t)
+DEFINE_SMALL_READER(8, uint64_t)
+DEFINE_WORDS_READER(16)
+DEFINE_WORDS_READER(24)
+DEFINE_WORDS_READER(32)
+DEFINE_WORDS_READER(64)
+
+static uint64_t read_any(const char* at, size_t stride, size_t count, unsigned int size)
+{
+	uint64_t sum = 0;
+	uint64_t word;
+	size_t i;
+	unsigned int left;
+	const char* p;
+
+	for(i = 0; i < count; ++i, at += stride)
+	{
+		for(p = at, left = size; left >= 8; left -= 8, p += 8)
+		{
+			memcpy(&word, p, sizeof(word));
+			sum += word;
+		}
+		for(; left > 0; --left)
+			sum += (unsigned char)*p++;
+	}
+
+	return sum;
+}
+
+static const struct
+{
+	unsigned int size;
+	field_reader reader;
+} readers[] = {
+	{1, read_1}, {2, read_2}, {4, read_4}, {8, read_8},
+	{16, read_16}, {24, read_24}, {32, read_32}, {64, read_64}
+};
+
+static field_reader find_reader(unsigned int size)
+{
+	unsigned int i;
+
+	for(i = 0; i < sizeof(readers) / sizeof(readers[0]); ++i)
+		if(readers[i].size == size)
+			return readers[i].reader;
+
+	return read_any;
+}
+
+/* Keeps each pass's sum, and so the pass, from being optimized away */
+#if defined(__GNUC__)
+#define KEEP(sum)	__asm__ volatile("" : : "r"(sum) : "memory")
+#else
+static volatile uint64_t sink;
+#define KEEP(sum)	(sink = (sum))
+#endif
+
+/*
+	Where each hot field's instances are in one layout: a run of
+	blockLength of them "stride" apart, the next run "blockStride" on.
+	Every layout goes through the same loops, a block at a time and
+	within it a field at a time, so only the addresses differ.
+*/
+struct hot_walk
+{
+	unsigned int hotCount;
+	const char* origins[LAYOUT_MAX_FIELDS];
+	size_t strides[LAYOUT_MAX_FIELDS];
+	size_t blockStrides[LAYOUT_MAX_FIELDS];
+	unsigned int sizes[LAYOUT_MAX_FIELDS];
+	field_reader readers[LAYOUT_MAX_FIELDS];
+};
+
+static void plan_walk(const char* base, const struct geometry* geometry, enum layout_kind kind, struct hot_walk* walk)
+{
+	unsigned int h;
+
+	walk->hotCount = geometry->hotCount;
+
+	for(h = 0; h < geometry->hotCount; ++h)
+	{
+		const unsigned int field = geometry->hot[h];
+		const unsigned int size = geometry->sizes[field];
+
+		walk->sizes[h] = size;
+		walk->readers[h] = find_reader(size);
+
+		switch(kind)
+		{
+		case LAYOUT_AOS:
+			walk->origins[h] = base + geometry->offsets[field];
+			walk->strides[h] = geometry->structSize;
+			walk->blockStrides[h] = (size_t)geometry->blockLength * geometry->structSize;
+			break;
+		case LAYOUT_SOA:
+			walk->origins[h] = base + geometry->arrayOffsets[field];
+			walk->strides[h] = size;
+			walk->blockStrides[h] = (size_t)geometry->blockLength * size;
+			break;
+		default:
+			walk->origins[h] = base + geometry->blockOffsets[field];
+			walk->strides[h] = size;
+			walk->blockStrides[h] = geometry->blockSize;
+			break;
+		}
+	}
+}
+
+/* "elements" is a whole number of blocks */
+static void sum_hot_fields(const struct hot_walk* walk, size_t blockLength, size_t elements)
+{
+	const size_t blocks = elements / blockLength;
+	uint64_t sum = 0;
+	size_t block;
+	unsigned int h;
+
+	for(block = 0; block < blocks; ++block)
+		for(h = 0; h < walk->hotCount; ++h)
+			sum += walk->readers[h](walk->origins[h] + block * walk->blockStrides[h], walk->strides[h], blockLength, walk->sizes[h]);
+
+	KEEP(sum);
+}
+
+/* Median nanoseconds per element */
+static double time_layout(const char* base, const struct geometry* geometry, enum layout_kind kind, size_t elements)
+{
+	size_t passes = TRIAL_BYTES / geometry->footprint[LAYOUT_AOS];
+	struct hot_walk walk;
+	double samples[TRIALS];
+	unsigned int trial;
+	size_t pass;
+
+	if(passes == 0)
+		passes = 1;
+
+	plan_walk(base, geometry, kind, &walk);
+	sum_hot_fields(&walk, geometry->blockLength, elements);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		for(pass = 0; pass < passes; ++pass)
+			sum_hot_fields(&walk, geometry->blockLength, elements);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / ((double)passes * elements);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+static int measure_target(const struct struct_description* description, const struct layout_analysis* analysis, struct layout_target* target)
+{
+	struct geometry geometry;
+	size_t largest = 0;
+	char* raw;
+	char* base;
+	unsigned int kind;
+
+	build_geometry(description, analysis->lineSize, analysis->blockLength, target->elements, &geometry);
+
+	for(kind = 0; kind < LAYOUT_KIND_COUNT; ++kind)
+		if(geometry.footprint[kind] > largest)
+			largest = geometry.footprint[kind];
+
+	/* Line aligned by hand, like the analysis assumes */
+	raw = malloc(largest + analysis->lineSize);
+	if(!raw)
+		return -1;
+	base = (char*)(((uintptr_t)raw + analysis->lineSize - 1) & ~(uintptr_t)(analysis->lineSize - 1));
+	memset(base, 1, largest);
+
+	for(kind = 0; kind < LAYOUT_KIND_COUNT; ++kind)
+		target->nanos[kind] = time_layout(base, &geometry, (enum layout_kind)kind, target->elements);
+
+	free(raw);
+	return 0;
+}
+
+static void add_target(struct layout_benchmark* benchmark, const struct layout_analysis* analysis, unsigned int level, size_t bytes)
+{
+	struct layout_target* target = &benchmark->targets[benchmark->count++];
+	size_t elements = bytes / analysis->structSize;
+
+	target->level = level;
+	target->elements = align_up(elements ? elements : 1, analysis->blockLength);
+}
+
+int benchmark_layouts(const struct struct_description* description, const struct layout_analysis* analysis, const unsigned int levels[3], struct layout_benchmark* benchmark)
+{
+	struct level_target targets[MAX_LEVEL_TARGETS];
+	unsigned int count, i;
+
+	memset(benchmark, 0, sizeof(*benchmark));
+
+	count = get_level_targets(levels, 2, MAX_MEMORY_SET, targets);
+	for(i = 0; i < count; ++i)
+		add_target(benchmark, analysis, targets[i].level, targets[i].bytes);
+
+	profile_phase_begin("layout benchmark");
+	for(i = 0; i < benchmark->count; ++i)
+	{
+		if(measure_target(description, analysis, &benchmark->targets[i]) != 0)
+		{
+			profile_phase_end();
+			return -1;
+		}
+	}
+	profile_phase_end();
+
+	return 0;
+}
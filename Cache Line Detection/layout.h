@@ -0,0 +1,79 @@
+#ifndef LAYOUT_INC
+#define LAYOUT_INC
+
+#include <stddef.h>
+
+/*
+	Whether to split a struct. Given its fields' sizes and which of them
+	a hot loop reads, three layouts of the same elements are compared:
+
+		AoS		one array of structs, fields in declaration order with
+				C's padding (each field aligned to its size, up to 8)
+		SoA		one array per field, each starting on a line
+		AoSoA	blocks of "blockLength" elements, each block holding
+				that many of the first field, then of the second...
+
+	First on paper: how many lines a pass over the elements touches per
+	element, from the line size alone. Then measured: the hot fields
+	summed over working sets sized to each cache level and to memory.
+*/
+
+#define LAYOUT_MAX_FIELDS		16
+#define LAYOUT_MAX_FIELD_SIZE	256
+#define LAYOUT_MAX_BLOCK		4096
+#define LAYOUT_MAX_TARGETS		4
+
+enum layout_kind
+{
+	LAYOUT_AOS,
+	LAYOUT_SOA,
+	LAYOUT_AOSOA,
+
+	LAYOUT_KIND_COUNT
+};
+
+struct struct_description
+{
+	unsigned int count;
+	unsigned int sizes[LAYOUT_MAX_FIELDS];
+	int hot[LAYOUT_MAX_FIELDS];
+};
+
+struct layout_analysis
+{
+	unsigned int lineSize;
+	unsigned int structSize;				/* With padding, as sizeof would say */
+	unsigned int hotBytes;					/* Per element */
+	unsigned int blockLength;				/* AoSoA elements per block */
+
+	double linesPerElement[LAYOUT_KIND_COUNT];
+	double usefulFraction[LAYOUT_KIND_COUNT];	/* Hot bytes over bytes of the lines touched */
+};
+
+struct layout_target
+{
+	unsigned int level;						/* 1 to 3, or 0 for memory */
+	size_t elements;						/* The AoS array fills half the level */
+	double nanos[LAYOUT_KIND_COUNT];		/* Per element, median of the trials */
+};
+
+struct layout_benchmark
+{
+	unsigned int count;
+	struct layout_target targets[LAYOUT_MAX_TARGETS];
+};
+
+const char* layout_kind_name(enum layout_kind kind);
+
+/*
+	"blockLength" 0 picks a line's worth of the smallest hot field.
+	Returns 0 on success, -1 if the description has no fields, no hot
+	ones, a field of 0 or more than LAYOUT_MAX_FIELD_SIZE bytes, a block
+	longer than LAYOUT_MAX_BLOCK, or the line size isn't a power of two.
+*/
+int analyse_layouts(const struct struct_description* description, unsigned int lineSize, unsigned int blockLength, struct layout_analysis* analysis);
+
+/* "levels" are L1 to L3, 0 for any that weren't found. Returns -1 if out of memory. */
+int benchmark_layouts(const struct struct_description* description, const struct layout_analysis* analysis, const unsigned int levels[3], struct layout_benchmark* benchmark);
+
+#endif
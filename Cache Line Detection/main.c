@@ -5,6 +5,29 @@
 #include "platform.h"
 #include "cache.h"
 #include "format.h"
+#include "topology_shm.h"
+#include "results.h"
+#include "compare.h"
+#include "profile.h"
+#include "bench.h"
+#include "cache_sim.h"
+#include "selftest.h"
+#include "budget.h"
+#include "icache.h"
+#include "stores.h"
+#include "alignment.h"
+#include "aliasing.h"
+#include "dram.h"
+#include "stream.h"
+#include "faults.h"
+#include "allocator.h"
+#include "layout.h"
+#include "hash.h"
+#include "prefetch.h"
+#include "coherence.h"
+#include "flush.h"
+#include "affinity.h"
+#include "stats.h"
 
 /* Get cache line size using native macOS sysctl (M1 compatible) */
 #if PLATFORM_MACOS
@@ -103,30 +126,57 @@ static unsigned int get_cache_line_linux(void)
     return cache_line;
 }
 
+static int read_sysfs_line(const char* path, char* line, size_t lineSize)
+{
+    FILE *fp = fopen(path, "r");
+    int ok = 0;
+
+    if (fp) {
+        ok = fgets(line, lineSize, fp) != NULL;
+        fclose(fp);
+    }
+
+    return ok;
+}
+
 static unsigned int get_cache_size_linux_sysfs(int level, int type)
 {
-    FILE *fp;
     char path[256];
     char line[256];
     unsigned int cache_size = 0;
+    int index;
     
-    /* Build path for specific cache level and type */
     /* type: 0 = unified, 1 = instruction, 2 = data */
-    const char* type_str[] = {"", "index1", "index2"};
-    snprintf(path, sizeof(path), 
-             "/sys/devices/system/cpu/cpu0/cache/%s/size", type_str[type]);
+    const char* type_str[] = {"Unified", "Instruction", "Data"};
     
-    fp = fopen(path, "r");
-    if (fp) {
-        if (fgets(line, sizeof(line), fp)) {
+    /* The index numbering differs between CPUs, so look for the matching level and type */
+    for (index = 0; index < 16; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if (!read_sysfs_line(path, line, sizeof(line))) {
+            break;
+        }
+        if (atoi(line) != level) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if (!read_sysfs_line(path, line, sizeof(line)) ||
+            strncmp(line, type_str[type], strlen(type_str[type])) != 0) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if (read_sysfs_line(path, line, sizeof(line))) {
             /* Size is usually in KB, may have K suffix */
             char* end;
             cache_size = (unsigned int)strtoul(line, &end, 10);
             if (*end == 'K' || *end == 'k') {
                 cache_size *= 1024;
+            } else if (*end == 'M' || *end == 'm') {
+                cache_size *= 1024 * 1024;
             }
         }
-        fclose(fp);
+        break;
     }
     
     return cache_size;
@@ -134,26 +184,92 @@ static unsigned int get_cache_size_linux_sysfs(int level, int type)
 
 static void get_l1_cache_linux(unsigned int* l1i, unsigned int* l1d)
 {
-    *l1i = get_cache_size_linux_sysfs(1, 1);  /* index1 is usually instruction */
-    *l1d = get_cache_size_linux_sysfs(1, 2);  /* index2 is usually data */
+    *l1i = get_cache_size_linux_sysfs(1, 1);
+    *l1d = get_cache_size_linux_sysfs(1, 2);
 }
 
 static unsigned int get_l2_cache_linux(void)
 {
-    return get_cache_size_linux_sysfs(2, 0);  /* index2 is unified L2 */
+    return get_cache_size_linux_sysfs(2, 0);
 }
 
 static unsigned int get_l3_cache_linux(void)
 {
-    return get_cache_size_linux_sysfs(3, 0);  /* index3 is L3 (if exists) */
+    return get_cache_size_linux_sysfs(3, 0);  /* if exists */
 }
 #endif
 
-/* Print cache information with native and timing-based results */
-static void print_cache_info(void)
+/* Collect whatever the OS tells us about the cache hierarchy */
+static void get_native_topology(struct cache_topology* topology)
 {
-    unsigned int results[4];
+    memset(topology, 0, sizeof(*topology));
+    
+#if PLATFORM_MACOS
+    get_l1_cache_macOS(&topology->l1i, &topology->l1d);
+    topology->l2 = get_l2_cache_macOS();
+    topology->l3 = get_l3_cache_macOS();
+    topology->lineSize = get_cache_line_macOS();
+#elif PLATFORM_LINUX
+    get_l1_cache_linux(&topology->l1i, &topology->l1d);
+    topology->l2 = get_l2_cache_linux();
+    topology->l3 = get_l3_cache_linux();
+    topology->lineSize = get_cache_line_linux();
+#endif
+}
+
+/* Print what another process would see in the shared segment */
+static int print_published_topology(void)
+{
+    const struct cache_topology_segment* segment = map_cache_topology();
+    struct cache_topology topology;
+    
+    if (!segment) {
+        printf("No cache topology published at %s\n", CACHE_TOPOLOGY_SHM_NAME);
+        return 1;
+    }
+    
+    if (read_cache_topology(segment, &topology) != 0) {
+        printf("Published cache topology is being rewritten, try again\n");
+        unmap_cache_topology(segment);
+        return 1;
+    }
+    
+    printf("Published Cache Topology (%s, version %u):\n", CACHE_TOPOLOGY_SHM_NAME, segment->version);
+    printf("  Cache Line: %uB (measured %uB)\n", topology.lineSize, topology.measuredLineSize);
+    printf("  L1 Instruction: %uB\n", topology.l1i);
+    printf("  L1 Data: %uB (measured %uB)\n", topology.l1d, topology.measuredL1);
+    printf("  L2: %uB (measured %uB)\n", topology.l2, topology.measuredL2);
+    printf("  L3: %uB (measured %uB)\n", topology.l3, topology.measuredL3);
+    
+    unmap_cache_topology(segment);
+    return 0;
+}
+
+/* Load-to-use latency of each level from a dependent chase, and the clock it's in cycles of */
+static void print_level_latencies(void)
+{
+    const char* names[] = {"L1", "L2", "L3"};
+    double nanos, cycles, ghz;
+    int fromPerf;
+    unsigned int level;
     
+    ghz = get_stable_core_frequency(&fromPerf);
+    if (ghz <= 0) {
+        return;
+    }
+    
+    printf("\n  Core Clock: %.2fGHz (per sample from %s)\n", ghz, fromPerf ? "perf cycles" : "dependent adds");
+    
+    for (level = 1; level <= 3; level++) {
+        if (get_cache_level_latency(level, &nanos, &cycles) == 0) {
+            printf("  %s Latency: %.2fns, %.1f cycles\n", names[level - 1], nanos, cycles);
+        }
+    }
+}
+
+/* Print cache information with native and timing-based results */
+static void print_cache_info(unsigned int results[4])
+{
     printf("=== Cache Detection Results ===\n\n");
     
 #if PLATFORM_MACOS
@@ -162,10 +278,12 @@ static void print_cache_info(void)
     unsigned int nativeL2 = 0, nativeL3 = 0;
     unsigned int nativeLine = 0;
     
+    profile_phase_begin("sysctl reads");
     get_l1_cache_macOS(&nativeL1i, &nativeL1d);
     nativeL2 = get_l2_cache_macOS();
     nativeL3 = get_l3_cache_macOS();
     nativeLine = get_cache_line_macOS();
+    profile_phase_end();
     
     /* L1 Cache (Native) */
     printf("L1 Cache (Native macOS):\n");
@@ -217,10 +335,12 @@ static void print_cache_info(void)
     unsigned int nativeL2 = 0, nativeL3 = 0;
     unsigned int nativeLine = 0;
     
+    profile_phase_begin("sysfs reads");
     get_l1_cache_linux(&nativeL1i, &nativeL1d);
     nativeL2 = get_l2_cache_linux();
     nativeL3 = get_l3_cache_linux();
     nativeLine = get_cache_line_linux();
+    profile_phase_end();
     
     /* L1 Cache (Native) */
     printf("L1 Cache (Native Linux):\n");
@@ -288,9 +408,178 @@ static void print_cache_info(void)
     struct size_of_data formattedLine = unitfy_data_size(results[3]);
     printf("  Cache Line: %u%s\n", formattedLine.quantity, formattedLine.unit);
     
+    /* Memory plateau, if the sweeps got there before 64MB */
+    if (get_memory_plateau()) {
+        struct size_of_data formattedPlateau = unitfy_data_size(get_memory_plateau());
+        printf("  Memory Latency From: %u%s\n", formattedPlateau.quantity, formattedPlateau.unit);
+    }
+    
+    print_level_latencies();
+    
+    printf("\n");
+}
+
+static void print_stream_row(const char* name, unsigned int threads, const double bandwidth[STREAM_KERNEL_COUNT])
+{
+    unsigned int kernel;
+    
+    printf("  %-22s %7u", name, threads);
+    for (kernel = 0; kernel < STREAM_KERNEL_COUNT; kernel++) {
+        printf(" %9.1f", bandwidth[kernel]);
+    }
+    printf("\n");
+}
+
+/* STREAM's kernels on arrays sized from the levels just detected, on one thread and on all of them */
+static void print_stream_bandwidth(const unsigned int results[4])
+{
+    struct stream_result stream;
+    const char* failure;
+    unsigned int i, kernel;
+    
+    printf("=== Sustained Bandwidth (STREAM, GB/s) ===\n\n");
+    
+    if (measure_stream(results, &stream, &failure) != 0) {
+        printf("  Not available: %s\n\n", failure);
+        return;
+    }
+    
+    printf("  %-22s %7s", "Arrays", "Threads");
+    for (kernel = 0; kernel < STREAM_KERNEL_COUNT; kernel++) {
+        printf(" %9s", stream_kernel_name((enum stream_kernel)kernel));
+    }
+    printf("\n");
+    
+    for (i = 0; i < stream.count; i++) {
+        const struct stream_target* target = &stream.targets[i];
+        struct size_of_data formatted = unitfy_data_size((unsigned int)target->arrayBytes);
+        char name[32];
+        
+        if (target->level) {
+            snprintf(name, sizeof(name), "L%u, 3 x %u%s", target->level, formatted.quantity, formatted.unit);
+        } else {
+            snprintf(name, sizeof(name), "Memory, 3 x %u%s", formatted.quantity, formatted.unit);
+        }
+        
+        print_stream_row(name, 1, target->single);
+        if (stream.threads > 1) {
+            print_stream_row("", stream.threads, target->all);
+        }
+    }
+    
+    printf("\n  L1 and L2 arrays are per thread, L3 and memory arrays are split between threads.\n\n");
+}
+
+/* What was subtracted from the measurements, per kernel, with the range over buffer sizes */
+static void print_overhead_calibration(void)
+{
+    const struct overhead_calibration* calibrations;
+    unsigned int count = get_overhead_calibrations(&calibrations);
+    unsigned int i, j;
+    
+    if (count == 0) {
+        return;
+    }
+    
+    printf("Overhead Calibration (subtracted):\n");
+    printf("  Timer: %.1fns per reading pair\n", get_timer_overhead());
+    
+    for (i = 0; i < count; i++) {
+        double emptyMin, emptyMax, registerMin, registerMax;
+        unsigned int sizes = 0;
+        int seen = 0;
+        
+        /* Each kernel once, at its first calibration */
+        for (j = 0; j < i; j++) {
+            if (calibrations[j].width == calibrations[i].width && calibrations[j].stride == calibrations[i].stride) {
+                seen = 1;
+            }
+        }
+        if (seen) {
+            continue;
+        }
+        
+        emptyMin = emptyMax = calibrations[i].emptyNanos;
+        registerMin = registerMax = calibrations[i].registerNanos;
+        
+        for (j = i; j < count; j++) {
+            if (calibrations[j].width != calibrations[i].width || calibrations[j].stride != calibrations[i].stride) {
+                continue;
+            }
+            
+            emptyMin = calibrations[j].emptyNanos < emptyMin ? calibrations[j].emptyNanos : emptyMin;
+            emptyMax = calibrations[j].emptyNanos > emptyMax ? calibrations[j].emptyNanos : emptyMax;
+            registerMin = calibrations[j].registerNanos < registerMin ? calibrations[j].registerNanos : registerMin;
+            registerMax = calibrations[j].registerNanos > registerMax ? calibrations[j].registerNanos : registerMax;
+            sizes++;
+        }
+        
+        printf("  %uB accesses, %uB stride: loop %.3f-%.3fns, register-only %.3f-%.3fns per access (%u sizes)\n",
+            calibrations[i].width, calibrations[i].stride, emptyMin, emptyMax, registerMin, registerMax, sizes);
+    }
+    
     printf("\n");
 }
 
+/* unitfy_data_size rounds down, and bisected sizes are only exact in KB */
+static void format_exact_size(unsigned int size, char* text, size_t length)
+{
+    if (size >= 1024 && size % (1024 * 1024) != 0) {
+        snprintf(text, length, "%uKB", size / 1024);
+    } else {
+        struct size_of_data formatted = unitfy_data_size(size);
+        snprintf(text, length, "%u%s", formatted.quantity, formatted.unit);
+    }
+}
+
+/* --budget SECONDS: the native values as hints, then as much measuring as the budget allows */
+static void print_budgeted_detection(double seconds, unsigned int results[4])
+{
+    const char* names[3] = {"L1 Cache", "L2 Cache", "L3 Cache / SLC"};
+    struct cache_topology native;
+    struct budget_result budget;
+    unsigned int hints[4];
+    char size[32], bound[32];
+    unsigned int i;
+    
+    profile_phase_begin("native hints");
+    get_native_topology(&native);
+    profile_phase_end();
+    
+    hints[0] = native.l1d;
+    hints[1] = native.l2;
+    hints[2] = native.l3;
+    hints[3] = native.lineSize;
+    
+    detect_cache_within_budget(seconds, hints, &budget);
+    
+    printf("=== Budgeted Cache Detection (%.2fs of %.2fs, %u measurements) ===\n\n",
+        budget.seconds, seconds, budget.measurements);
+    
+    for (i = 0; i < 3; i++) {
+        const struct budget_estimate* estimate = &budget.levels[i];
+        
+        format_exact_size(estimate->size, size, sizeof(size));
+        
+        if (estimate->fromHint) {
+            printf("  %-15s %s (native, not reached)\n", names[i], size);
+        } else if (!estimate->size) {
+            printf("  %-15s unknown (not reached)\n", names[i]);
+        } else if (!estimate->upperBound) {
+            printf("  %-15s at least %s, confidence %.2f\n", names[i], size, estimate->confidence);
+        } else {
+            format_exact_size(estimate->upperBound, bound, sizeof(bound));
+            printf("  %-15s %s (%s doesn't fit), confidence %.2f\n", names[i], size, bound, estimate->confidence);
+        }
+        
+        /* Native values stand in for the output, but aren't measurements */
+        results[i] = estimate->fromHint ? 0 : estimate->size;
+    }
+    
+    printf("  %-15s %uB%s\n\n", "Cache Line", budget.lineSize, budget.lineFromHint ? " (native)" : "");
+    results[3] = budget.lineFromHint ? 0 : budget.lineSize;
+}
+
 /* Print architecture-specific info for M1 */
 static void print_m1_info(void)
 {
@@ -314,80 +603,1319 @@ static void print_m1_info(void)
 #endif
 }
 
-int main(int argc, char** argv)
+/* compare <baseline> <current> [--threshold PERCENT] [--alpha LEVEL] */
+static int run_compare(int argc, char** argv)
 {
-    /* Check for --quick flag for native-only output */
-    int quickMode = 0;
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--quick") == 0 || strcmp(argv[i], "-q") == 0) {
-            quickMode = 1;
+    double thresholdPercent = 5.0;
+    double alpha = 0.01;
+    const char* paths[2] = {NULL, NULL};
+    int pathCount = 0;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            thresholdPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+            alpha = atof(argv[++i]);
+        } else if (pathCount < 2) {
+            paths[pathCount++] = argv[i];
         }
     }
     
-    print_m1_info();
+    if (pathCount != 2) {
+        fprintf(stderr, "Usage: %s compare <baseline> <current> [--threshold PERCENT] [--alpha LEVEL]\n", argv[0]);
+        return 2;
+    }
     
-    if (quickMode) {
-        /* Quick mode: only show native values */
-#if PLATFORM_MACOS
-        unsigned int l1i = 0, l1d = 0;
-        unsigned int l2 = 0, l3 = 0;
-        unsigned int line = 0;
-        
-        get_l1_cache_macOS(&l1i, &l1d);
-        l2 = get_l2_cache_macOS();
-        l3 = get_l3_cache_macOS();
-        line = get_cache_line_macOS();
-        
-        printf("Native Cache Information:\n");
-        if (l1d > 0) {
-            struct size_of_data f = unitfy_data_size(l1d);
-            printf("  L1 Data: %u%s\n", f.quantity, f.unit);
+    return compare_result_files(paths[0], paths[1], thresholdPercent, alpha);
+}
+
+/* bench [--dir DIR] [--cpu N] [--huge-pages] [--update-baseline] [--threshold PERCENT] [--alpha LEVEL] */
+static int run_bench_command(int argc, char** argv)
+{
+    struct bench_options options;
+    
+    options.directory = "bench-baselines";
+    options.cpu = 0;
+    options.hugePages = 0;
+    options.updateBaseline = 0;
+    options.thresholdPercent = 5.0;
+    options.alpha = 0.01;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            options.directory = argv[++i];
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            options.cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            options.hugePages = 1;
+        } else if (strcmp(argv[i], "--update-baseline") == 0) {
+            options.updateBaseline = 1;
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            options.thresholdPercent = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+            options.alpha = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s bench [--dir DIR] [--cpu N] [--huge-pages] [--update-baseline] "
+                "[--threshold PERCENT] [--alpha LEVEL]\n", argv[0]);
+            return 2;
         }
-        if (l2 > 0) {
-            struct size_of_data f = unitfy_data_size(l2);
-            printf("  L2: %u%s\n", f.quantity, f.unit);
+    }
+    
+    return run_bench(&options);
+}
+
+/* "32K" -> 32768, "8M" -> 8388608, plain numbers are bytes */
+static unsigned int parse_size(const char* text)
+{
+    char* end;
+    unsigned int size = (unsigned int)strtoul(text, &end, 10);
+    
+    if (*end == 'K' || *end == 'k') {
+        size *= 1024;
+    } else if (*end == 'M' || *end == 'm') {
+        size *= 1024 * 1024;
+    } else if (*end == 'G' || *end == 'g') {
+        size *= 1024 * 1024 * 1024;
+    }
+    
+    return size;
+}
+
+static void print_detected_against_configured(const char* name, unsigned int detected, unsigned int configured)
+{
+    struct size_of_data formattedDetected = unitfy_data_size(detected);
+    struct size_of_data formattedConfigured = unitfy_data_size(configured);
+    
+    printf("  %-10s detected %5u%-2s  configured %5u%-2s\n", name,
+        formattedDetected.quantity, formattedDetected.unit,
+        formattedConfigured.quantity, formattedConfigured.unit);
+}
+
+static void print_icache_curve(const char* title, const struct icache_curve* curve, double ghz)
+{
+    unsigned int i;
+    
+    printf("  %s\n", title);
+    for (i = 0; i < curve->count; i++) {
+        struct size_of_data size = unitfy_data_size(curve->sizes[i]);
+        printf("    %6u%-2s %7.3fns %6.2f cycles\n", size.quantity, size.unit, curve->nanos[i], curve->nanos[i] * ghz);
+    }
+}
+
+static void print_icache_boundary(const char* name, unsigned int size, const char* none)
+{
+    if (size) {
+        struct size_of_data formatted = unitfy_data_size(size);
+        printf("  %s: %u%s\n", name, formatted.quantity, formatted.unit);
+    } else {
+        printf("  %s: %s\n", name, none);
+    }
+}
+
+/* icache: L1I, decoded cache and iTLB reach, measured by running generated code */
+static int run_icache(void)
+{
+    struct icache_result result;
+    const char* failure;
+    
+    if (detect_instruction_caches(&result, &failure) != 0) {
+        fprintf(stderr, "Instruction probe unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Instruction Side (%.2fGHz) ===\n\n", result.ghz);
+    
+    print_icache_curve("Straight no-ops, per instruction:", &result.nops, result.ghz);
+    print_icache_curve("One jump per line, per jump:", &result.lines, result.ghz);
+    print_icache_curve("One jump per page, per jump:", &result.pages, result.ghz);
+    
+    printf("\n");
+    print_icache_boundary("Decoded (uop) Cache Reach", result.uopCacheReach, "no step before the L1I");
+    print_icache_boundary("L1 Instruction Cache", result.l1iSize, "no boundary up to 1MB");
+    print_icache_boundary("iTLB Reach", result.itlbReach, "no boundary up to 4096 pages");
+    if (result.itlbReach) {
+        printf("    (%u pages of %uB)\n", result.itlbReach / result.pageSize, result.pageSize);
+    }
+
+    return 0;
+}
+
+static void print_store_curve(const char* title, const char* unit, const struct store_curve* curve)
+{
+    unsigned int i;
+    
+    printf("  %s\n", title);
+    for (i = 0; i < curve->count; i++) {
+        printf("    %4u %-7s %8.2fns\n", curve->burst[i], unit, curve->nanos[i]);
+    }
+}
+
+static void print_store_knee(const char* name, unsigned int knee, unsigned int limit, const char* unit)
+{
+    if (knee) {
+        printf("  %s: about %u %s\n", name, knee, unit);
+    } else {
+        printf("  %s: no knee up to %u %s\n", name, limit, unit);
+    }
+}
+
+/* stores: store buffer depth and write combining buffer count */
+static int run_stores(void)
+{
+    struct store_result result;
+    const char* failure;
+    
+    if (detect_store_buffers(&result, &failure) != 0) {
+        fprintf(stderr, "Store probes unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Stores in Flight ===\n\n");
+    
+    print_store_curve("Two misses with a burst after each, L1 resident stores, per iteration:", "stores", &result.resident);
+    print_store_curve("The same, stores to fresh lines from memory:", "stores", &result.streaming);
+    print_store_curve("Non-temporal stores to several lines at once, per line:", "lines", &result.combining);
+    
+    /* Entries are two bursts' worth of stores, see stores.h */
+    printf("\n");
+    print_store_knee("Store Buffer", result.storeBufferDepth, result.resident.count ? 2 * result.resident.burst[result.resident.count - 1] : 0, "entries");
+    print_store_knee("Store Buffer, Missing Stores", result.streamingDepth, result.streaming.count ? 2 * result.streaming.burst[result.streaming.count - 1] : 0, "entries");
+    print_store_knee("Write Combining Buffers", result.combiningBuffers, result.combining.count ? result.combining.burst[result.combining.count - 1] : 0, "lines");
+    
+    return 0;
+}
+
+static void print_alignment_offsets(const struct alignment_map* map, enum alignment_placement placement, enum alignment_test test)
+{
+    unsigned int offset, w;
+    
+    printf("  Offset");
+    for (w = 0; w < ALIGNMENT_WIDTHS; w++) {
+        if (map->supported[w]) {
+            printf(" %6uB", map->widths[w]);
         }
-        if (l3 > 0) {
-            struct size_of_data f = unitfy_data_size(l3);
-            printf("  L3/SLC: %u%s\n", f.quantity, f.unit);
+    }
+    printf("\n");
+    
+    for (offset = 0; offset < map->lineSize; offset++) {
+        printf("  %6u", offset);
+        for (w = 0; w < ALIGNMENT_WIDTHS; w++) {
+            if (map->supported[w]) {
+                printf(" %7.2f", map->cycles[w][placement][test][offset]);
+            }
         }
-        if (line > 0) {
-            struct size_of_data f = unitfy_data_size(line);
-            printf("  Cache Line: %u%s\n", f.quantity, f.unit);
+        printf("\n");
+    }
+}
+
+/* alignment [--line BYTES] [--map] */
+static int run_alignment(int argc, char** argv)
+{
+    static const char* testNames[ALIGNMENT_TEST_COUNT] = {
+        "load throughput", "load latency", "store throughput", "store forwarding"
+    };
+    static struct alignment_map map;
+    unsigned int lineSize = 0;
+    int printMap = 0;
+    unsigned int w, test, kind;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--line") == 0 && i + 1 < argc) {
+            lineSize = parse_size(argv[++i]);
+        } else if (strcmp(argv[i], "--map") == 0) {
+            printMap = 1;
+        } else {
+            fprintf(stderr, "Usage: %s alignment [--line BYTES] [--map]\n", argv[0]);
+            return 2;
         }
-#elif PLATFORM_LINUX
-        unsigned int l1i = 0, l1d = 0;
-        unsigned int l2 = 0, l3 = 0;
-        unsigned int line = 0;
-        
-        get_l1_cache_linux(&l1i, &l1d);
-        l2 = get_l2_cache_linux();
-        l3 = get_l3_cache_linux();
-        line = get_cache_line_linux();
+    }
+    
+    if (lineSize == 0) {
+        struct cache_session* session = create_cache_session();
         
-        printf("Native Cache Information:\n");
-        if (l1d > 0) {
-            struct size_of_data f = unitfy_data_size(l1d);
-            printf("  L1 Data: %u%s\n", f.quantity, f.unit);
-        }
-        if (l2 > 0) {
-            struct size_of_data f = unitfy_data_size(l2);
-            printf("  L2: %u%s\n", f.quantity, f.unit);
+        lineSize = cache_session_line_size(session);
+        free_cache_session(session);
+    }
+    
+    if (measure_alignment_map(lineSize, &map) != 0) {
+        fprintf(stderr, "Alignment map unavailable: needs x86-64 and a power of two line of 16 to %u bytes (got %u)\n",
+                ALIGNMENT_MAX_LINE, lineSize);
+        return 1;
+    }
+    
+    printf("=== Misaligned Access Cost (%uB line, cycles per access at %.2fGHz) ===\n\n", map.lineSize, map.ghz);
+    printf("  Width  Test              Aligned  Misaligned  Line split  Page split\n");
+    
+    for (w = 0; w < ALIGNMENT_WIDTHS; w++) {
+        if (!map.supported[w]) {
+            printf("  %4uB  (not supported by this CPU)\n", map.widths[w]);
+            continue;
         }
-        if (l3 > 0) {
-            struct size_of_data f = unitfy_data_size(l3);
-            printf("  L3: %u%s\n", f.quantity, f.unit);
+        
+        for (test = 0; test < ALIGNMENT_TEST_COUNT; test++) {
+            printf("  %4uB  %-16s", map.widths[w], testNames[test]);
+            for (kind = 0; kind < ALIGNMENT_KIND_COUNT; kind++) {
+                double worst = worst_alignment_cost(&map, w, (enum alignment_test)test, (enum alignment_kind)kind);
+                
+                if (worst < 0) {
+                    printf("  %10s", "-");
+                } else {
+                    printf("  %10.2f", worst);
+                }
+            }
+            printf("\n");
         }
-        if (line > 0) {
-            struct size_of_data f = unitfy_data_size(line);
-            printf("  Cache Line: %u%s\n", f.quantity, f.unit);
+    }
+    
+    printf("\n  Misaligned and split columns are the worst offset of their kind.\n");
+    
+    if (printMap) {
+        for (test = 0; test < ALIGNMENT_TEST_COUNT; test++) {
+            printf("\n  %s, middle of a page:\n", testNames[test]);
+            print_alignment_offsets(&map, ALIGNMENT_MID_PAGE, (enum alignment_test)test);
+            printf("\n  %s, last line of a page:\n", testNames[test]);
+            print_alignment_offsets(&map, ALIGNMENT_PAGE_END, (enum alignment_test)test);
         }
-#else
-        printf("Quick mode not supported on this platform\n");
-#endif
-    } else {
-        /* Full mode: show both native and timing-based results */
-        print_cache_info();
+    }
+    
+    return 0;
+}
+
+/* Offending runs of points, each point "step" bytes of distance or offset */
+static void print_offending_ranges(const char* name, const char* what, const double* cycles, unsigned int count, unsigned int step)
+{
+    struct offending_range ranges[8];
+    unsigned int found = find_offending_ranges(cycles, count, ranges, 8);
+    unsigned int i;
+    
+    if (found == 0) {
+        printf("  %s: none, every %s within %.0f%% of %.2f cycles\n", name, what, SIGNIFICANT_RISE * 100, sample_median(cycles, count));
+        return;
+    }
+    
+    printf("  %s:\n", name);
+    for (i = 0; i < found && i < 8; i++) {
+        printf("    %s %u-%u: up to %.2f cycles, %.1fx the typical %.2f\n", what,
+               ranges[i].first * step, ranges[i].last * step, ranges[i].worst, ranges[i].worst / ranges[i].typical, ranges[i].typical);
+    }
+    if (found > 8) {
+        printf("    ... and %u more\n", found - 8);
+    }
+}
+
+/* aliasing [--line BYTES]: 4K aliasing distances and L1 bank conflicts */
+static int run_aliasing(int argc, char** argv)
+{
+    struct aliasing_result result;
+    const char* failure;
+    unsigned int lineSize = 0;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--line") == 0 && i + 1 < argc) {
+            lineSize = parse_size(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s aliasing [--line BYTES]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    if (lineSize == 0) {
+        struct cache_session* session = create_cache_session();
+        
+        lineSize = cache_session_line_size(session);
+        free_cache_session(session);
+    }
+    
+    if (measure_aliasing(lineSize, &result, &failure) != 0) {
+        fprintf(stderr, "Aliasing probes failed: %s (got %u)\n", failure, lineSize);
+        return 1;
+    }
+    
+    printf("=== L1 Address Conflicts (%uB line, cycles at %.2fGHz) ===\n\n", result.lineSize, result.ghz);
+    
+    print_offending_ranges("4K Aliasing (load minus store, modulo 4096)", "distance", result.alias, ALIASING_POINTS, ALIASING_STEP);
+    print_offending_ranges("Bank Conflicts, Same Line", "offset", result.sameLine, result.bankPoints, BANK_STEP);
+    print_offending_ranges("Bank Conflicts, Other Line", "offset", result.otherLine, result.bankPoints, BANK_STEP);
+    
+    return 0;
+}
+
+/* dram [--llc SIZE]: row buffer hits and conflicts, and the stride channels and banks interleave at */
+static int run_dram(int argc, char** argv)
+{
+    struct dram_result result;
+    const char* failure;
+    unsigned int llcSize = 0;
+    unsigned int i;
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--llc") == 0 && arg + 1 < argc) {
+            llcSize = parse_size(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s dram [--llc SIZE]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    if (llcSize == 0) {
+        struct cache_topology topology;
+        
+        get_native_topology(&topology);
+        llcSize = topology.l3 ? topology.l3 : topology.l2;
+    }
+    
+    if (measure_dram(llcSize, &result, &failure) != 0) {
+        fprintf(stderr, "DRAM probe unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== DRAM (%uMB buffer%s) ===\n\n", (unsigned int)(result.bufferSize / (1024 * 1024)),
+           result.hugePages ? ", transparent huge pages" : "");
+    
+    printf("  Row Buffer, per access with its flush (%u random addresses):\n", result.pairs);
+    printf("    Page open (row hit): %.1fns\n", result.rowHitNanos);
+    if (result.conflicts) {
+        printf("    Page conflict: %.1fns, %.1fns more, for %u addresses (1 in %.0f)\n", result.rowConflictNanos,
+               result.rowConflictNanos - result.rowHitNanos, result.conflicts, (double)result.pairs / result.conflicts);
+    } else {
+        printf("    Page conflict: none slower by %.0f%%\n", SIGNIFICANT_RISE * 100);
+    }
+    
+    printf("\n  Strided Loads, per line (stride, then stride plus a line):\n");
+    for (i = 0; i < result.strideCount; i++) {
+        struct size_of_data formatted = unitfy_data_size(result.strides[i]);
+        
+        printf("    %4u%-2s %8.2fns %8.2fns  %.2fx\n", formatted.quantity, formatted.unit,
+               result.aligned[i], result.offset[i], result.aligned[i] / result.offset[i]);
+    }
+    
+    printf("\n");
+    if (result.interleavePeriod) {
+        struct size_of_data formatted = unitfy_data_size(result.interleavePeriod);
+        
+        printf("  Interleaving Period: %u%s (strides that are multiples of it share a channel or bank)\n",
+               formatted.quantity, formatted.unit);
+    } else {
+        printf("  Interleaving Period: no power of two stride up to the buffer's limit is singled out\n");
+    }
+    
+    return 0;
+}
+
+/* faults [--threads N]: first-touch cost of fresh memory, backed four ways, on 1 to N threads */
+static int run_faults(int argc, char** argv)
+{
+    struct fault_result result;
+    const char* failure;
+    unsigned int maxThreads = 0;
+    unsigned int method, i;
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc) {
+            maxThreads = (unsigned int)atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s faults [--threads N]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    if (measure_page_faults(maxThreads, &result, &failure) != 0) {
+        fprintf(stderr, "Page fault probe unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== First Touch (%uMB region, split between threads) ===\n", (unsigned int)(result.regionSize / (1024 * 1024)));
+    
+    for (method = 0; method < FAULT_METHOD_COUNT; method++) {
+        const struct fault_curve* curve = &result.curves[method];
+        
+        printf("\n  %s:\n", fault_method_name((enum fault_method)method));
+        if (!curve->supported) {
+            printf("    not supported by this kernel\n");
+            continue;
+        }
+        
+        printf("    Threads  ns/4KB page      GB/s     Faults  ns/fault  Faults/s\n");
+        for (i = 0; i < curve->count; i++) {
+            const struct fault_point* point = &curve->points[i];
+            
+            printf("    %7u %12.1f %9.2f %10.0f", point->threads, point->nanosPerPage, 4096 / point->nanosPerPage, point->faults);
+            if (point->faults > 0) {
+                printf(" %9.1f %9.0f\n", point->nanosPerFault, point->faultsPerSecond);
+            } else {
+                printf(" %9s %9s\n", "-", "-");
+            }
+        }
+    }
+    
+    printf("\n");
+    if (result.ceilingThreads) {
+        printf("  Fault Rate Ceiling: about %.2fM faults/s, reached at %u threads\n",
+               result.ceilingFaultsPerSecond / 1e6, result.ceilingThreads);
+    } else if (result.cpus < 2) {
+        printf("  Fault Rate Ceiling: can't tell on one CPU\n");
+    } else {
+        printf("  Fault Rate Ceiling: none, faults/s kept scaling up to %u threads\n",
+               result.curves[FAULT_TOUCH_4K].points[result.curves[FAULT_TOUCH_4K].count - 1].threads);
+    }
+    
+    return 0;
+}
+
+/* allocator [--line BYTES]: where the system allocator puts objects relative to lines, and what sharing one costs */
+static int run_allocator(int argc, char** argv)
+{
+    static struct allocator_result result;
+    unsigned int lineSize = 0;
+    unsigned int s, kind, bucket;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--line") == 0 && i + 1 < argc) {
+            lineSize = parse_size(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s allocator [--line BYTES]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    if (lineSize == 0) {
+        struct cache_session* session = create_cache_session();
+        
+        lineSize = cache_session_line_size(session);
+        free_cache_session(session);
+    }
+    
+    if (measure_allocator(lineSize, &result) != 0) {
+        fprintf(stderr, "Allocator probe needs a power of two line of 16 to 1024 bytes (got %u)\n", lineSize);
+        return 1;
+    }
+    
+    printf("=== Allocator Placement (%uB line) ===\n\n", result.lineSize);
+    printf("  Alignment is the share of objects on each boundary, the largest that divides their address.\n\n");
+    
+    printf("  %5s  %-15s", "Size", "Allocator");
+    for (bucket = 0; bucket + 1 < result.buckets; bucket++) {
+        printf(" %5uB", 8u << bucket);
+    }
+    printf("   Line  Straddling  Spacing  ns/object\n");
+    
+    for (s = 0; s < ALLOCATOR_SIZES; s++) {
+        for (kind = 0; kind < ALLOCATOR_KIND_COUNT; kind++) {
+            const struct allocation_stats* stats = &result.stats[s][kind];
+            
+            printf("  %4uB  %-15s", result.sizes[s], allocator_kind_name((enum allocator_kind)kind));
+            if (!stats->supported) {
+                printf(" (not available)\n");
+                continue;
+            }
+            
+            for (bucket = 0; bucket < result.buckets; bucket++) {
+                printf(" %5.0f%%", stats->alignment[bucket] * 100);
+            }
+            printf(" %10.0f%% %7.0fB %10.1f\n", stats->straddling * 100, stats->spacing, stats->nanos);
+        }
+    }
+    
+    printf("\n  Two Threads Incrementing Their Own Counter, per increment:\n");
+    if (result.packedNanos > 0) {
+        printf("    Neighbours from malloc: %.2fns%s\n", result.packedNanos,
+               result.sharedLine ? " (one line)" : " (malloc never put two in one line)");
+    }
+    if (result.paddedNanos > 0) {
+        printf("    A line each: %.2fns\n", result.paddedNanos);
+    }
+    if (result.packedNanos > 0 && result.paddedNanos > 0) {
+        printf("    Sharing costs %.1fx%s\n", result.packedNanos / result.paddedNanos,
+               get_cpu_count() < 2 ? " (one CPU: the threads take turns, so nothing is really shared)" : "");
+    } else {
+        printf("    not available\n");
+    }
+    
+    return 0;
+}
+
+/* "8,8,4,16" -> {8, 8, 4, 16}. Returns how many there were, or -1 if more than "max". */
+static int parse_list(const char* text, unsigned int* values, unsigned int max)
+{
+    unsigned int count = 0;
+    
+    while (*text) {
+        char* end;
+        
+        if (count == max) {
+            return -1;
+        }
+        values[count++] = (unsigned int)strtoul(text, &end, 10);
+        text = *end == ',' ? end + 1 : end;
+        if (end == text && *text) {
+            return -1;
+        }
+    }
+    
+    return (int)count;
+}
+
+/*
+    layout --fields SIZE,SIZE... --hot INDEX,INDEX... [--block N] [--line BYTES]
+    Whether splitting a struct pays, on paper and measured at every level
+*/
+static int run_layout(int argc, char** argv)
+{
+    struct struct_description description;
+    struct layout_analysis analysis;
+    struct layout_benchmark benchmark;
+    struct cache_session* session;
+    unsigned int hot[LAYOUT_MAX_FIELDS];
+    unsigned int levels[3];
+    unsigned int lineSize = 0, blockLength = 0;
+    int fields = 0, hotCount = 0;
+    unsigned int i, kind, best;
+    
+    memset(&description, 0, sizeof(description));
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--fields") == 0 && arg + 1 < argc) {
+            fields = parse_list(argv[++arg], description.sizes, LAYOUT_MAX_FIELDS);
+        } else if (strcmp(argv[arg], "--hot") == 0 && arg + 1 < argc) {
+            hotCount = parse_list(argv[++arg], hot, LAYOUT_MAX_FIELDS);
+        } else if (strcmp(argv[arg], "--block") == 0 && arg + 1 < argc) {
+            char* end;
+            long value = strtol(argv[++arg], &end, 10);
+            
+            if (*end != '\0' || end == argv[arg] || value < 0 || value > LAYOUT_MAX_BLOCK) {
+                fields = -1;
+                break;
+            }
+            blockLength = (unsigned int)value;
+        } else if (strcmp(argv[arg], "--line") == 0 && arg + 1 < argc) {
+            lineSize = parse_size(argv[++arg]);
+        } else {
+            fields = -1;
+            break;
+        }
+    }
+    
+    for (i = 0; fields > 0 && hotCount > 0 && i < (unsigned int)hotCount; i++) {
+        if (hot[i] >= (unsigned int)fields) {
+            fields = -1;
+            break;
+        }
+        description.hot[hot[i]] = 1;
+    }
+    
+    if (fields <= 0 || hotCount <= 0) {
+        fprintf(stderr, "Usage: %s layout --fields SIZE,SIZE... --hot INDEX,INDEX... [--block N] [--line BYTES]\n"
+                "  Up to %u fields of 1 to %u bytes; hot fields by index, from 0\n"
+                "  Blocks of 1 to %u elements, or 0 for a line's worth of the smallest hot field\n",
+                argv[0], LAYOUT_MAX_FIELDS, LAYOUT_MAX_FIELD_SIZE, LAYOUT_MAX_BLOCK);
+        return 2;
+    }
+    description.count = (unsigned int)fields;
+    
+    session = create_cache_session();
+    if (lineSize == 0) {
+        lineSize = cache_session_line_size(session);
+    }
+    
+    if (analyse_layouts(&description, lineSize, blockLength, &analysis) != 0) {
+        fprintf(stderr, "Can't lay that out: fields must be 1 to %u bytes, with a power of two line (got %u)\n",
+                LAYOUT_MAX_FIELD_SIZE, lineSize);
+        free_cache_session(session);
+        return 1;
+    }
+    
+    for (i = 0; i < 3; i++) {
+        levels[i] = cache_session_level(session, i + 1);
+    }
+    free_cache_session(session);
+    
+    printf("=== Struct Layout (%uB struct, %uB hot, %uB line, AoSoA blocks of %u) ===\n\n",
+           analysis.structSize, analysis.hotBytes, analysis.lineSize, analysis.blockLength);
+    
+    printf("  Layout  Lines/element  Hot bytes of lines read\n");
+    for (kind = 0; kind < LAYOUT_KIND_COUNT; kind++) {
+        printf("  %-6s %14.3f %23.0f%%\n", layout_kind_name((enum layout_kind)kind),
+               analysis.linesPerElement[kind], analysis.usefulFraction[kind] * 100);
+    }
+    
+    if (benchmark_layouts(&description, &analysis, levels, &benchmark) != 0) {
+        fprintf(stderr, "Layout benchmark failed: out of memory\n");
+        return 1;
+    }
+    
+    printf("\n  Working set            ns/element (speed-up over AoS)\n");
+    for (i = 0; i < benchmark.count; i++) {
+        const struct layout_target* target = &benchmark.targets[i];
+        struct size_of_data formatted = unitfy_data_size((unsigned int)(target->elements * analysis.structSize));
+        char name[32];
+        
+        if (target->level) {
+            snprintf(name, sizeof(name), "L%u, %u%s", target->level, formatted.quantity, formatted.unit);
+        } else {
+            snprintf(name, sizeof(name), "Memory, %u%s", formatted.quantity, formatted.unit);
+        }
+        
+        printf("  %-18s", name);
+        for (kind = 0; kind < LAYOUT_KIND_COUNT; kind++) {
+            printf("  %s %.2f (%.2fx)", layout_kind_name((enum layout_kind)kind), target->nanos[kind],
+                   target->nanos[LAYOUT_AOS] / target->nanos[kind]);
+        }
+        printf("\n");
+    }
+    
+    /* Advice from memory, where layout matters most; a split has to win by SIGNIFICANT_RISE to be worth it */
+    const struct layout_target* memory = &benchmark.targets[benchmark.count - 1];
+    
+    best = LAYOUT_AOS;
+    for (kind = 1; kind < LAYOUT_KIND_COUNT; kind++) {
+        if (memory->nanos[kind] < memory->nanos[best]) {
+            best = kind;
+        }
+    }
+    
+    printf("\n");
+    if (best != LAYOUT_AOS && memory->nanos[LAYOUT_AOS] > memory->nanos[best] * (1 + SIGNIFICANT_RISE)) {
+        printf("  Advice: split it, %s is %.2fx faster from memory\n", layout_kind_name((enum layout_kind)best),
+               memory->nanos[LAYOUT_AOS] / memory->nanos[best]);
+    } else {
+        printf("  Advice: keep it as it is, no split is %.0f%% faster from memory\n", SIGNIFICANT_RISE * 100);
+    }
+    
+    return 0;
+}
+
+/* hash [--line BYTES]: lookup cost of three open addressing schemes, tables sized to each level */
+static int run_hash(int argc, char** argv)
+{
+    static struct hash_result result;
+    struct cache_session* session;
+    unsigned int levels[3];
+    unsigned int lineSize = 0;
+    unsigned int i, scheme, width, load;
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--line") == 0 && arg + 1 < argc) {
+            lineSize = parse_size(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s hash [--line BYTES]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    session = create_cache_session();
+    if (lineSize == 0) {
+        lineSize = cache_session_line_size(session);
+    }
+    for (i = 0; i < 3; i++) {
+        levels[i] = cache_session_level(session, i + 1);
+    }
+    free_cache_session(session);
+    
+    if (measure_hash_tables(lineSize, levels, &result) != 0) {
+        fprintf(stderr, "Hash table probe needs a power of two line of 64 to 1024 bytes (got %u) and memory for its tables\n", lineSize);
+        return 1;
+    }
+    
+    printf("=== Hash Table Probes (%uB line, lookups half present, half absent keys) ===\n", result.lineSize);
+    
+    for (i = 0; i < result.count; i++) {
+        const struct hash_target* target = &result.targets[i];
+        struct size_of_data formatted = unitfy_data_size((unsigned int)target->tableBytes);
+        const struct hash_point* best = NULL;
+        unsigned int bestScheme = 0, bestWidth = 0;
+        
+        if (target->level) {
+            printf("\n  L%u, %u%s table\n", target->level, formatted.quantity, formatted.unit);
+        } else {
+            printf("\n  Memory, %u%s table\n", formatted.quantity, formatted.unit);
+        }
+        
+        printf("    %-7s %6s", "", "");
+        for (load = 0; load < HASH_LOADS; load++) {
+            printf("  %15.0f%% full", result.loads[load] * 100);
+        }
+        printf("\n    %-7s %6s", "Scheme", "Bucket");
+        for (load = 0; load < HASH_LOADS; load++) {
+            printf("  %8s %5s %6s", "M/s", "Lines", "Misses");
+        }
+        printf("\n");
+        
+        for (scheme = 0; scheme < HASH_SCHEME_COUNT; scheme++) {
+            for (width = 0; width < HASH_WIDTHS; width++) {
+                printf("    %-7s %5uB", hash_scheme_name((enum hash_scheme)scheme), result.bucketBytes[width]);
+                
+                for (load = 0; load < HASH_LOADS; load++) {
+                    const struct hash_point* point = &target->points[scheme][width][load];
+                    
+                    if (!point->supported) {
+                        printf("  %8s %5s %6s", "full", "-", "-");
+                        continue;
+                    }
+                    
+                    printf("  %8.1f %5.2f", point->lookupsPerSecond / 1e6, point->linesPerLookup);
+                    if (point->missesPerLookup >= 0) {
+                        printf(" %6.2f", point->missesPerLookup);
+                    } else {
+                        printf(" %6s", "-");
+                    }
+                }
+                printf("\n");
+            }
+        }
+        
+        /* The highest load is where the schemes differ most */
+        for (scheme = 0; scheme < HASH_SCHEME_COUNT; scheme++) {
+            for (width = 0; width < HASH_WIDTHS; width++) {
+                const struct hash_point* point = &target->points[scheme][width][HASH_LOADS - 1];
+                
+                if (point->supported && (!best || point->lookupsPerSecond > best->lookupsPerSecond)) {
+                    best = point;
+                    bestScheme = scheme;
+                    bestWidth = width;
+                }
+            }
+        }
+        if (best) {
+            printf("    Fastest at %.0f%% full: %s, %uB buckets, %.1fM lookups/s\n", result.loads[HASH_LOADS - 1] * 100,
+                   hash_scheme_name((enum hash_scheme)bestScheme), result.bucketBytes[bestWidth], best->lookupsPerSecond / 1e6);
+        }
+    }
+    
+    if (!result.counted) {
+        printf("\n  Misses need perf's cache miss event, which isn't available here (VM, or perf_event_paranoid)\n");
+    }
+    
+    return 0;
+}
+
+/* prefetch [--line BYTES]: the distance and hint software prefetches should use, beyond each level */
+static int run_prefetch(int argc, char** argv)
+{
+    static struct prefetch_result result;
+    struct cache_session* session;
+    const char* failure = NULL;
+    unsigned int levels[3];
+    unsigned int lineSize = 0;
+    unsigned int i, pattern, hint, d;
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--line") == 0 && arg + 1 < argc) {
+            lineSize = parse_size(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s prefetch [--line BYTES]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    session = create_cache_session();
+    if (lineSize == 0) {
+        lineSize = cache_session_line_size(session);
+    }
+    for (i = 0; i < 3; i++) {
+        levels[i] = cache_session_level(session, i + 1);
+    }
+    free_cache_session(session);
+    
+    if (tune_prefetch(lineSize, levels, &result, &failure) != 0) {
+        fprintf(stderr, "Prefetch tuning failed: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Software Prefetch Tuning (%uB line, ns/element by hint and distance in elements) ===\n", result.lineSize);
+    
+    for (i = 0; i < result.count; i++) {
+        const struct prefetch_target* target = &result.targets[i];
+        struct size_of_data formatted = unitfy_data_size((unsigned int)target->bytes);
+        
+        printf("\n  Beyond L%u, %u%s working set\n", target->level, formatted.quantity, formatted.unit);
+        
+        for (pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+            const struct prefetch_sweep* sweep = &target->sweeps[pattern];
+            
+            printf("    %-8s none %.2f\n", prefetch_pattern_name((enum prefetch_pattern)pattern), sweep->baseline);
+            printf("    %-8s", "");
+            for (d = 0; d < PREFETCH_DISTANCES; d++) {
+                printf(" %6u", result.distances[d]);
+            }
+            printf("\n");
+            
+            for (hint = 0; hint < HINT_COUNT; hint++) {
+                printf("      %-6s", prefetch_hint_name((enum prefetch_hint)hint));
+                for (d = 0; d < PREFETCH_DISTANCES; d++) {
+                    printf(" %6.2f", sweep->nanos[hint][d]);
+                }
+                printf("\n");
+            }
+        }
+    }
+    
+    /* A prefetch has to win by SIGNIFICANT_RISE to be worth the instructions and the tuning */
+    printf("\n  Best distance in elements (lines), speed-up over no prefetch:\n");
+    printf("    %-6s", "Level");
+    for (pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+        printf(pattern + 1 < PATTERN_COUNT ? "  %-22s" : "  %s", prefetch_pattern_name((enum prefetch_pattern)pattern));
+    }
+    printf("\n");
+    
+    for (i = 0; i < result.count; i++) {
+        const struct prefetch_target* target = &result.targets[i];
+        
+        printf("    L%-5u", target->level);
+        for (pattern = 0; pattern < PATTERN_COUNT; pattern++) {
+            const struct prefetch_sweep* sweep = &target->sweeps[pattern];
+            const unsigned int distance = result.distances[sweep->bestDistance];
+            char cell[48];
+            
+            if (sweep->speedUp > 1 + SIGNIFICANT_RISE) {
+                snprintf(cell, sizeof(cell), "%s %u (%u) %.2fx", prefetch_hint_name(sweep->bestHint),
+                         distance, distance * result.linesPerElement[pattern], sweep->speedUp);
+            } else {
+                snprintf(cell, sizeof(cell), "none, at best %.2fx", sweep->speedUp);
+            }
+            printf(pattern + 1 < PATTERN_COUNT ? "  %-22s" : "  %s", cell);
+        }
+        printf("\n");
+    }
+    
+    return 0;
+}
+
+/* coherence: load and store latency to lines another CPU left in each MESI state */
+static int run_coherence(void)
+{
+    static struct coherence_result result;
+    const char* failure = NULL;
+    unsigned int relation, state;
+    
+    if (measure_coherence(&result, &failure) != 0) {
+        fprintf(stderr, "Coherence probe not available: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Coherence State Latency (measured on CPU %d, load / store+mfence in ns) ===\n\n", result.measurer);
+    
+    printf("  %-13s %-13s", "Prepared by", "CPUs");
+    for (state = 0; state < STATE_COUNT; state++) {
+        printf(" %15s", coherence_state_name((enum coherence_state)state));
+    }
+    printf("\n");
+    
+    for (relation = 0; relation < RELATION_COUNT; relation++) {
+        char cpus[32];
+        
+        printf("  %-13s", coherence_relation_name((enum coherence_relation)relation));
+        if (result.owners[relation] < 0) {
+            printf(" (none)\n");
+            continue;
+        }
+        
+        if (result.helpers[relation] >= 0) {
+            snprintf(cpus, sizeof(cpus), "%d, helper %d", result.owners[relation], result.helpers[relation]);
+        } else {
+            snprintf(cpus, sizeof(cpus), "%d", result.owners[relation]);
+        }
+        printf(" %-13s", cpus);
+        
+        for (state = 0; state < STATE_COUNT; state++) {
+            const struct coherence_cell* cell = &result.cells[relation][state];
+            char both[32];
+            
+            if (cell->supported) {
+                snprintf(both, sizeof(both), "%.1f / %.1f", cell->loadNanos, cell->storeNanos);
+            } else {
+                snprintf(both, sizeof(both), "-");
+            }
+            printf(" %15s", both);
+        }
+        printf("\n");
+    }
+    
+    if (result.helpers[RELATION_SAME_CPU] < 0) {
+        printf("\n  Shared needs a third CPU to hold the other copy\n");
+    }
+    
+    return 0;
+}
+
+/* flush: what clflush, clflushopt and clwb cost per line, clean and dirty */
+static int run_flush(void)
+{
+    struct flush_result result;
+    const char* failure = NULL;
+    unsigned int instruction;
+    
+    if (measure_flush_costs(&result, &failure) != 0) {
+        fprintf(stderr, "Flush probe unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Flush Instructions (ns per line, over %u lines) ===\n\n", result.lines);
+    printf("  %-11s %21s %21s\n", "", "Latency (with mfence)", "Throughput");
+    printf("  %-11s %10s %10s %10s %10s\n", "Instruction", "Clean", "Dirty", "Clean", "Dirty");
+    
+    for (instruction = 0; instruction < FLUSH_INSTRUCTION_COUNT; instruction++) {
+        const struct flush_cost* cost = &result.costs[instruction];
+        
+        printf("  %-11s", flush_instruction_name((enum flush_instruction)instruction));
+        if (!cost->supported) {
+            printf(" (not supported by this CPU)\n");
+            continue;
+        }
+        printf(" %10.1f %10.1f %10.1f %10.1f\n", cost->cleanLatency, cost->dirtyLatency,
+               cost->cleanThroughput, cost->dirtyThroughput);
+    }
+    
+    return 0;
+}
+
+/* cold: latency per level from a flushed start, next to the same level's warm chase */
+static int run_cold(void)
+{
+    struct cold_result result;
+    struct cache_session* session;
+    const char* failure = NULL;
+    unsigned int levels[3];
+    double warm[3];
+    double cycles;
+    unsigned int i;
+    
+    session = create_cache_session();
+    for (i = 0; i < 3; i++) {
+        levels[i] = cache_session_level(session, i + 1);
+        if (cache_session_level_latency(session, i + 1, &warm[i], &cycles) != 0) {
+            warm[i] = 0;
+        }
+    }
+    free_cache_session(session);
+    
+    if (measure_cold_latency(levels, &result, &failure) != 0) {
+        fprintf(stderr, "Cold measurement unavailable: %s\n", failure);
+        return 1;
+    }
+    
+    printf("=== Cold Latency (%u lines flushed with %s before every chase) ===\n\n",
+           result.chainLines, flush_instruction_name(result.evictor));
+    printf("  %-8s %10s %10s\n", "Level", "Cold", "Warm");
+    
+    for (i = 0; i < result.count; i++) {
+        const struct cold_level* level = &result.levels[i];
+        
+        if (level->level == 0) {
+            printf("  %-8s %8.2fns %10s\n", "Memory", level->nanos, "-");
+        } else if (warm[level->level - 1] > 0) {
+            printf("  L%-7u %8.2fns %8.2fns\n", level->level, level->nanos, warm[level->level - 1]);
+        } else {
+            printf("  L%-7u %8.2fns %10s\n", level->level, level->nanos, "-");
+        }
+    }
+    
+    return 0;
+}
+
+/*
+    simulate [--line BYTES] [--level SIZE:WAYS:LATENCY]... [--memory CYCLES]
+             [--tlb ENTRIES:WAYS:PAGE:PENALTY] [--plru] [--ghz FREQUENCY]
+*/
+static int run_simulate(int argc, char** argv)
+{
+    struct sim_config config;
+    struct cache_sim* sim;
+    unsigned int results[4];
+    unsigned int i;
+    
+    memset(&config, 0, sizeof(config));
+    config.lineSize = 64;
+    config.memoryLatency = 200;
+    config.replacement = SIM_REPLACEMENT_LRU;
+    config.frequencyGHz = 3.0;
+    
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--line") == 0 && arg + 1 < argc) {
+            config.lineSize = parse_size(argv[++arg]);
+        } else if (strcmp(argv[arg], "--level") == 0 && arg + 1 < argc && config.levelCount < SIM_MAX_LEVELS) {
+            struct sim_level_config* level = &config.levels[config.levelCount++];
+            char size[32];
+            
+            if (sscanf(argv[++arg], "%31[^:]:%u:%u", size, &level->ways, &level->latency) != 3) {
+                fprintf(stderr, "--level wants SIZE:WAYS:LATENCY, got %s\n", argv[arg]);
+                return 2;
+            }
+            level->size = parse_size(size);
+        } else if (strcmp(argv[arg], "--memory") == 0 && arg + 1 < argc) {
+            config.memoryLatency = (unsigned int)atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--tlb") == 0 && arg + 1 < argc) {
+            char page[32];
+            
+            if (sscanf(argv[++arg], "%u:%u:%31[^:]:%u", &config.tlbEntries, &config.tlbWays, page, &config.tlbMissLatency) != 4) {
+                fprintf(stderr, "--tlb wants ENTRIES:WAYS:PAGE:PENALTY, got %s\n", argv[arg]);
+                return 2;
+            }
+            config.pageSize = parse_size(page);
+        } else if (strcmp(argv[arg], "--plru") == 0) {
+            config.replacement = SIM_REPLACEMENT_PLRU;
+        } else if (strcmp(argv[arg], "--ghz") == 0 && arg + 1 < argc) {
+            config.frequencyGHz = atof(argv[++arg]);
+        } else {
+            fprintf(stderr, "Usage: %s simulate [--line BYTES] [--level SIZE:WAYS:LATENCY]... [--memory CYCLES]\n"
+                "       [--tlb ENTRIES:WAYS:PAGE:PENALTY] [--plru] [--ghz FREQUENCY]\n", argv[0]);
+            return 2;
+        }
+    }
+    
+    /* A generic desktop part unless told otherwise */
+    if (config.levelCount == 0) {
+        const struct sim_level_config defaults[] = {
+            {32 * 1024, 8, 4},
+            {1024 * 1024, 16, 14},
+            {32 * 1024 * 1024, 16, 50}
+        };
+        
+        config.levelCount = 3;
+        memcpy(config.levels, defaults, sizeof(defaults));
+    }
+    
+    sim = create_cache_sim(&config);
+    if (!sim) {
+        fprintf(stderr, "Invalid simulator configuration\n");
+        return 2;
+    }
+    
+    set_cache_simulator(sim);
+    get_all_cache_sizes(results);
+    set_cache_simulator(NULL);
+    free_cache_sim(sim);
+    
+    printf("=== Simulated Cache Hierarchy ===\n\n");
+    for (i = 0; i < 3; i++) {
+        char name[8];
+        
+        snprintf(name, sizeof(name), "L%u", i + 1);
+        print_detected_against_configured(name, results[i], i < config.levelCount ? config.levels[i].size : 0);
+    }
+    print_detected_against_configured("Cache Line", results[3], config.lineSize);
+    
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    /* Check for --quick flag for native-only output */
+    int quickMode = 0;
+    int publishMode = 0;
+    int streamMode = 0;
+    const char* savePath = NULL;
+    unsigned int trials = 0;
+    double budgetSeconds = 0;
+    struct result_set* recorded = NULL;
+    unsigned int results[4] = {0, 0, 0, 0};
+    
+    if (argc > 1 && strcmp(argv[1], "compare") == 0) {
+        return run_compare(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return run_bench_command(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "simulate") == 0) {
+        return run_simulate(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "selftest") == 0) {
+        return run_selftest();
+    }
+    if (argc > 1 && strcmp(argv[1], "icache") == 0) {
+        return run_icache();
+    }
+    if (argc > 1 && strcmp(argv[1], "stores") == 0) {
+        return run_stores();
+    }
+    if (argc > 1 && strcmp(argv[1], "alignment") == 0) {
+        return run_alignment(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "aliasing") == 0) {
+        return run_aliasing(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "dram") == 0) {
+        return run_dram(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "faults") == 0) {
+        return run_faults(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "allocator") == 0) {
+        return run_allocator(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "layout") == 0) {
+        return run_layout(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "hash") == 0) {
+        return run_hash(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "prefetch") == 0) {
+        return run_prefetch(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "coherence") == 0) {
+        return run_coherence();
+    }
+    if (argc > 1 && strcmp(argv[1], "flush") == 0) {
+        return run_flush();
+    }
+    if (argc > 1 && strcmp(argv[1], "cold") == 0) {
+        return run_cold();
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0 || strcmp(argv[i], "-q") == 0) {
+            quickMode = 1;
+        } else if (strcmp(argv[i], "--publish") == 0) {
+            publishMode = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            streamMode = 1;
+        } else if (strcmp(argv[i], "--show-published") == 0) {
+            return print_published_topology();
+        } else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            savePath = argv[++i];
+        } else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc) {
+            trials = (unsigned int)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            enable_profiling();
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            budgetSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            if (set_cache_access_width((unsigned int)atoi(argv[++i])) != 0) {
+                fprintf(stderr, "--width wants 1, 4, 8, 16, 32 or 64, got %s\n", argv[i]);
+                return 2;
+            }
+        }
+    }
+    
+    /* Saved results are meant to be compared, which needs a few trials per point */
+    if (savePath) {
+        recorded = create_result_set();
+        if (trials == 0) {
+            trials = 5;
+        }
+    }
+    if (trials > 0) {
+        set_cache_recorder(recorded, trials);
+    }
+    
+    print_m1_info();
+    
+    if (quickMode) {
+        /* Quick mode: only show native values */
+#if PLATFORM_MACOS
+        unsigned int l1i = 0, l1d = 0;
+        unsigned int l2 = 0, l3 = 0;
+        unsigned int line = 0;
+        
+        get_l1_cache_macOS(&l1i, &l1d);
+        l2 = get_l2_cache_macOS();
+        l3 = get_l3_cache_macOS();
+        line = get_cache_line_macOS();
+        
+        printf("Native Cache Information:\n");
+        if (l1d > 0) {
+            struct size_of_data f = unitfy_data_size(l1d);
+            printf("  L1 Data: %u%s\n", f.quantity, f.unit);
+        }
+        if (l2 > 0) {
+            struct size_of_data f = unitfy_data_size(l2);
+            printf("  L2: %u%s\n", f.quantity, f.unit);
+        }
+        if (l3 > 0) {
+            struct size_of_data f = unitfy_data_size(l3);
+            printf("  L3/SLC: %u%s\n", f.quantity, f.unit);
+        }
+        if (line > 0) {
+            struct size_of_data f = unitfy_data_size(line);
+            printf("  Cache Line: %u%s\n", f.quantity, f.unit);
+        }
+#elif PLATFORM_LINUX
+        unsigned int l1i = 0, l1d = 0;
+        unsigned int l2 = 0, l3 = 0;
+        unsigned int line = 0;
+        
+        get_l1_cache_linux(&l1i, &l1d);
+        l2 = get_l2_cache_linux();
+        l3 = get_l3_cache_linux();
+        line = get_cache_line_linux();
+        
+        printf("Native Cache Information:\n");
+        if (l1d > 0) {
+            struct size_of_data f = unitfy_data_size(l1d);
+            printf("  L1 Data: %u%s\n", f.quantity, f.unit);
+        }
+        if (l2 > 0) {
+            struct size_of_data f = unitfy_data_size(l2);
+            printf("  L2: %u%s\n", f.quantity, f.unit);
+        }
+        if (l3 > 0) {
+            struct size_of_data f = unitfy_data_size(l3);
+            printf("  L3: %u%s\n", f.quantity, f.unit);
+        }
+        if (line > 0) {
+            struct size_of_data f = unitfy_data_size(line);
+            printf("  Cache Line: %u%s\n", f.quantity, f.unit);
+        }
+#else
+        printf("Quick mode not supported on this platform\n");
+#endif
+    } else if (budgetSeconds > 0) {
+        /* Budgeted mode: best estimates by the deadline */
+        print_budgeted_detection(budgetSeconds, results);
+    } else {
+        /* Full mode: show both native and timing-based results */
+        print_cache_info(results);
+        if (streamMode) {
+            print_stream_bandwidth(results);
+        }
+        print_overhead_calibration();
+    }
+    
+    print_profile();
+    
+    if (recorded) {
+        if (quickMode || budgetSeconds > 0) {
+            fprintf(stderr, "Nothing recorded in %s mode, not saving %s\n", quickMode ? "quick" : "budgeted", savePath);
+        } else if (save_result_set(recorded, savePath) != 0) {
+            fprintf(stderr, "Failed to save results to %s\n", savePath);
+        } else {
+            printf("Saved results to %s\n", savePath);
+        }
+        set_cache_recorder(NULL, 1);
+        free_result_set(recorded);
+    }
+    
+    if (publishMode) {
+        const struct cache_topology_segment* segment = map_cache_topology();
+        struct cache_topology topology, published;
+        
+        get_native_topology(&topology);
+        topology.measuredL1 = results[0];
+        topology.measuredL2 = results[1];
+        topology.measuredL3 = results[2];
+        topology.measuredLineSize = results[3];
+        
+        /* Whatever this run didn't measure keeps what an earlier one published */
+        if (segment && read_cache_topology(segment, &published) == 0) {
+            if (!topology.measuredL1) {
+                topology.measuredL1 = published.measuredL1;
+            }
+            if (!topology.measuredL2) {
+                topology.measuredL2 = published.measuredL2;
+            }
+            if (!topology.measuredL3) {
+                topology.measuredL3 = published.measuredL3;
+            }
+            if (!topology.measuredLineSize) {
+                topology.measuredLineSize = published.measuredLineSize;
+            }
+        }
+        unmap_cache_topology(segment);
+        
+        if (publish_cache_topology(&topology) != 0) {
+            fprintf(stderr, "Failed to publish cache topology to %s\n", CACHE_TOPOLOGY_SHM_NAME);
+            return 1;
+        }
+        printf("\nPublished cache topology to %s\n", CACHE_TOPOLOGY_SHM_NAME);
     }
     
     return 0;
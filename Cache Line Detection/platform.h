@@ -33,6 +33,15 @@
 	#include <mach/mach.h>
 	#include <mach/mach_time.h>
 	typedef double timing_t;
+	
+	/* mach_absolute_time wrapper */
+	static inline double get_time_seconds(void) {
+		static mach_timebase_info_data_t timebase;
+		if (timebase.denom == 0) {
+			mach_timebase_info(&timebase);
+		}
+		return (double)mach_absolute_time() * timebase.numer / timebase.denom / 1e9;
+	}
 #elif PLATFORM_LINUX
 	#include <stdint.h>
 	#include <stdio.h>
@@ -57,10 +66,23 @@
 	/* Windows-specific includes would go here */
 	#include <windows.h>
 	typedef double timing_t;
+	
+	/* QueryPerformanceCounter wrapper */
+	static inline double get_time_seconds(void) {
+		LARGE_INTEGER frequency, counter;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+		return (double)counter.QuadPart / (double)frequency.QuadPart;
+	}
 #else
 	/* Fallback to POSIX */
 	#include <time.h>
 	typedef clock_t timing_t;
+	
+	/* Processor time only, but it's all we have */
+	static inline double get_time_seconds(void) {
+		return (double)clock() / CLOCKS_PER_SEC;
+	}
 #endif
 
 /* Convenience macro for platform-specific code */
@@ -0,0 +1,340 @@
+#include "prefetch.h"
+#include "cache.h"
+#include "fast_math.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* patternNames[PATTERN_COUNT] = {"Strided", "Gather", "Linked"};
+static const char* hintNames[HINT_COUNT] = {"T0", "T1", "T2", "NTA"};
+
+const char* prefetch_pattern_name(enum prefetch_pattern pattern)
+{
+	return (unsigned int)pattern < PATTERN_COUNT ? patternNames[pattern] : "?";
+}
+
+const char* prefetch_hint_name(enum prefetch_hint hint)
+{
+	return (unsigned int)hint < HINT_COUNT ? hintNames[hint] : "?";
+}
+
+#if defined(__GNUC__)
+
+#define TRIALS				3
+
+/* Elements a timed pass covers at most, and a trial at least, repeating passes over small working sets */
+#define MAX_PASS			(1024 * 1024)
+#define MIN_TRIAL			(1024 * 1024)
+
+/*
+	The set beyond a level, capped below the usual MAX_MEMORY_SET: each
+	pattern runs at every hint and distance, and gather needs an index
+	array as well, so a larger set costs a lot of time for no different
+	a distance. A level whose set the cap would cut short is skipped, as
+	the data would mostly still be in it.
+*/
+#define MAX_WORKING_SET		((size_t)128 * 1024 * 1024)
+
+#define STRIDE_LINES		2
+#define MAX_DISTANCE		128
+
+/* One per line; the rest of the line is padding */
+struct node
+{
+	struct node* next;
+	struct node* jump;
+	uint64_t value;
+};
+
+struct workload
+{
+	size_t elements;						/* Per pass */
+
+	const uint64_t* words;					/* Strided */
+	size_t strideWords;
+
+	const uint64_t* table;					/* Gather */
+	const unsigned int* indices;			/* Padded with MAX_DISTANCE more */
+	size_t lineWords;
+
+	const struct node* head;				/* Linked */
+};
+
+typedef uint64_t (*prefetch_kernel)(const struct workload* work, size_t distance);
+
+#define PREFETCH_T0(at)		__builtin_prefetch((at), 0, 3)
+#define PREFETCH_T1(at)		__builtin_prefetch((at), 0, 2)
+#define PREFETCH_T2(at)		__builtin_prefetch((at), 0, 1)
+#define PREFETCH_NTA(at)	__builtin_prefetch((at), 0, 0)
+#define PREFETCH_NONE(at)	((void)0)
+
+/*
+	The three patterns for one hint. __builtin_prefetch wants its
+	locality as a constant, so each hint gets its own copy rather than a
+	switch in the loop, which would cost more than some of the misses.
+*/
+#define DEFINE_KERNELS(suffix, PREFETCH) \
+static uint64_t strided_##suffix(const struct workload* work, size_t distance) \
+{ \
+	uint64_t sum = 0; \
+	size_t i; \
+	\
+	for(i = 0; i < work->elements; ++i) \
+	{ \
+		PREFETCH(work->words + (i + distance) * work->strideWords); \
+		sum += work->words[i * work->strideWords]; \
+	} \
+	\
+	return sum; \
+} \
+\
+static uint64_t gather_##suffix(const struct workload* work, size_t distance) \
+{ \
+	uint64_t sum = 0; \
+	size_t i; \
+	\
+	for(i = 0; i < work->elements; ++i) \
+	{ \
+		PREFETCH(work->table + (size_t)work->indices[i + distance] * work->lineWords); \
+		sum += work->table[(size_t)work->indices[i] * work->lineWords]; \
+	} \
+	\
+	return sum; \
+} \
+\
+static uint64_t linked_##suffix(const struct workload* work, size_t distance) \
+{ \
+	const struct node* node = work->head; \
+	uint64_t sum = 0; \
+	size_t i; \
+	\
+	for(i = 0; i < work->elements; ++i) \
+	{ \
+		PREFETCH(node->jump); \
+		sum += node->value; \
+		node = node->next; \
+	} \
+	\
+	return sum; \
+}
+
+DEFINE_KERNELS(t0, PREFETCH_T0)
+DEFINE_KERNELS(t1, PREFETCH_T1)
+DEFINE_KERNELS(t2, PREFETCH_T2)
+DEFINE_KERNELS(nta, PREFETCH_NTA)
+DEFINE_KERNELS(none, PREFETCH_NONE)
+
+/* By hint, then HINT_COUNT for no prefetches */
+static const prefetch_kernel kernels[HINT_COUNT + 1][PATTERN_COUNT] =
+{
+	{strided_t0, gather_t0, linked_t0},
+	{strided_t1, gather_t1, linked_t1},
+	{strided_t2, gather_t2, linked_t2},
+	{strided_nta, gather_nta, linked_nta},
+	{strided_none, gather_none, linked_none}
+};
+
+static volatile uint64_t sink;
+
+/* Median ns/element */
+static double time_kernel(prefetch_kernel kernel, const struct workload* work, size_t distance)
+{
+	const size_t passes = work->elements < MIN_TRIAL ? (MIN_TRIAL + work->elements - 1) / work->elements : 1;
+	double samples[TRIALS];
+	unsigned int trial;
+	size_t pass;
+
+	sink = kernel(work, distance);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+
+		for(pass = 0; pass < passes; ++pass)
+			sink = kernel(work, distance);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / ((double)passes * work->elements);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+/* A random cycle through one node per line, jump pointers to follow */
+static void link_nodes(char* buffer, const unsigned int* order, size_t count, unsigned int lineSize)
+{
+	size_t k;
+
+	for(k = 0; k < count; ++k)
+	{
+		struct node* node = (struct node*)(buffer + (size_t)order[k] * lineSize);
+
+		node->next = (struct node*)(buffer + (size_t)order[(k + 1) % count] * lineSize);
+		node->jump = node;
+		node->value = k;
+	}
+}
+
+static void set_jumps(char* buffer, const unsigned int* order, size_t count, unsigned int lineSize, size_t distance)
+{
+	size_t k;
+
+	for(k = 0; k < count; ++k)
+		((struct node*)(buffer + (size_t)order[k] * lineSize))->jump = (struct node*)(buffer + (size_t)order[(k + distance) % count] * lineSize);
+}
+
+static void sweep_pattern(enum prefetch_pattern pattern, const struct workload* work, const struct prefetch_result* result,
+	char* buffer, const unsigned int* order, size_t lines, struct prefetch_sweep* sweep)
+{
+	unsigned int hint, d;
+	double best;
+
+	sweep->baseline = time_kernel(kernels[HINT_COUNT][pattern], work, 0);
+
+	for(d = 0; d < PREFETCH_DISTANCES; ++d)
+	{
+		if(pattern == PATTERN_LINKED)
+			set_jumps(buffer, order, lines, result->lineSize, result->distances[d]);
+
+		for(hint = 0; hint < HINT_COUNT; ++hint)
+			sweep->nanos[hint][d] = time_kernel(kernels[hint][pattern], work, result->distances[d]);
+	}
+
+	best = sweep->nanos[0][0];
+	for(hint = 0; hint < HINT_COUNT; ++hint)
+	{
+		for(d = 0; d < PREFETCH_DISTANCES; ++d)
+		{
+			if(sweep->nanos[hint][d] < best)
+			{
+				best = sweep->nanos[hint][d];
+				sweep->bestHint = (enum prefetch_hint)hint;
+				sweep->bestDistance = d;
+			}
+		}
+	}
+	sweep->speedUp = sweep->baseline / best;
+}
+
+/* Strided and gather read the buffer as it is; linked, last, writes its nodes over it */
+static int measure_target(const struct prefetch_result* result, struct prefetch_target* target)
+{
+	const unsigned int lineSize = result->lineSize;
+	const size_t lines = target->bytes / lineSize;
+	const size_t slack = (size_t)MAX_DISTANCE * STRIDE_LINES * lineSize;
+	struct workload work;
+	unsigned int* order;
+	unsigned int* indices;
+	char* raw;
+	char* buffer;
+	size_t i;
+
+	raw = malloc(target->bytes + slack + lineSize);
+	order = malloc(lines * sizeof(unsigned int));
+	indices = malloc((lines + MAX_DISTANCE) * sizeof(unsigned int));
+	if(!raw || !order || !indices)
+	{
+		free(raw);
+		free(order);
+		free(indices);
+		return -1;
+	}
+
+	buffer = (char*)(((uintptr_t)raw + lineSize - 1) & ~(uintptr_t)(lineSize - 1));
+	memset(buffer, 1, target->bytes + slack);
+
+	shuffle_indices(order, (unsigned int)lines, 0x2545F491);
+	memcpy(indices, order, lines * sizeof(unsigned int));
+	for(i = 0; i < MAX_DISTANCE; ++i)
+		indices[lines + i] = order[i % lines];
+
+	memset(&work, 0, sizeof(work));
+
+	work.words = (const uint64_t*)buffer;
+	work.strideWords = (size_t)STRIDE_LINES * lineSize / sizeof(uint64_t);
+	work.elements = target->bytes / (STRIDE_LINES * lineSize);
+	if(work.elements > MAX_PASS)
+		work.elements = MAX_PASS;
+	sweep_pattern(PATTERN_STRIDED, &work, result, buffer, order, lines, &target->sweeps[PATTERN_STRIDED]);
+
+	work.table = (const uint64_t*)buffer;
+	work.indices = indices;
+	work.lineWords = lineSize / sizeof(uint64_t);
+	work.elements = lines < MAX_PASS ? lines : MAX_PASS;
+	sweep_pattern(PATTERN_GATHER, &work, result, buffer, order, lines, &target->sweeps[PATTERN_GATHER]);
+
+	link_nodes(buffer, order, lines, lineSize);
+	work.head = (const struct node*)(buffer + (size_t)order[0] * lineSize);
+	sweep_pattern(PATTERN_LINKED, &work, result, buffer, order, lines, &target->sweeps[PATTERN_LINKED]);
+
+	free(raw);
+	free(order);
+	free(indices);
+	return 0;
+}
+
+int tune_prefetch(unsigned int lineSize, const unsigned int levels[3], struct prefetch_result* result, const char** failure)
+{
+	unsigned int level, i;
+
+	memset(result, 0, sizeof(*result));
+
+	if(!is_power_of_two(lineSize) || lineSize < 32 || lineSize > 1024)
+	{
+		*failure = "the line size must be a power of two from 32 to 1024 bytes";
+		return -1;
+	}
+
+	result->lineSize = lineSize;
+	for(i = 0; i < PREFETCH_DISTANCES; ++i)
+		result->distances[i] = 1u << i;
+	result->linesPerElement[PATTERN_STRIDED] = STRIDE_LINES;
+	result->linesPerElement[PATTERN_GATHER] = 1;
+	result->linesPerElement[PATTERN_LINKED] = 1;
+
+	for(level = 1; level <= 3; ++level)
+	{
+		struct prefetch_target* target = &result->targets[result->count];
+
+		if(levels[level - 1] == 0 || (size_t)levels[level - 1] * LEVEL_MEMORY_MULTIPLE > MAX_WORKING_SET)
+			continue;
+
+		target->level = level;
+		target->bytes = get_set_beyond_level(levels[level - 1], MAX_WORKING_SET);
+		target->bytes -= target->bytes % ((size_t)STRIDE_LINES * lineSize);
+		result->count++;
+	}
+
+	if(result->count == 0)
+	{
+		*failure = "no cache level was detected, or none small enough";
+		return -1;
+	}
+
+	profile_phase_begin("prefetch tuning");
+	for(i = 0; i < result->count; ++i)
+	{
+		if(measure_target(result, &result->targets[i]) != 0)
+		{
+			profile_phase_end();
+			*failure = "out of memory";
+			return -1;
+		}
+	}
+	profile_phase_end();
+
+	return 0;
+}
+
+#else
+
+int tune_prefetch(unsigned int lineSize, const unsigned int levels[3], struct prefetch_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs GCC or Clang for __builtin_prefetch";
+	return -1;
+}
+
+#endif
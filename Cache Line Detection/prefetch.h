@@ -0,0 +1,90 @@
+#ifndef PREFETCH_INC
+#define PREFETCH_INC
+
+#include <stddef.h>
+
+/*
+	How far ahead software prefetches should reach, and with which hint,
+	for three access patterns over working sets four times each cache
+	level, so the data lives in the next one down (or memory). Sets are
+	at most 128MB, so a level over 32MB is skipped:
+
+		Strided	one 64-bit word every two lines, in order
+		Gather	a[b[i]], b walked in order, a read a line at a time
+				in random order
+		Linked	line sized nodes in random order, each holding a jump
+				pointer to the node "distance" hops ahead, set up
+				before timing, since chasing next pointers to get there
+				would be the very latency prefetching hides
+
+	Every pattern runs once without prefetches, then with each hint at
+	each distance. The hints are the compiler's localities, 3 to 0, which
+	x86 turns into prefetcht0, t1, t2 and prefetchnta. Distances are in
+	elements; in lines, that's twice as many for strided and the same
+	for the others.
+
+	Needs GCC or Clang for __builtin_prefetch.
+*/
+
+enum prefetch_pattern
+{
+	PATTERN_STRIDED,
+	PATTERN_GATHER,
+	PATTERN_LINKED,
+
+	PATTERN_COUNT
+};
+
+enum prefetch_hint
+{
+	HINT_T0,
+	HINT_T1,
+	HINT_T2,
+	HINT_NTA,
+
+	HINT_COUNT
+};
+
+#define PREFETCH_DISTANCES		8			/* 1 to 128 elements, doubling */
+#define PREFETCH_MAX_TARGETS	3
+
+struct prefetch_sweep
+{
+	double baseline;						/* ns/element without prefetches */
+	double nanos[HINT_COUNT][PREFETCH_DISTANCES];
+
+	/* The fastest of them all, whether or not it beats the baseline */
+	enum prefetch_hint bestHint;
+	unsigned int bestDistance;				/* Index into the distances */
+	double speedUp;							/* baseline over the best */
+};
+
+struct prefetch_target
+{
+	unsigned int level;						/* The level the working set is beyond, 1 to 3 */
+	size_t bytes;
+	struct prefetch_sweep sweeps[PATTERN_COUNT];
+};
+
+struct prefetch_result
+{
+	unsigned int lineSize;
+	unsigned int distances[PREFETCH_DISTANCES];
+	unsigned int linesPerElement[PATTERN_COUNT];
+
+	unsigned int count;
+	struct prefetch_target targets[PREFETCH_MAX_TARGETS];
+};
+
+const char* prefetch_pattern_name(enum prefetch_pattern pattern);
+const char* prefetch_hint_name(enum prefetch_hint hint);
+
+/*
+	"levels" are L1 to L3, 0 for any that weren't found. Returns 0 on
+	success, -1 with "failure" set otherwise: no prefetch builtin, no
+	level found, a line size that isn't a power of two from 32 to 1024
+	bytes, or out of memory.
+*/
+int tune_prefetch(unsigned int lineSize, const unsigned int levels[3], struct prefetch_result* result, const char** failure);
+
+#endif
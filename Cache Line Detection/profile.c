@@ -0,0 +1,200 @@
+#include "profile.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_PHASES			32
+#define MAX_PHASE_DEPTH		8
+#define PHASE_NAME_LENGTH	48
+
+struct profile_phase
+{
+	char name[PHASE_NAME_LENGTH];
+	unsigned int calls;
+	double wallSeconds;
+	double childSeconds;	/* Wall time spent in phases nested in this one */
+
+	double seconds[PROFILE_ACTIVITY_COUNT];
+	unsigned long long iterations[PROFILE_ACTIVITY_COUNT];
+	unsigned long long bytes[PROFILE_ACTIVITY_COUNT];
+};
+
+static int enabled = 0;
+
+static struct profile_phase phases[MAX_PHASES];
+static unsigned int phaseCount = 0;
+
+/* Currently open phases, innermost last */
+static struct profile_phase* stack[MAX_PHASE_DEPTH];
+static double stackBegin[MAX_PHASE_DEPTH];
+static unsigned int depth = 0;
+
+/* Phases begun past MAX_PHASE_DEPTH, not pushed; their ends pop nothing */
+static unsigned int skippedDepth = 0;
+
+/* Wall time of the outermost phases, i.e. everything that was profiled */
+static double topLevelSeconds = 0;
+
+void enable_profiling(void)
+{
+	enabled = 1;
+}
+
+int profiling_enabled(void)
+{
+	return enabled;
+}
+
+static struct profile_phase* find_or_add_phase(const char* name)
+{
+	unsigned int i;
+
+	for(i = 0; i < phaseCount; ++i)
+		if(strcmp(phases[i].name, name) == 0)
+			return &phases[i];
+
+	if(phaseCount == MAX_PHASES)
+		return NULL;
+
+	strncpy(phases[phaseCount].name, name, PHASE_NAME_LENGTH - 1);
+	return &phases[phaseCount++];
+}
+
+void profile_phase_begin(const char* name)
+{
+	if(!enabled)
+		return;
+
+	if(depth == MAX_PHASE_DEPTH)
+	{
+		++skippedDepth;
+		return;
+	}
+
+	/* A full table still pushes, so begin/end stay balanced. Its work goes nowhere. */
+	stack[depth] = find_or_add_phase(name);
+	stackBegin[depth] = get_time_seconds();
+	++depth;
+}
+
+void profile_phase_end(void)
+{
+	struct profile_phase* phase;
+	double elapsed;
+
+	if(!enabled)
+		return;
+
+	if(skippedDepth > 0)
+	{
+		--skippedDepth;
+		return;
+	}
+
+	if(depth == 0)
+		return;
+
+	--depth;
+	phase = stack[depth];
+	elapsed = get_time_seconds() - stackBegin[depth];
+
+	if(phase)
+	{
+		++phase->calls;
+		phase->wallSeconds += elapsed;
+	}
+
+	if(depth == 0)
+		topLevelSeconds += elapsed;
+	else if(stack[depth - 1])
+		stack[depth - 1]->childSeconds += elapsed;
+}
+
+void profile_activity(
+		enum profile_activity activity,
+		double seconds,
+		unsigned long long iterations,
+		unsigned long long bytes
+	)
+{
+	struct profile_phase* phase;
+
+	if(!enabled || depth == 0)
+		return;
+
+	phase = stack[depth - 1];
+	if(!phase)
+		return;
+
+	phase->seconds[activity] += seconds;
+	phase->iterations[activity] += iterations;
+	phase->bytes[activity] += bytes;
+}
+
+void print_profile(void)
+{
+	static const char* activityNames[PROFILE_ACTIVITY_COUNT] = {
+		"Allocation",
+		"Warm-up",
+		"Measured"
+	};
+
+	double totals[PROFILE_ACTIVITY_COUNT] = {0};
+	double other = topLevelSeconds;
+	unsigned int i, a;
+
+	if(!enabled)
+		return;
+
+	printf("=== Profile ===\n\n");
+	printf("%-34s %6s %9s %9s %9s %9s %9s %12s %12s\n",
+		"Phase", "Calls", "Wall(s)", "Alloc(s)", "Warm(s)", "Meas(s)", "Other(s)", "Iterations", "Touched(MB)");
+
+	for(i = 0; i < phaseCount; ++i)
+	{
+		const struct profile_phase* phase = &phases[i];
+		double phaseOther = phase->wallSeconds - phase->childSeconds;
+		unsigned long long iterations = 0;
+		unsigned long long bytes = 0;
+
+		for(a = 0; a < PROFILE_ACTIVITY_COUNT; ++a)
+		{
+			phaseOther -= phase->seconds[a];
+			totals[a] += phase->seconds[a];
+
+			/* Allocated bytes aren't touched by the allocation itself */
+			if(a != PROFILE_ALLOCATION)
+			{
+				iterations += phase->iterations[a];
+				bytes += phase->bytes[a];
+			}
+		}
+
+		printf("%-34s %6u %9.3f %9.3f %9.3f %9.3f %9.3f %12llu %12.1f\n",
+			phase->name,
+			phase->calls,
+			phase->wallSeconds,
+			phase->seconds[PROFILE_ALLOCATION],
+			phase->seconds[PROFILE_WARMUP],
+			phase->seconds[PROFILE_MEASUREMENT],
+			phaseOther > 0 ? phaseOther : 0,
+			iterations,
+			bytes / (1024.0 * 1024.0));
+	}
+
+	printf("\nBreakdown of the %.3fs spent in profiled phases:\n", topLevelSeconds);
+	for(a = 0; a < PROFILE_ACTIVITY_COUNT; ++a)
+	{
+		other -= totals[a];
+		printf("  %-10s %9.3fs (%5.1f%%)\n",
+			activityNames[a],
+			totals[a],
+			topLevelSeconds > 0 ? totals[a] / topLevelSeconds * 100 : 0);
+	}
+	printf("  %-10s %9.3fs (%5.1f%%)\n",
+		"Other",
+		other > 0 ? other : 0,
+		topLevelSeconds > 0 && other > 0 ? other / topLevelSeconds * 100 : 0);
+	printf("\n");
+}
@@ -0,0 +1,42 @@
+#ifndef PROFILE_INC
+#define PROFILE_INC
+
+/*
+	Self-profiling (--profile). The detection code marks the phases it
+	goes through, and reports the work it does inside of them, so we can
+	tell where a run spends its time.
+
+	Everything here is a no-op until enable_profiling() is called.
+*/
+
+enum profile_activity
+{
+	PROFILE_ALLOCATION,
+	PROFILE_WARMUP,
+	PROFILE_MEASUREMENT,
+
+	PROFILE_ACTIVITY_COUNT
+};
+
+void enable_profiling(void);
+int profiling_enabled(void);
+
+/*
+	Phases nest. Wall time is inclusive of nested phases, activities are
+	charged to the innermost phase only. Entering a phase with a name
+	that was seen before adds to it.
+*/
+void profile_phase_begin(const char* name);
+void profile_phase_end(void);
+
+/* "bytes" is the amount of memory the activity accessed, or allocated. */
+void profile_activity(
+		enum profile_activity activity,
+		double seconds,
+		unsigned long long iterations,
+		unsigned long long bytes
+	);
+
+void print_profile(void);
+
+#endif
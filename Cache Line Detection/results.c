@@ -0,0 +1,295 @@
+#include "results.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESULTS_FILE_HEADER		"cacheline_detect-results"
+#define RESULTS_FILE_VERSION	1
+
+struct result_set* create_result_set(void)
+{
+	return calloc(1, sizeof(struct result_set));
+}
+
+void free_result_set(struct result_set* results)
+{
+	unsigned int i;
+
+	if(!results)
+		return;
+
+	for(i = 0; i < results->curveCount; ++i)
+		free(results->curves[i].points);
+
+	free(results->curves);
+	free(results->capacities);
+	free(results);
+}
+
+static void copy_name(char* destination, const char* source)
+{
+	strncpy(destination, source, RESULT_NAME_LENGTH - 1);
+	destination[RESULT_NAME_LENGTH - 1] = '\0';
+}
+
+static struct result_curve* get_or_add_curve(struct result_set* results, const char* name, const char* unit)
+{
+	struct result_curve* curves;
+	struct result_curve* curve;
+	unsigned int i;
+
+	for(i = 0; i < results->curveCount; ++i)
+		if(strcmp(results->curves[i].name, name) == 0)
+			return &results->curves[i];
+
+	curves = realloc(results->curves, (results->curveCount + 1) * sizeof(struct result_curve));
+	if(!curves)
+		return NULL;
+
+	results->curves = curves;
+	curve = &curves[results->curveCount++];
+
+	memset(curve, 0, sizeof(*curve));
+	copy_name(curve->name, name);
+	copy_name(curve->unit, unit);
+
+	return curve;
+}
+
+/* Points are kept sorted by x, so printing and comparing can just walk them. */
+static struct result_point* get_or_add_point(struct result_curve* curve, unsigned int x)
+{
+	struct result_point* points;
+	unsigned int i, position;
+
+	for(position = 0; position < curve->pointCount && curve->points[position].x < x; ++position);
+
+	if(position < curve->pointCount && curve->points[position].x == x)
+		return &curve->points[position];
+
+	points = realloc(curve->points, (curve->pointCount + 1) * sizeof(struct result_point));
+	if(!points)
+		return NULL;
+
+	curve->points = points;
+
+	for(i = curve->pointCount; i > position; --i)
+		points[i] = points[i - 1];
+
+	++curve->pointCount;
+
+	points[position].x = x;
+	points[position].trialCount = 0;
+
+	return &points[position];
+}
+
+void record_result_trial(
+		struct result_set* results,
+		const char* curve,
+		const char* unit,
+		unsigned int x,
+		double value
+	)
+{
+	struct result_curve* targetCurve;
+	struct result_point* point;
+
+	targetCurve = get_or_add_curve(results, curve, unit);
+	if(!targetCurve)
+		return;
+
+	point = get_or_add_point(targetCurve, x);
+	if(!point || point->trialCount >= RESULT_MAX_TRIALS)
+		return;
+
+	point->trials[point->trialCount++] = value;
+}
+
+void record_result_capacity(struct result_set* results, const char* name, unsigned int bytes)
+{
+	struct result_capacity* capacities;
+	unsigned int i;
+
+	for(i = 0; i < results->capacityCount; ++i)
+	{
+		if(strcmp(results->capacities[i].name, name) == 0)
+		{
+			results->capacities[i].bytes = bytes;
+			return;
+		}
+	}
+
+	capacities = realloc(results->capacities, (results->capacityCount + 1) * sizeof(struct result_capacity));
+	if(!capacities)
+		return;
+
+	results->capacities = capacities;
+	copy_name(capacities[results->capacityCount].name, name);
+	capacities[results->capacityCount].bytes = bytes;
+	++results->capacityCount;
+}
+
+const struct result_curve* find_result_curve(const struct result_set* results, const char* name)
+{
+	unsigned int i;
+
+	for(i = 0; i < results->curveCount; ++i)
+		if(strcmp(results->curves[i].name, name) == 0)
+			return &results->curves[i];
+
+	return NULL;
+}
+
+const struct result_point* find_result_point(const struct result_curve* curve, unsigned int x)
+{
+	unsigned int i;
+
+	for(i = 0; i < curve->pointCount; ++i)
+		if(curve->points[i].x == x)
+			return &curve->points[i];
+
+	return NULL;
+}
+
+const struct result_capacity* find_result_capacity(const struct result_set* results, const char* name)
+{
+	unsigned int i;
+
+	for(i = 0; i < results->capacityCount; ++i)
+		if(strcmp(results->capacities[i].name, name) == 0)
+			return &results->capacities[i];
+
+	return NULL;
+}
+
+/*
+	The format is line based plain text, so a results file can be read
+	(and diffed) by humans as well:
+
+		cacheline_detect-results 1
+		capacity <name> <bytes>
+		curve <name> <unit>
+		point <curve> <x> <trial count> <trial> <trial> ...
+*/
+int save_result_set(const struct result_set* results, const char* path)
+{
+	FILE* fp;
+	unsigned int i, j, k;
+
+	fp = fopen(path, "w");
+	if(!fp)
+		return -1;
+
+	fprintf(fp, "%s %d\n", RESULTS_FILE_HEADER, RESULTS_FILE_VERSION);
+
+	for(i = 0; i < results->capacityCount; ++i)
+		fprintf(fp, "capacity %s %u\n", results->capacities[i].name, results->capacities[i].bytes);
+
+	for(i = 0; i < results->curveCount; ++i)
+	{
+		const struct result_curve* curve = &results->curves[i];
+
+		fprintf(fp, "curve %s %s\n", curve->name, curve->unit);
+
+		for(j = 0; j < curve->pointCount; ++j)
+		{
+			fprintf(fp, "point %s %u %u", curve->name, curve->points[j].x, curve->points[j].trialCount);
+
+			for(k = 0; k < curve->points[j].trialCount; ++k)
+				fprintf(fp, " %.6g", curve->points[j].trials[k]);
+
+			fprintf(fp, "\n");
+		}
+	}
+
+	return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int parse_point(struct result_set* results, char* line)
+{
+	const struct result_curve* curve;
+	char name[RESULT_NAME_LENGTH];
+	unsigned int x, count, i;
+	char* cursor;
+	char* end;
+	int consumed;
+
+	if(sscanf(line, "point %31s %u %u%n", name, &x, &count, &consumed) != 3)
+		return -1;
+
+	curve = find_result_curve(results, name);
+	if(!curve)
+		return -1;
+
+	cursor = line + consumed;
+
+	for(i = 0; i < count; ++i)
+	{
+		double value = strtod(cursor, &end);
+		if(end == cursor)
+			return -1;
+
+		record_result_trial(results, curve->name, curve->unit, x, value);
+		cursor = end;
+	}
+
+	return 0;
+}
+
+struct result_set* load_result_set(const char* path)
+{
+	struct result_set* results;
+	char line[4096];
+	char name[RESULT_NAME_LENGTH];
+	char unit[RESULT_NAME_LENGTH];
+	unsigned int bytes;
+	int version;
+	FILE* fp;
+
+	fp = fopen(path, "r");
+	if(!fp)
+		return NULL;
+
+	if(!fgets(line, sizeof(line), fp) ||
+		sscanf(line, RESULTS_FILE_HEADER " %d", &version) != 1 ||
+		version != RESULTS_FILE_VERSION)
+	{
+		fclose(fp);
+		return NULL;
+	}
+
+	results = create_result_set();
+
+	while(results && fgets(line, sizeof(line), fp))
+	{
+		int ok = 1;
+
+		if(strncmp(line, "capacity ", 9) == 0)
+		{
+			ok = sscanf(line, "capacity %31s %u", name, &bytes) == 2;
+			if(ok)
+				record_result_capacity(results, name, bytes);
+		}
+		else if(strncmp(line, "curve ", 6) == 0)
+		{
+			ok = sscanf(line, "curve %31s %31s", name, unit) == 2;
+			if(ok)
+				ok = get_or_add_curve(results, name, unit) != NULL;
+		}
+		else if(strncmp(line, "point ", 6) == 0)
+		{
+			ok = parse_point(results, line) == 0;
+		}
+
+		if(!ok)
+		{
+			free_result_set(results);
+			results = NULL;
+		}
+	}
+
+	fclose(fp);
+	return results;
+}
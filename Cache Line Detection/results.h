@@ -0,0 +1,80 @@
+#ifndef RESULTS_INC
+#define RESULTS_INC
+
+/*
+	Everything a run measured, in a form that can be saved and compared
+	against a later run.
+
+	A curve is one kernel swept over some parameter ("x" - usually the
+	working set size or the stride). Every point keeps all of its trials,
+	so two runs can be compared with proper significance tests instead
+	of eyeballing single numbers.
+*/
+
+#define RESULT_NAME_LENGTH	32
+#define RESULT_MAX_TRIALS	64
+
+struct result_point
+{
+	unsigned int x;
+	unsigned int trialCount;
+	double trials[RESULT_MAX_TRIALS];
+};
+
+struct result_curve
+{
+	char name[RESULT_NAME_LENGTH];
+
+	/*
+		"ns" for latencies (lower is better), "GB/s" for bandwidths
+		(higher is better).
+	*/
+	char unit[RESULT_NAME_LENGTH];
+
+	unsigned int pointCount;
+	struct result_point* points;
+};
+
+/* A detected size, e.g. "L2" -> 2097152. */
+struct result_capacity
+{
+	char name[RESULT_NAME_LENGTH];
+	unsigned int bytes;
+};
+
+struct result_set
+{
+	unsigned int curveCount;
+	struct result_curve* curves;
+
+	unsigned int capacityCount;
+	struct result_capacity* capacities;
+};
+
+struct result_set* create_result_set(void);
+void free_result_set(struct result_set* results);
+
+/* Appends one trial to the point, creating the curve and the point on first use. */
+void record_result_trial(
+		struct result_set* results,
+		const char* curve,
+		const char* unit,
+		unsigned int x,
+		double value
+	);
+
+/* Records (or overwrites) a detected size. */
+void record_result_capacity(struct result_set* results, const char* name, unsigned int bytes);
+
+/* These return NULL when there's no such curve/point/capacity. */
+const struct result_curve* find_result_curve(const struct result_set* results, const char* name);
+const struct result_point* find_result_point(const struct result_curve* curve, unsigned int x);
+const struct result_capacity* find_result_capacity(const struct result_set* results, const char* name);
+
+/* Returns 0 on success, -1 on failure. */
+int save_result_set(const struct result_set* results, const char* path);
+
+/* Returns NULL if the file can't be read or isn't a results file. */
+struct result_set* load_result_set(const char* path);
+
+#endif
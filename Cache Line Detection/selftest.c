@@ -0,0 +1,215 @@
+#include "selftest.h"
+#include "cache.h"
+#include "cache_sim.h"
+#include "format.h"
+
+#include <stdio.h>
+
+#define KB	(1024u)
+#define MB	(1024u * 1024u)
+
+/*
+	A simulated machine and what detection has to find on it.
+
+	Detection only tries power of two sizes, so the expected capacity is
+	the largest power of two that fits in the real one. Ranges that can't
+	see a boundary report the largest size they tried ("at least").
+*/
+struct reference_profile
+{
+	const char* name;
+	struct sim_config config;
+	unsigned int expected[4];	/* Same layout as get_all_cache_sizes: L1, L2, L3, line */
+};
+
+/*
+	Latencies are load-to-use cycles from public microbenchmarks, rounded.
+	They only need to get the shape of the curves right.
+*/
+static const struct reference_profile corpus[] = {
+	{
+		"Haswell i3",
+		{
+			64, 3, {
+				{32 * KB, 8, 4},
+				{256 * KB, 8, 12},
+				{3 * MB, 12, 36}	/* Smaller than the whole L3 range: it only ever sees memory */
+			},
+			200, SIM_REPLACEMENT_PLRU,
+			64, 4, 4 * KB, 9,
+			3.4
+		},
+		{32 * KB, 256 * KB, 2 * MB, 64}
+	},
+	{
+		"Skylake-SP",
+		{
+			64, 3, {
+				{32 * KB, 8, 4},
+				{1 * MB, 16, 14},
+				{27 * MB + 512 * KB, 11, 60}	/* 20 cores x 1.375MB, non-inclusive */
+			},
+			220, SIM_REPLACEMENT_PLRU,
+			64, 4, 4 * KB, 9,
+			2.4
+		},
+		{32 * KB, 1 * MB, 16 * MB, 64}
+	},
+	{
+		"Ice Lake-SP",
+		{
+			64, 3, {
+				{48 * KB, 12, 5},
+				{1 * MB + 256 * KB, 20, 14},
+				{60 * MB, 12, 70}	/* 40 cores x 1.5MB */
+			},
+			250, SIM_REPLACEMENT_PLRU,
+			64, 4, 4 * KB, 9,
+			2.3
+		},
+		{32 * KB, 1 * MB, 32 * MB, 64}
+	},
+	{
+		"Zen 2",
+		{
+			64, 3, {
+				{32 * KB, 8, 4},
+				{512 * KB, 8, 12},
+				{16 * MB, 16, 39}	/* Per CCX */
+			},
+			300, SIM_REPLACEMENT_LRU,
+			64, 64, 4 * KB, 7,
+			3.4
+		},
+		{32 * KB, 512 * KB, 16 * MB, 64}
+	},
+	{
+		"Zen 3",
+		{
+			64, 3, {
+				{32 * KB, 8, 4},
+				{512 * KB, 8, 12},
+				{32 * MB, 16, 46}
+			},
+			320, SIM_REPLACEMENT_LRU,
+			64, 64, 4 * KB, 7,
+			3.7
+		},
+		{32 * KB, 512 * KB, 32 * MB, 64}
+	},
+	{
+		"Zen 4 V-Cache",
+		{
+			64, 3, {
+				{32 * KB, 8, 4},
+				{1 * MB, 8, 14},
+				{96 * MB, 16, 50}	/* 32MB + 64MB stacked */
+			},
+			350, SIM_REPLACEMENT_LRU,
+			72, 72, 4 * KB, 7,
+			4.2
+		},
+		{32 * KB, 1 * MB, 64 * MB, 64}	/* L3 is beyond the 64MB the sweep goes up to */
+	},
+	{
+		"Graviton2",
+		{
+			64, 3, {
+				{64 * KB, 4, 4},
+				{1 * MB, 8, 11},
+				{32 * MB, 16, 60}	/* System level cache */
+			},
+			250, SIM_REPLACEMENT_LRU,
+			48, 48, 4 * KB, 5,
+			2.5
+		},
+		{64 * KB, 1 * MB, 32 * MB, 64}
+	},
+	{
+		"M1 (P-core)",
+		{
+			128, 2, {
+				{128 * KB, 8, 3},
+				{12 * MB, 12, 18}
+				/* The 8MB SLC is smaller than L2, a single core never hits in it */
+			},
+			320, SIM_REPLACEMENT_LRU,
+			160, 4, 16 * KB, 10,
+			3.2
+		},
+		{128 * KB, 8 * MB, 8 * MB, 128}	/* No L3: its range finds the L2 boundary again */
+	}
+};
+
+static int check(const char* what, unsigned int detected, unsigned int expected)
+{
+	struct size_of_data formatted = unitfy_data_size(detected);
+
+	if(detected == expected)
+	{
+		printf(" %s %u%s", what, formatted.quantity, formatted.unit);
+		return 1;
+	}
+	else
+	{
+		struct size_of_data formattedExpected = unitfy_data_size(expected);
+
+		printf(" %s %u%s (expected %u%s)", what,
+			formatted.quantity, formatted.unit,
+			formattedExpected.quantity, formattedExpected.unit);
+		return 0;
+	}
+}
+
+static int run_profile(const struct reference_profile* profile)
+{
+	struct cache_sim* sim;
+	unsigned int results[4];
+	unsigned int l1Boundary;
+	int passed = 1;
+
+	sim = create_cache_sim(&profile->config);
+	if(!sim)
+	{
+		printf("%-16s invalid simulator configuration\n", profile->name);
+		return 0;
+	}
+
+	printf("%-16s", profile->name);
+	fflush(stdout);
+
+	set_cache_simulator(sim);
+	get_all_cache_sizes(results);
+
+	/* The original API: with a line sized stride, the first boundary it finds is L1 */
+	set_cache_simulator(sim);
+	l1Boundary = get_cache_line(1 * MB, profile->expected[3]);
+
+	set_cache_simulator(NULL);
+	free_cache_sim(sim);
+
+	passed &= check("L1", results[0], profile->expected[0]);
+	passed &= check("L2", results[1], profile->expected[1]);
+	passed &= check("L3", results[2], profile->expected[2]);
+	passed &= check("line", results[3], profile->expected[3]);
+	passed &= check("get_cache_line", l1Boundary, profile->expected[0]);
+
+	printf("  %s\n", passed ? "PASS" : "FAIL");
+	return passed;
+}
+
+int run_selftest(void)
+{
+	unsigned int count = sizeof(corpus) / sizeof(corpus[0]);
+	unsigned int passed = 0;
+	unsigned int i;
+
+	printf("=== Detection Self-Test (simulated reference profiles) ===\n\n");
+
+	for(i = 0; i < count; ++i)
+		passed += run_profile(&corpus[i]);
+
+	printf("\n%u/%u profiles passed\n", passed, count);
+
+	return passed == count ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#ifndef SELFTEST_INC
+#define SELFTEST_INC
+
+/*
+	Runs the detection heuristics against a corpus of simulated reference
+	machines (a small-LLC Haswell, Skylake-SP, Ice Lake, Zen 2/3/4 with
+	V-Cache, Graviton and M1-like profiles) and checks them against the known answers, so a
+	heuristic tuned on one machine can't silently break all the others.
+
+	Returns 0 if every profile passed, 1 otherwise.
+*/
+int run_selftest(void);
+
+#endif
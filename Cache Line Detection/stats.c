@@ -0,0 +1,160 @@
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+double sample_mean(const double* samples, unsigned int count)
+{
+	double sum = 0;
+	unsigned int i;
+
+	if(count == 0)
+		return 0;
+
+	for(i = 0; i < count; ++i)
+		sum += samples[i];
+
+	return sum / count;
+}
+
+double sample_variance(const double* samples, unsigned int count)
+{
+	double mean, sum = 0;
+	unsigned int i;
+
+	if(count < 2)
+		return 0;
+
+	mean = sample_mean(samples, count);
+
+	for(i = 0; i < count; ++i)
+		sum += (samples[i] - mean) * (samples[i] - mean);
+
+	return sum / (count - 1);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+double sample_median(const double* samples, unsigned int count)
+{
+	double* sorted;
+	double median;
+
+	if(count == 0)
+		return 0;
+
+	sorted = malloc(count * sizeof(double));
+	if(!sorted)
+		return samples[0];
+
+	memcpy(sorted, samples, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), compare_doubles);
+
+	if(count & 1)
+		median = sorted[count / 2];
+	else
+		median = (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+
+	free(sorted);
+	return median;
+}
+
+/* Continued fraction for the incomplete beta function (modified Lentz's method). */
+static double incomplete_beta_fraction(double a, double b, double x)
+{
+	static const double tiny = 1e-300;
+	static const double epsilon = 1e-12;
+
+	double c = 1, d, h, term;
+	int m;
+
+	d = 1 - (a + b) * x / (a + 1);
+	if(fabs(d) < tiny)
+		d = tiny;
+	d = 1 / d;
+	h = d;
+
+	for(m = 1; m <= 200; ++m)
+	{
+		/* Even step */
+		term = m * (b - m) * x / ((a + 2*m - 1) * (a + 2*m));
+		d = 1 + term * d;
+		if(fabs(d) < tiny)
+			d = tiny;
+		c = 1 + term / c;
+		if(fabs(c) < tiny)
+			c = tiny;
+		d = 1 / d;
+		h *= d * c;
+
+		/* Odd step */
+		term = -(a + m) * (a + b + m) * x / ((a + 2*m) * (a + 2*m + 1));
+		d = 1 + term * d;
+		if(fabs(d) < tiny)
+			d = tiny;
+		c = 1 + term / c;
+		if(fabs(c) < tiny)
+			c = tiny;
+		d = 1 / d;
+		h *= d * c;
+
+		if(fabs(d * c - 1) < epsilon)
+			break;
+	}
+
+	return h;
+}
+
+/* The regularized incomplete beta function I_x(a, b). */
+static double regularized_incomplete_beta(double a, double b, double x)
+{
+	double front;
+
+	if(x <= 0)
+		return 0;
+	if(x >= 1)
+		return 1;
+
+	front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+
+	/* The fraction converges quickly on one side of the mean only. Use the symmetry otherwise. */
+	if(x < (a + 1) / (a + b + 2))
+		return front * incomplete_beta_fraction(a, b, x) / a;
+	else
+		return 1 - front * incomplete_beta_fraction(b, a, 1 - x) / b;
+}
+
+double welch_t_test(
+		const double* a, unsigned int countA,
+		const double* b, unsigned int countB
+	)
+{
+	double meanA, meanB, errorA, errorB, t, df;
+
+	if(countA < 2 || countB < 2)
+		return -1;
+
+	meanA = sample_mean(a, countA);
+	meanB = sample_mean(b, countB);
+	errorA = sample_variance(a, countA) / countA;
+	errorB = sample_variance(b, countB) / countB;
+
+	/* Both sides are perfectly repeatable. Any difference at all is significant. */
+	if(errorA + errorB == 0)
+		return meanA == meanB ? 1 : 0;
+
+	t = (meanA - meanB) / sqrt(errorA + errorB);
+
+	/* Welch-Satterthwaite degrees of freedom */
+	df = (errorA + errorB) * (errorA + errorB) /
+		(errorA * errorA / (countA - 1) + errorB * errorB / (countB - 1));
+
+	return regularized_incomplete_beta(df / 2, 0.5, df / (df + t * t));
+}
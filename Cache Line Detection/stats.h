@@ -0,0 +1,22 @@
+#ifndef STATS_INC
+#define STATS_INC
+
+double sample_mean(const double* samples, unsigned int count);
+
+/* Unbiased (n - 1) sample variance. 0 for fewer than two samples. */
+double sample_variance(const double* samples, unsigned int count);
+
+/* Sorts a copy, so "samples" is left alone. */
+double sample_median(const double* samples, unsigned int count);
+
+/*
+	Welch's unequal-variance t-test between two sets of samples.
+	Returns the two-sided p-value, or -1 if either side has fewer
+	than two samples and there's nothing to test.
+*/
+double welch_t_test(
+		const double* a, unsigned int countA,
+		const double* b, unsigned int countB
+	);
+
+#endif
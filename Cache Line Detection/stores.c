@@ -0,0 +1,373 @@
+#include "stores.h"
+#include "cache.h"
+#include "stats.h"
+#include "profile.h"
+#include "fast_math.h"
+#include "jit.h"
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if HAVE_CODE_GENERATION && defined(__x86_64__)
+
+#include <emmintrin.h>
+
+/* Well past any cache the loads could hit in */
+#define CHAIN_SIZE			(64 * 1024 * 1024)
+
+/*
+	Streaming bursts take the next slice of the buffer on every call,
+	wrapping around, so a line is written again only after the rest of
+	the buffer has been - long since written back from any LLC.
+*/
+#define STREAM_SIZE			(256 * 1024 * 1024)
+#define STREAM_SLICE		(16 * 1024 * 1024)
+#define COMBINING_SIZE		(8 * 1024 * 1024)
+#define LINE				64
+
+/* The resident stores all land in this many bytes */
+#define RESIDENT_AREA		4096
+
+#define BURST_STEP			8
+#define MAX_BURST			256
+#define MAX_STREAMS			32
+
+#define ITERATIONS			8192
+#define TRIALS				5
+
+#define CODE_SIZE			8192
+
+/* Where each chain is, so every call picks up where the last one stopped */
+typedef void (*burst_code)(void** chains[2], char* target, unsigned long iterations);
+
+/*
+	A random cycle through every line of a CHAIN_SIZE buffer, so each
+	load misses and nothing can prefetch it.
+*/
+static char* build_chain(unsigned int seed)
+{
+	const unsigned int lines = CHAIN_SIZE / LINE;
+	char* memory = malloc(CHAIN_SIZE);
+	unsigned int* order = malloc(lines * sizeof(unsigned int));
+	unsigned int i;
+
+	if(!memory || !order)
+	{
+		free(memory);
+		free(order);
+		return NULL;
+	}
+
+	shuffle_indices(order, lines, seed);
+
+	for(i = 0; i < lines; ++i)
+		*(void**)(memory + (size_t)order[i] * LINE) = memory + (size_t)order[(i + 1) % lines] * LINE;
+
+	free(order);
+	return memory;
+}
+
+static unsigned char* emit(unsigned char* at, const unsigned char* bytes, unsigned int count)
+{
+	memcpy(at, bytes, count);
+	return at + count;
+}
+
+static unsigned char* emit_store(unsigned char* at, int displacement)
+{
+	static const unsigned char store[] = {0x89, 0x86};	/* mov [rsi + disp32], eax */
+
+	at = emit(at, store, sizeof(store));
+	memcpy(at, &displacement, sizeof(displacement));
+	return at + sizeof(displacement);
+}
+
+/*
+	The loop, with the chains in r8 and r9, the target in rsi and the
+	count in rdx. Resident bursts store to every quadword of a page in
+	turn, streaming ones to a new line each, moving on by as many lines
+	every iteration.
+
+	The stores are unrolled, since a branch inside a burst that ever
+	mispredicted would throw away the second load. So the loop grows
+	by six bytes a store, 96 a step of the burst, and crossing a front end
+	limit (the uop cache, the loop stream detector) can show up as a
+	spike or step of its own. knee() ignores spikes that fall back.
+*/
+static burst_code generate_bursts(unsigned char* code, unsigned int burst, int streaming)
+{
+	static const unsigned char prologue[] = {0x4c, 0x8b, 0x07, 0x4c, 0x8b, 0x4f, 0x08};	/* mov r8, [rdi]; mov r9, [rdi + 8] */
+	static const unsigned char loadA[] = {0x4d, 0x8b, 0x00};							/* mov r8, [r8] */
+	static const unsigned char loadB[] = {0x4d, 0x8b, 0x09};							/* mov r9, [r9] */
+	static const unsigned char advance[] = {0x48, 0x81, 0xc6};							/* add rsi, imm32 */
+	static const unsigned char countDown[] = {0x48, 0xff, 0xca, 0x0f, 0x85};			/* dec rdx; jnz rel32 */
+	static const unsigned char epilogue[] = {0x4c, 0x89, 0x07, 0x4c, 0x89, 0x4f, 0x08, 0xc3};	/* mov [rdi], r8; mov [rdi + 8], r9; ret */
+
+	union
+	{
+		unsigned char* data;
+		burst_code function;
+	} entryPoint;
+
+	unsigned char* at = emit(code, prologue, sizeof(prologue));
+	unsigned char* loop = at;
+	unsigned int i;
+	int offset;
+
+	for(i = 0; i < 2 * burst; ++i)
+	{
+		if(i == 0)
+			at = emit(at, loadA, sizeof(loadA));
+		else if(i == burst)
+			at = emit(at, loadB, sizeof(loadB));
+
+		at = emit_store(at, streaming ? (int)(i * LINE) : (int)((i * 8) % RESIDENT_AREA));
+	}
+
+	if(streaming)
+	{
+		offset = (int)(2 * burst * LINE);
+		at = emit(at, advance, sizeof(advance));
+		memcpy(at, &offset, sizeof(offset));
+		at += sizeof(offset);
+	}
+
+	at = emit(at, countDown, sizeof(countDown));
+	offset = (int)(loop - (at + 4));
+	memcpy(at, &offset, sizeof(offset));
+	at = emit(at + 4, epilogue, sizeof(epilogue));
+
+	if(jit_seal(code, CODE_SIZE) != 0)
+		return NULL;
+
+	entryPoint.data = code;
+	return entryPoint.function;
+}
+
+/* The next streaming slice, wrapping to the start once the buffer runs out */
+static char* next_slice(char* target, size_t* offset)
+{
+	char* slice;
+
+	if(*offset + STREAM_SLICE > STREAM_SIZE)
+		*offset = 0;
+
+	slice = target + *offset;
+	*offset += STREAM_SLICE;
+	return slice;
+}
+
+/*
+	Median nanoseconds per iteration, or -1 if the code couldn't be made
+	executable. "offset" is where the next streaming slice starts.
+*/
+static double time_bursts(void** chains[2], char* target, size_t* offset, unsigned int burst, int streaming)
+{
+	unsigned char* code = jit_alloc(CODE_SIZE);
+	unsigned long iterations = ITERATIONS;
+	double samples[TRIALS];
+	burst_code run;
+	unsigned int trial;
+
+	if(!code)
+		return -1;
+
+	run = generate_bursts(code, burst, streaming);
+	if(!run)
+	{
+		jit_free(code, CODE_SIZE);
+		return -1;
+	}
+
+	/* Streaming bursts have to stay inside their slice */
+	if(streaming && iterations > STREAM_SLICE / (2 * burst * LINE))
+		iterations = STREAM_SLICE / (2 * burst * LINE);
+
+	run(chains, streaming ? next_slice(target, offset) : target, iterations);
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		char* slice = streaming ? next_slice(target, offset) : target;
+		double begin = get_time_seconds();
+
+		run(chains, slice, iterations);
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / iterations;
+	}
+
+	jit_free(code, CODE_SIZE);
+	return sample_median(samples, TRIALS);
+}
+
+/* Nanoseconds per line to stream the whole buffer "streams" lines at a time */
+static double time_combining(char* buffer, unsigned int streams)
+{
+	const size_t groupSize = (size_t)streams * LINE;
+	const size_t groups = COMBINING_SIZE / groupSize;
+	double samples[TRIALS];
+	unsigned int trial;
+
+	for(trial = 0; trial < TRIALS; ++trial)
+	{
+		double begin = get_time_seconds();
+		size_t group;
+
+		for(group = 0; group < groups; ++group)
+		{
+			char* base = buffer + group * groupSize;
+			unsigned int quad, line;
+
+			for(quad = 0; quad < LINE / 8; ++quad)
+				for(line = 0; line < streams; ++line)
+					_mm_stream_si64((long long*)(base + line * LINE + quad * 8), (long long)quad);
+
+			_mm_sfence();
+		}
+
+		samples[trial] = (get_time_seconds() - begin) * 1e9 / (groups * streams);
+	}
+
+	return sample_median(samples, TRIALS);
+}
+
+static void add_point(struct store_curve* curve, unsigned int burst, double nanos)
+{
+	curve->burst[curve->count] = burst;
+	curve->nanos[curve->count] = nanos;
+	curve->count++;
+}
+
+/* Points right after a knee that all have to be above the threshold */
+#define KNEE_RUN			4
+
+/*
+	Unlike a cache boundary these knees are a step to twice the time or
+	more, with noise on both sides and, for write combining, a fall
+	before it. The knee is the last point before the curve, past its
+	lowest point, crosses halfway to the median of its last quarter and
+	stays there: the next KNEE_RUN points all above it, and at least
+	three quarters of every point after. A spike of a point or two that
+	falls back isn't one.
+*/
+static unsigned int knee(const struct store_curve* curve)
+{
+	unsigned int quarter = curve->count / 4;
+	unsigned int lowest = 0;
+	unsigned int i, j, above;
+	double high, threshold;
+
+	if(quarter == 0)
+		return 0;
+
+	for(i = 1; i < curve->count; ++i)
+		if(curve->nanos[i] < curve->nanos[lowest])
+			lowest = i;
+
+	high = sample_median(curve->nanos + curve->count - quarter, quarter);
+	if(high < curve->nanos[lowest] * (1 + SIGNIFICANT_RISE))
+		return 0;
+
+	threshold = (curve->nanos[lowest] + high) / 2;
+
+	for(i = lowest + 1; i + 1 < curve->count; ++i)
+	{
+		above = 0;
+		for(j = i; j < curve->count; ++j)
+		{
+			if(curve->nanos[j] > threshold)
+				++above;
+			else if(j < i + KNEE_RUN)
+				break;
+		}
+
+		if(j == curve->count && above * 4 >= (curve->count - i) * 3)
+			return curve->burst[i - 1];
+	}
+
+	return 0;
+}
+
+int detect_store_buffers(struct store_result* result, const char** failure)
+{
+	char* chainA = build_chain(2463534242u);
+	char* chainB = build_chain(88675123u);
+	char* target = malloc(STREAM_SIZE);
+	void** chains[2];
+	unsigned int burst, streams;
+	size_t offset = 0;
+	double nanos = 0;
+
+	memset(result, 0, sizeof(*result));
+
+	if(!chainA || !chainB || !target)
+	{
+		free(chainA);
+		free(chainB);
+		free(target);
+		*failure = "not enough memory for the load chains";
+		return -1;
+	}
+
+	chains[0] = (void**)chainA;
+	chains[1] = (void**)chainB;
+	memset(target, 0, STREAM_SIZE);
+
+	profile_phase_begin("store buffer probe");
+	for(burst = BURST_STEP; nanos >= 0 && burst <= MAX_BURST; burst += BURST_STEP)
+	{
+		nanos = time_bursts(chains, target, &offset, burst, 0);
+		if(nanos >= 0)
+			add_point(&result->resident, burst, nanos);
+	}
+	for(burst = BURST_STEP; nanos >= 0 && burst <= MAX_BURST; burst += BURST_STEP)
+	{
+		nanos = time_bursts(chains, target, &offset, burst, 1);
+		if(nanos >= 0)
+			add_point(&result->streaming, burst, nanos);
+	}
+	profile_phase_end();
+
+	free(chainA);
+	free(chainB);
+
+	if(nanos < 0)
+	{
+		free(target);
+		*failure = jit_failure();
+		return -1;
+	}
+
+	/* The streaming target is as good a buffer as any to stream over again */
+	profile_phase_begin("write combining probe");
+	for(streams = 1; streams <= MAX_STREAMS; ++streams)
+		add_point(&result->combining, streams, time_combining(target, streams));
+	profile_phase_end();
+
+	free(target);
+
+	/* Two bursts are in the buffer at once, see stores.h */
+	result->storeBufferDepth = 2 * knee(&result->resident);
+	result->streamingDepth = 2 * knee(&result->streaming);
+
+	/*
+		Missing stores hold their entries longer, never more of them. A
+		crossing past the resident knee is the curve climbing with memory
+		bandwidth, one more line per store, not a buffer running out.
+	*/
+	if(result->storeBufferDepth && result->streamingDepth > result->storeBufferDepth)
+		result->streamingDepth = 0;
+	result->combiningBuffers = knee(&result->combining);
+
+	return 0;
+}
+
+#else
+
+int detect_store_buffers(struct store_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "the store probes need x86-64 and generated code";
+	return -1;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef STORES_INC
+#define STORES_INC
+
+/*
+	How many stores the core keeps in flight.
+
+	Store buffer: every iteration is two independent cache-missing loads,
+	each followed by a burst of N stores. The stores can't retire while
+	the load before them waits, so once one burst no longer fits in the
+	store buffer the second load can't issue until the first returns,
+	and an iteration costs two miss latencies instead of one. The bursts
+	go either to the same few L1 resident lines, or to fresh lines
+	streaming in from memory.
+
+	The depth is reported as two bursts, not one. The two chains miss
+	in turn, each load issuing while the other is still out, so the
+	burst behind the older load is still waiting to retire when the
+	burst behind the younger one is allocated: both hold entries at
+	once. A knee at 48 stores a burst is about 96 entries.
+
+	Write combining: non-temporal stores to N lines at once, a quadword
+	of each in turn, fenced after every N lines. While there's a buffer
+	per line they go out as whole lines, past that as fragments.
+
+	x86-64 only: the store buffer probe needs generated code.
+*/
+
+#define STORE_MAX_POINTS	64
+
+struct store_curve
+{
+	unsigned int count;
+	unsigned int burst[STORE_MAX_POINTS];	/* Stores per burst, or lines at once */
+	double nanos[STORE_MAX_POINTS];			/* Per iteration, or per line written */
+};
+
+struct store_result
+{
+	struct store_curve resident;
+	struct store_curve streaming;
+	struct store_curve combining;
+
+	/*
+		Store buffer entries, two of the largest bursts before the knee,
+		and the largest line count before it for write combining. 0 if
+		the curve has no knee.
+	*/
+	unsigned int storeBufferDepth;
+	unsigned int streamingDepth;
+	unsigned int combiningBuffers;
+};
+
+/*
+	Returns 0 on success, -1 if the probes can't run here, with "failure"
+	saying why (not x86-64, or executable memory refused).
+*/
+int detect_store_buffers(struct store_result* result, const char** failure);
+
+#endif
@@ -0,0 +1,241 @@
+#include "stream.h"
+#include "cache.h"
+#include "threads.h"
+#include "affinity.h"
+#include "stats.h"
+#include "profile.h"
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char* kernelNames[STREAM_KERNEL_COUNT] = {"Copy", "Scale", "Add", "Triad"};
+
+const char* stream_kernel_name(enum stream_kernel kernel)
+{
+	return (unsigned int)kernel < STREAM_KERNEL_COUNT ? kernelNames[kernel] : "?";
+}
+
+#if HAVE_THREADS
+
+/* Bytes each thread moves per trial, at least, and trials per point */
+#define TRIAL_BYTES			((size_t)128 * 1024 * 1024)
+#define TRIALS				5
+
+#define SCALAR				3.0
+
+/* Keeps one pass from being merged into the next */
+#if defined(__GNUC__)
+#define PASS_BARRIER()		__asm__ volatile("" : : : "memory")
+#else
+#define PASS_BARRIER()
+#endif
+
+static const unsigned int bytesPerElement[STREAM_KERNEL_COUNT] = {16, 16, 24, 24};
+
+static void run_kernel(enum stream_kernel kernel, double* a, double* b, double* c, size_t elements, unsigned int passes)
+{
+	const double q = SCALAR;
+	unsigned int pass;
+	size_t i;
+
+	for(pass = 0; pass < passes; ++pass)
+	{
+		switch(kernel)
+		{
+		case STREAM_COPY:
+			for(i = 0; i < elements; ++i)
+				a[i] = b[i];
+			break;
+		case STREAM_SCALE:
+			for(i = 0; i < elements; ++i)
+				b[i] = q * c[i];
+			break;
+		case STREAM_ADD:
+			for(i = 0; i < elements; ++i)
+				c[i] = a[i] + b[i];
+			break;
+		default:
+			for(i = 0; i < elements; ++i)
+				a[i] = b[i] + q * c[i];
+			break;
+		}
+
+		PASS_BARRIER();
+	}
+}
+
+struct stream_worker
+{
+	int failed;
+
+	/* When this thread started and finished each trial of each kernel */
+	double begin[STREAM_KERNEL_COUNT][TRIALS];
+	double end[STREAM_KERNEL_COUNT][TRIALS];
+};
+
+/* What every thread of a run shares */
+struct stream_run
+{
+	size_t elements;						/* Of each array, per thread */
+	unsigned int passes;
+	struct thread_barrier barrier;
+	struct stream_worker* workers;
+};
+
+/*
+	Every thread goes through every barrier, even without its arrays,
+	so one failed allocation can't leave the others waiting forever.
+*/
+static void stream_thread(unsigned int index, void* context)
+{
+	struct stream_run* run = context;
+	struct stream_worker* worker = &run->workers[index];
+	size_t elements = run->elements;
+	double *a, *b, *c;
+	unsigned int kernel, trial;
+	size_t i;
+
+	a = malloc(elements * sizeof(double));
+	b = malloc(elements * sizeof(double));
+	c = malloc(elements * sizeof(double));
+
+	if(!a || !b || !c)
+	{
+		worker->failed = 1;
+		elements = 0;
+	}
+
+	/* First touch, from the thread that will use them */
+	for(i = 0; i < elements; ++i)
+	{
+		a[i] = 1.0;
+		b[i] = 2.0;
+		c[i] = 0.0;
+	}
+
+	for(kernel = 0; kernel < STREAM_KERNEL_COUNT; ++kernel)
+	{
+		run_kernel((enum stream_kernel)kernel, a, b, c, elements, 1);
+
+		for(trial = 0; trial < TRIALS; ++trial)
+		{
+			thread_barrier_wait(&run->barrier);
+			worker->begin[kernel][trial] = get_time_seconds();
+			run_kernel((enum stream_kernel)kernel, a, b, c, elements, run->passes);
+			worker->end[kernel][trial] = get_time_seconds();
+		}
+	}
+
+	free(a);
+	free(b);
+	free(c);
+}
+
+/*
+	GB/s of each kernel with "arrayBytes" per array per thread. A trial
+	lasts from the first thread starting to the last one finishing.
+	Returns -1 if a thread couldn't be started or get its arrays.
+*/
+static int run_threads(unsigned int threads, size_t arrayBytes, double bandwidth[STREAM_KERNEL_COUNT])
+{
+	struct stream_worker* workers = calloc(threads, sizeof(struct stream_worker));
+	struct stream_run run;
+	unsigned int kernel, trial, t;
+	int failed;
+
+	if(!workers)
+		return -1;
+
+	run.elements = arrayBytes / sizeof(double);
+	run.passes = (unsigned int)(TRIAL_BYTES / (3 * arrayBytes));
+	if(run.passes == 0)
+		run.passes = 1;
+	run.workers = workers;
+
+	thread_barrier_init(&run.barrier, threads);
+	failed = run_pinned_threads(threads, stream_thread, &run) != 0;
+	thread_barrier_destroy(&run.barrier);
+
+	for(t = 0; t < threads; ++t)
+		if(workers[t].failed)
+			failed = 1;
+
+	for(kernel = 0; kernel < STREAM_KERNEL_COUNT && !failed; ++kernel)
+	{
+		double samples[TRIALS];
+
+		for(trial = 0; trial < TRIALS; ++trial)
+		{
+			double begin = workers[0].begin[kernel][trial];
+			double end = workers[0].end[kernel][trial];
+
+			for(t = 1; t < threads; ++t)
+			{
+				if(workers[t].begin[kernel][trial] < begin)
+					begin = workers[t].begin[kernel][trial];
+				if(workers[t].end[kernel][trial] > end)
+					end = workers[t].end[kernel][trial];
+			}
+
+			samples[trial] = (double)bytesPerElement[kernel] * run.elements * run.passes * threads / (end - begin) / 1e9;
+		}
+
+		bandwidth[kernel] = sample_median(samples, TRIALS);
+	}
+
+	free(workers);
+	return failed ? -1 : 0;
+}
+
+static void add_target(struct stream_result* result, unsigned int level, size_t arrayBytes)
+{
+	struct stream_target* target = &result->targets[result->count++];
+
+	target->level = level;
+	target->arrayBytes = arrayBytes;
+}
+
+int measure_stream(const unsigned int levels[3], struct stream_result* result, const char** failure)
+{
+	struct level_target targets[MAX_LEVEL_TARGETS];
+	unsigned int count, i;
+
+	memset(result, 0, sizeof(*result));
+	result->threads = (unsigned int)get_cpu_count();
+
+	/* Three arrays in half the level; from memory, each array is the whole set */
+	count = get_level_targets(levels, 6, MAX_MEMORY_SET, targets);
+	for(i = 0; i < count; ++i)
+		add_target(result, targets[i].level, targets[i].bytes);
+
+	profile_phase_begin("STREAM kernels");
+	for(i = 0; i < result->count; ++i)
+	{
+		struct stream_target* target = &result->targets[i];
+		int shared = target->level == 0 || target->level == 3;
+		size_t perThread = shared ? target->arrayBytes / result->threads : target->arrayBytes;
+
+		if(run_threads(1, target->arrayBytes, target->single) != 0 ||
+		   run_threads(result->threads, perThread, target->all) != 0)
+		{
+			profile_phase_end();
+			*failure = "not enough memory or threads for the arrays";
+			return -1;
+		}
+	}
+	profile_phase_end();
+
+	return 0;
+}
+
+#else
+
+int measure_stream(const unsigned int levels[3], struct stream_result* result, const char** failure)
+{
+	memset(result, 0, sizeof(*result));
+	*failure = "needs POSIX threads";
+	return -1;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef STREAM_INC
+#define STREAM_INC
+
+#include <stddef.h>
+
+/*
+	STREAM's four kernels, on arrays of doubles sized from the cache
+	hierarchy rather than by hand:
+
+		Copy	a[i] = b[i]
+		Scale	b[i] = q * c[i]
+		Add		c[i] = a[i] + b[i]
+		Triad	a[i] = b[i] + q * c[i]
+
+	For each level the three arrays fill half of it, per thread for L1
+	and L2 (assumed private) and between all threads for L3 (shared).
+	For memory each array is four times the last level, STREAM's own
+	rule, so nothing is left in any cache.
+
+	Every size runs on one thread, then on one per logical CPU, each
+	thread touching its own part of the arrays first so it's local to
+	it. Bandwidth counts the bytes the kernel names, as STREAM does:
+	16 per element for Copy and Scale, 24 for Add and Triad, write
+	allocate traffic not included.
+
+	Needs POSIX threads (Linux and macOS).
+*/
+
+enum stream_kernel
+{
+	STREAM_COPY,
+	STREAM_SCALE,
+	STREAM_ADD,
+	STREAM_TRIAD,
+
+	STREAM_KERNEL_COUNT
+};
+
+#define STREAM_MAX_TARGETS		4
+
+struct stream_target
+{
+	unsigned int level;						/* 1 to 3, or 0 for memory */
+	size_t arrayBytes;						/* Each array, over all threads for shared levels */
+
+	/* GB/s, median of the trials */
+	double single[STREAM_KERNEL_COUNT];
+	double all[STREAM_KERNEL_COUNT];
+};
+
+struct stream_result
+{
+	unsigned int threads;
+	unsigned int count;
+	struct stream_target targets[STREAM_MAX_TARGETS];
+};
+
+const char* stream_kernel_name(enum stream_kernel kernel);
+
+/*
+	"levels" are the L1, L2 and L3 sizes, 0 for any that weren't found
+	(they're skipped). Returns 0 on success, -1 if it can't run here or
+	there's no memory for the arrays, with "failure" saying why.
+*/
+int measure_stream(const unsigned int levels[3], struct stream_result* result, const char** failure);
+
+#endif
@@ -0,0 +1,164 @@
+#include "threads.h"
+#include "affinity.h"
+
+#include <stdlib.h>
+
+#if HAVE_THREADS
+
+void thread_barrier_init(struct thread_barrier* barrier, unsigned int count)
+{
+	pthread_mutex_init(&barrier->lock, NULL);
+	pthread_cond_init(&barrier->released, NULL);
+	barrier->count = count;
+	barrier->waiting = 0;
+	barrier->generation = 0;
+}
+
+void thread_barrier_destroy(struct thread_barrier* barrier)
+{
+	pthread_cond_destroy(&barrier->released);
+	pthread_mutex_destroy(&barrier->lock);
+}
+
+void thread_barrier_wait(struct thread_barrier* barrier)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&barrier->lock);
+	generation = barrier->generation;
+
+	if(++barrier->waiting == barrier->count)
+	{
+		barrier->waiting = 0;
+		barrier->generation++;
+		pthread_cond_broadcast(&barrier->released);
+	}
+	else
+	{
+		while(generation == barrier->generation)
+			pthread_cond_wait(&barrier->released, &barrier->lock);
+	}
+
+	pthread_mutex_unlock(&barrier->lock);
+}
+
+enum gate_state
+{
+	GATE_CLOSED,
+	GATE_OPEN,
+	GATE_ABORTED							/* Not every thread started */
+};
+
+/* Holds the threads back until all of them exist */
+struct thread_group
+{
+	void (*work)(unsigned int index, void* context);
+	void* context;
+	const int* cpus;						/* Per thread, or NULL for index modulo cpuCount */
+	unsigned int cpuCount;
+
+	pthread_mutex_t gateLock;
+	pthread_cond_t gateChanged;
+	enum gate_state gate;
+	unsigned int pinned;					/* Threads that tried to pin themselves so far */
+	int pinFailed;							/* Only counts with explicit cpus */
+};
+
+struct group_member
+{
+	struct thread_group* group;
+	unsigned int index;
+};
+
+static void set_gate(struct thread_group* group, enum gate_state state)
+{
+	pthread_mutex_lock(&group->gateLock);
+	group->gate = state;
+	pthread_cond_broadcast(&group->gateChanged);
+	pthread_mutex_unlock(&group->gateLock);
+}
+
+static void* group_thread(void* argument)
+{
+	struct group_member* member = argument;
+	struct thread_group* group = member->group;
+	enum gate_state state;
+	int failed = pin_current_thread(group->cpus ? group->cpus[member->index] : (int)(member->index % group->cpuCount)) != 0;
+
+	pthread_mutex_lock(&group->gateLock);
+	group->pinned++;
+	if(failed && group->cpus)
+		group->pinFailed = 1;
+	pthread_cond_broadcast(&group->gateChanged);
+
+	while(group->gate == GATE_CLOSED)
+		pthread_cond_wait(&group->gateChanged, &group->gateLock);
+	state = group->gate;
+	pthread_mutex_unlock(&group->gateLock);
+
+	if(state == GATE_OPEN)
+		group->work(member->index, group->context);
+
+	return NULL;
+}
+
+int run_threads_on_cpus(unsigned int count, const int* cpus, void (*work)(unsigned int index, void* context), void* context)
+{
+	struct group_member* members = calloc(count, sizeof(struct group_member));
+	pthread_t* handles = calloc(count, sizeof(pthread_t));
+	struct thread_group group;
+	unsigned int started = 0;
+	unsigned int t;
+
+	if(!members || !handles)
+	{
+		free(members);
+		free(handles);
+		return -1;
+	}
+
+	group.work = work;
+	group.context = context;
+	group.cpus = cpus;
+	group.cpuCount = (unsigned int)get_cpu_count();
+	group.gate = GATE_CLOSED;
+	group.pinned = 0;
+	group.pinFailed = 0;
+	pthread_mutex_init(&group.gateLock, NULL);
+	pthread_cond_init(&group.gateChanged, NULL);
+
+	for(t = 0; t < count; ++t)
+	{
+		members[t].group = &group;
+		members[t].index = t;
+
+		if(pthread_create(&handles[t], NULL, group_thread, &members[t]) != 0)
+			break;
+		started++;
+	}
+
+	/* Every thread pins itself before any of them runs, so one that couldn't can still stop the rest */
+	pthread_mutex_lock(&group.gateLock);
+	while(group.pinned < started)
+		pthread_cond_wait(&group.gateChanged, &group.gateLock);
+	pthread_mutex_unlock(&group.gateLock);
+
+	set_gate(&group, started == count && !group.pinFailed ? GATE_OPEN : GATE_ABORTED);
+
+	for(t = 0; t < started; ++t)
+		pthread_join(handles[t], NULL);
+
+	pthread_cond_destroy(&group.gateChanged);
+	pthread_mutex_destroy(&group.gateLock);
+	free(members);
+	free(handles);
+
+	return started == count && !group.pinFailed ? 0 : -1;
+}
+
+int run_pinned_threads(unsigned int count, void (*work)(unsigned int index, void* context), void* context)
+{
+	return run_threads_on_cpus(count, NULL, work, context);
+}
+
+#endif
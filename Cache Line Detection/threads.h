@@ -0,0 +1,56 @@
+#ifndef THREADS_INC
+#define THREADS_INC
+
+#include "platform.h"
+
+/*
+	Probes that load several cores at once: a group of threads, each
+	pinned to its own logical CPU, none of them starting until all of
+	them exist, and a barrier to keep their trials in step.
+*/
+
+#if PLATFORM_LINUX || PLATFORM_MACOS
+#define HAVE_THREADS	1
+#else
+#define HAVE_THREADS	0
+#endif
+
+#if HAVE_THREADS
+
+#include <pthread.h>
+
+/* pthread_barrier_t is missing on macOS */
+struct thread_barrier
+{
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+	unsigned int count;
+	unsigned int waiting;
+	unsigned int generation;
+};
+
+void thread_barrier_init(struct thread_barrier* barrier, unsigned int count);
+void thread_barrier_destroy(struct thread_barrier* barrier);
+void thread_barrier_wait(struct thread_barrier* barrier);
+
+/*
+	Runs work(index, context) on "count" new threads, thread "index"
+	pinned to CPU index (modulo the CPU count), and waits for all of
+	them. The caller's own thread and affinity are left alone. Returns
+	0, or -1 if not every thread could be started, in which case none
+	of them ran "work".
+*/
+int run_pinned_threads(unsigned int count, void (*work)(unsigned int index, void* context), void* context);
+
+/*
+	The same, thread "index" pinned to cpus[index] instead. Here the
+	placement is the point, so a thread that can't be pinned (a CPU
+	outside the affinity mask, or macOS) is a failure: -1, and none of
+	them ran "work". run_pinned_threads only spreads the load, and runs
+	unpinned where it has to.
+*/
+int run_threads_on_cpus(unsigned int count, const int* cpus, void (*work)(unsigned int index, void* context), void* context);
+
+#endif
+
+#endif
@@ -0,0 +1,138 @@
+#include "topology_shm.h"
+#include "platform.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if PLATFORM_LINUX || PLATFORM_MACOS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* A writer that dies half way through leaves the sequence odd forever. Don't spin on it. */
+#define READ_RETRIES	1000
+
+int publish_cache_topology(const struct cache_topology* topology)
+{
+	struct cache_topology_segment* segment;
+	unsigned int sequence;
+	int fd;
+
+	fd = shm_open(CACHE_TOPOLOGY_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if(fd < 0)
+		return -1;
+
+	if(ftruncate(fd, sizeof(*segment)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	segment = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(segment == MAP_FAILED)
+		return -1;
+
+	sequence = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+
+	/* An odd leftover from a crashed writer - step over it so readers see a change. */
+	if(sequence & 1)
+		++sequence;
+
+	__atomic_store_n(&segment->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	segment->magic = CACHE_TOPOLOGY_MAGIC;
+	segment->version = CACHE_TOPOLOGY_VERSION;
+	segment->topology = *topology;
+
+	__atomic_store_n(&segment->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+	munmap(segment, sizeof(*segment));
+	return 0;
+}
+
+const struct cache_topology_segment* map_cache_topology(void)
+{
+	const struct cache_topology_segment* segment;
+	struct stat info;
+	int fd;
+
+	fd = shm_open(CACHE_TOPOLOGY_SHM_NAME, O_RDONLY, 0);
+	if(fd < 0)
+		return NULL;
+
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(*segment))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	segment = mmap(NULL, sizeof(*segment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(segment == MAP_FAILED)
+		return NULL;
+
+	if(segment->magic != CACHE_TOPOLOGY_MAGIC || segment->version != CACHE_TOPOLOGY_VERSION)
+	{
+		unmap_cache_topology(segment);
+		return NULL;
+	}
+
+	return segment;
+}
+
+int read_cache_topology(const struct cache_topology_segment* segment, struct cache_topology* out)
+{
+	unsigned int before, after;
+	int i;
+
+	for(i = 0; i < READ_RETRIES; ++i)
+	{
+		before = __atomic_load_n(&segment->sequence, __ATOMIC_ACQUIRE);
+		if(before & 1)
+			continue;
+
+		memcpy(out, &segment->topology, sizeof(*out));
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&segment->sequence, __ATOMIC_RELAXED);
+
+		if(before == after)
+			return 0;
+	}
+
+	return -1;
+}
+
+void unmap_cache_topology(const struct cache_topology_segment* segment)
+{
+	if(segment)
+		munmap((void*)segment, sizeof(*segment));
+}
+
+#else
+
+int publish_cache_topology(const struct cache_topology* topology)
+{
+	return -1;
+}
+
+const struct cache_topology_segment* map_cache_topology(void)
+{
+	return NULL;
+}
+
+int read_cache_topology(const struct cache_topology_segment* segment, struct cache_topology* out)
+{
+	return -1;
+}
+
+void unmap_cache_topology(const struct cache_topology_segment* segment)
+{
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef TOPOLOGY_SHM_INC
+#define TOPOLOGY_SHM_INC
+
+/*
+	Publishes the detected cache geometry in a POSIX shared memory
+	segment, so other processes on the host can look it up instead of
+	running detection (or poking sysfs) themselves.
+*/
+
+#define CACHE_TOPOLOGY_SHM_NAME	"/cacheline_detect.topology"
+#define CACHE_TOPOLOGY_MAGIC	0x43414348u	/* "CACH" */
+#define CACHE_TOPOLOGY_VERSION	1
+
+/*
+	All sizes are in bytes, 0 meaning "unknown". The native values come
+	from sysfs/sysctl, the measured ones from the timing analysis. A run
+	that didn't measure a level (--quick, or --budget falling back on the
+	native value) leaves whatever an earlier run published for it.
+*/
+struct cache_topology
+{
+	unsigned int lineSize;
+	unsigned int l1i;
+	unsigned int l1d;
+	unsigned int l2;
+	unsigned int l3;
+
+	unsigned int measuredLineSize;
+	unsigned int measuredL1;
+	unsigned int measuredL2;
+	unsigned int measuredL3;
+};
+
+/*
+	The layout of the shared segment. It is protected by a seqlock:
+	the writer makes "sequence" odd while it updates "topology", and
+	even again afterwards.
+
+	Measured values change from one run to the next, so don't load
+	fields from the segment directly: take a snapshot with
+	read_cache_topology().
+*/
+struct cache_topology_segment
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int sequence;
+	struct cache_topology topology;
+};
+
+/* Creates (or updates) the shared segment. Returns 0 on success, -1 on failure. */
+int publish_cache_topology(const struct cache_topology* topology);
+
+/*
+	Maps the published segment read-only. Returns NULL if nothing was
+	published yet, the segment has a different version, or shared memory
+	isn't supported on this platform.
+*/
+const struct cache_topology_segment* map_cache_topology(void);
+
+/* Takes a consistent snapshot of the segment. Returns 0 on success, -1 on failure. */
+int read_cache_topology(const struct cache_topology_segment* segment, struct cache_topology* out);
+
+void unmap_cache_topology(const struct cache_topology_segment* segment);
+
+#endif